@@ -1,17 +1,84 @@
 #include "arena.h"
+#include "tracer.h"
 #include <assert.h>
+#include <atomic>
 
 namespace mem
 {
 
+// NOTE: series of the Arena::used counter, one per arena so two arenas never
+// share one even if their addresses only differ in the high bits
+static std::atomic<u32> arena_next_trace_id(1);
+
+/*@docs------------------------------------------------
+[FNC]:  - Arena(Memory *mem, u64 size)
+[DES]:  - takes a span of (mem), it goes back to (mem) when the arena is
+          destroyed, only a span never used before in this run is restored
+[IN ]:
+        - mem (Memory *): pointer to a memory object
+        - size (u64): size of the arena in bytes
+[OUT]:
+        - arena (Arena): new Arena object
+-----------------------------------------------------*/
 Arena::Arena(Memory *mem, u64 size)
 {
     u64 size_a = align8(size);
-    assert(mem->_used + size_a <= mem->_size);
+    assert(size_a >= sizeof(ArenaHeader));
+    bool fresh;
     _size = size_a;
-    _base = mem->_base + mem->_used;
-    _used = 0;
-    mem->_used += size_a;
+    _base = mem->allocate_span(size_a, &fresh);
+    _memory = mem;
+    _trace_id = arena_next_trace_id.fetch_add(1, std::memory_order_relaxed);
+    
+    _header = (ArenaHeader *)_base;
+    _restored = fresh && mem->_restored && _header->_magic == ARENA_MAGIC;
+    if(_restored)
+    {
+        _used = _header->_used;
+    }
+    else
+    {
+        _used = sizeof(ArenaHeader);
+        _header->_root = 0;
+    }
+    // NOTE: mark the header dirty until the arena is closed
+    _header->_magic = 0;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Arena(u8 *data, u64 size)
+[DES]:  - arena over a region owned by someone else (a block of a parent
+          heap or arena), it is never restored
+[IN ]:
+        - data (u8 *): 8 byte aligned start of the region
+        - size (u64): size of the region in bytes
+[OUT]:
+        - arena (Arena): new Arena object
+-----------------------------------------------------*/
+Arena::Arena(u8 *data, u64 size)
+{
+    assert(((u64)data & 7) == 0);
+    _size = size & ~7ULL;
+    assert(_size >= sizeof(ArenaHeader));
+    _base = data;
+    _memory = 0;
+    _trace_id = arena_next_trace_id.fetch_add(1, std::memory_order_relaxed);
+    _header = (ArenaHeader *)_base;
+    _restored = false;
+    _used = sizeof(ArenaHeader);
+    _header->_root = 0;
+    _header->_magic = 0;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - ~Arena()
+[DES]:  - saves the state in the header then gives the span back to the
+          Memory object, a file backed span keeps its content for the next run
+-----------------------------------------------------*/
+Arena::~Arena()
+{
+    sync_header();
+    if(_memory) _memory->free_span(_base, _size);
 }
 
 u8 *Arena::push_size(u64 size)
@@ -19,13 +86,52 @@ u8 *Arena::push_size(u64 size)
     assert(_used + size <= _size);
     u8 *result = _base + _used;
     _used += size;
+    Tracer::counter("Arena::used", _trace_id, _used);
     return result;
 }
 
+/*@docs------------------------------------------------
+[FNC]:  - Arena::push_aligned(u64 size, u64 alignment)
+[IN ]:
+        - size (u64): number of bytes to push
+        - alignment (u64): power of two, alignment of the returned pointer
+[OUT]:
+        - data (u8 *): pointer to the pushed bytes
+-----------------------------------------------------*/
+u8 *Arena::push_aligned(u64 size, u64 alignment)
+{
+    assert(alignment && (alignment & (alignment - 1)) == 0);
+    u64 padding = (alignment - ((u64)(_base + _used) & (alignment - 1))) & (alignment - 1);
+    return push_size(padding + size) + padding;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Arena::try_grow(u8 *data, u64 size, u64 new_size)
+[DES]:  - grows the last push in place, it fails if something was pushed
+          after (data) or if the arena is full, the caller then pushes
+          a new copy
+[IN ]:
+        - data (u8 *): pointer returned by a push
+        - size (u64): current size of the push
+        - new_size (u64): size wanted, bigger than (size)
+[OUT]:
+        - grown (bool): true if (data) now has (new_size) bytes
+-----------------------------------------------------*/
+bool Arena::try_grow(u8 *data, u64 size, u64 new_size)
+{
+    assert(new_size >= size);
+    if(data + size != _base + _used) return false;
+    if(_used + (new_size - size) > _size) return false;
+    _used += new_size - size;
+    Tracer::counter("Arena::used", _trace_id, _used);
+    return true;
+}
+
 void Arena::free_size(u64 size)
 {
-    assert(_used >= size);
+    assert(_used >= size + sizeof(ArenaHeader));
     _used -= size;
+    Tracer::counter("Arena::used", _trace_id, _used);
 }
 
 void Arena::push_offset(s64 offset)
@@ -39,4 +145,80 @@ u64 Arena::get_used()
     return _used;
 }
 
+u64 Arena::get_size()
+{
+    return _size;
+}
+
+u8 *Arena::get_base()
+{
+    return _base;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Arena::sync_header()
+[DES]:  - saves the state in the header like a clean close and the arena
+          stays usable, mark_header_dirty must follow once the header
+          was copied so a crash is never restored from it
+-----------------------------------------------------*/
+void Arena::sync_header()
+{
+    _header->_used = _used;
+    _header->_magic = ARENA_MAGIC;
+}
+
+void Arena::mark_header_dirty()
+{
+    _header->_magic = 0;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Arena::owns(u8 *data)
+[OUT]:
+        - owns (bool): true if (data) is inside the region of the arena
+-----------------------------------------------------*/
+bool Arena::owns(u8 *data)
+{
+    return data >= _base && data < _base + _size;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Arena::get_marker()
+[DES]:  - saves the current top of the arena, pop_to_marker frees
+          everything pushed after it in one step
+[OUT]:
+        - marker (u64): current top of the arena
+-----------------------------------------------------*/
+u64 Arena::get_marker()
+{
+    return _used;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Arena::pop_to_marker(u64 marker)
+[IN ]:
+        - marker (u64): value returned by get_marker, not already popped
+-----------------------------------------------------*/
+void Arena::pop_to_marker(u64 marker)
+{
+    assert(marker >= sizeof(ArenaHeader) && marker <= _used);
+    _used = marker;
+    Tracer::counter("Arena::used", _trace_id, _used);
+}
+
+void Arena::set_root(u8 *data)
+{
+    _header->_root = data ? (u64)(data - _base) : 0;
+}
+
+u8 *Arena::get_root()
+{
+    return _header->_root ? _base + _header->_root : 0;
+}
+
+bool Arena::is_restored()
+{
+    return _restored;
+}
+
 };
@@ -6,20 +6,151 @@
 namespace mem
 {
 
+#define ARENA_MAGIC 0x414E455241ULL
+
+/*@docs------------------------------------------------
+[DES]:  - lives at the start of every arena, magic is only valid after a clean
+          close so a crashed run is never restored with half written state
+-----------------------------------------------------*/
+struct ArenaHeader
+{
+    u64 _magic;
+    u64 _used;
+    u64 _root;
+};
+
 class Arena
 {
 public:
+    /*@docs------------------------------------------------
+    [FNC]:  - Arena(Memory *mem, u64 size)
+    [DES]:  - takes a span of (mem), it goes back to (mem) when the arena is
+              destroyed, only a span never used before in this run is restored
+    [IN ]:
+            - mem (Memory *): pointer to a memory object
+            - size (u64): size of the arena in bytes
+    [OUT]:
+            - arena (Arena): new Arena object
+    -----------------------------------------------------*/
     Arena(Memory *mem, u64 size);
-    ~Arena() = default;
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Arena(u8 *data, u64 size)
+    [DES]:  - arena over a region owned by someone else (a block of a parent
+              heap or arena), it is never restored
+    [IN ]:
+            - data (u8 *): 8 byte aligned start of the region
+            - size (u64): size of the region in bytes
+    [OUT]:
+            - arena (Arena): new Arena object
+    -----------------------------------------------------*/
+    Arena(u8 *data, u64 size);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - ~Arena()
+    [DES]:  - saves the state in the header then gives the span back to the
+              Memory object, a file backed span keeps its content for the next run
+    -----------------------------------------------------*/
+    ~Arena();
+
+    // NOTE: a copy would give the span back to the Memory object twice
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
     u8 *push_size(u64 size);
     void free_size(u64 size);
 
+    /*@docs------------------------------------------------
+    [FNC]:  - Arena::push_aligned(u64 size, u64 alignment)
+    [IN ]:
+            - size (u64): number of bytes to push
+            - alignment (u64): power of two, alignment of the returned pointer
+    [OUT]:
+            - data (u8 *): pointer to the pushed bytes
+    -----------------------------------------------------*/
+    u8 *push_aligned(u64 size, u64 alignment);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Arena::try_grow(u8 *data, u64 size, u64 new_size)
+    [DES]:  - grows the last push in place, it fails if something was pushed
+              after (data) or if the arena is full, the caller then pushes
+              a new copy
+    [IN ]:
+            - data (u8 *): pointer returned by a push
+            - size (u64): current size of the push
+            - new_size (u64): size wanted, bigger than (size)
+    [OUT]:
+            - grown (bool): true if (data) now has (new_size) bytes
+    -----------------------------------------------------*/
+    bool try_grow(u8 *data, u64 size, u64 new_size);
+
     u64 get_used();
+    u64 get_size();
+    u8 *get_base();
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Arena::sync_header()
+    [DES]:  - saves the state in the header like a clean close and the arena
+              stays usable, mark_header_dirty must follow once the header
+              was copied so a crash is never restored from it
+    -----------------------------------------------------*/
+    void sync_header();
+    void mark_header_dirty();
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Arena::owns(u8 *data)
+    [OUT]:
+            - owns (bool): true if (data) is inside the region of the arena
+    -----------------------------------------------------*/
+    bool owns(u8 *data);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Arena::get_marker()
+    [DES]:  - saves the current top of the arena, pop_to_marker frees
+              everything pushed after it in one step
+    [OUT]:
+            - marker (u64): current top of the arena
+    -----------------------------------------------------*/
+    u64 get_marker();
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Arena::pop_to_marker(u64 marker)
+    [IN ]:
+            - marker (u64): value returned by get_marker, not already popped
+    -----------------------------------------------------*/
+    void pop_to_marker(u64 marker);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Arena::set_root(u8 *data)
+    [DES]:  - saves the entry point of the user data structures, stored as an
+              offset so it can be found again after the region is re-mapped
+    [IN ]:
+            - data (u8 *): pointer inside the arena or 0
+    -----------------------------------------------------*/
+    void set_root(u8 *data);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Arena::get_root()
+    [OUT]:
+            - data (u8 *): the pointer saved with set_root or 0
+    -----------------------------------------------------*/
+    u8 *get_root();
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Arena::is_restored()
+    [OUT]:
+            - restored (bool): true if the state was loaded from a previous run
+    -----------------------------------------------------*/
+    bool is_restored();
     
 protected:
     u64 _used;
     u8 *_base;
     u64 _size;
+    Memory *_memory;
+    ArenaHeader *_header;
+    bool _restored;
+    u32 _trace_id;
 
     void push_offset(s64 offset);
 };
@@ -0,0 +1,115 @@
+#ifndef ARENA_ARRAY_H
+#define ARENA_ARRAY_H
+
+#include "arena.h"
+#include <string.h>
+#include <type_traits>
+#include <assert.h>
+
+namespace mem
+{
+
+#define ARENA_ARRAY_MIN_CAPACITY 8
+
+/*@docs------------------------------------------------
+[DES]:  - dynamic array in an arena, while it is the last push of the arena
+          it grows in place, else it moves to a new push and the old one
+          stays in the arena until the arena is popped, nothing is ever
+          freed one by one so (T) must be trivially copyable
+-----------------------------------------------------*/
+template <typename T>
+class ArenaArray
+{
+    static_assert(std::is_trivially_copyable<T>::value, "ArenaArray needs a trivially copyable type");
+
+public:
+    ArenaArray(Arena *arena)
+    {
+        _arena = arena;
+        _data = 0;
+        _count = 0;
+        _capacity = 0;
+    }
+
+    ArenaArray(Arena *arena, u64 capacity) : ArenaArray(arena)
+    {
+        reserve(capacity);
+    }
+
+    /*@docs------------------------------------------------
+    [FNC]:  - ArenaArray::push(const T &value)
+    [IN ]:
+            - value (const T &): value copied at the end of the array
+    [OUT]:
+            - element (T *): pointer to the new element, valid until the
+              array grows
+    -----------------------------------------------------*/
+    T *push(const T &value)
+    {
+        if(_count == _capacity)
+        {
+            reserve(_capacity ? _capacity * 2 : ARENA_ARRAY_MIN_CAPACITY);
+        }
+        _data[_count] = value;
+        return &_data[_count++];
+    }
+
+    T pop()
+    {
+        assert(_count > 0);
+        return _data[--_count];
+    }
+
+    /*@docs------------------------------------------------
+    [FNC]:  - ArenaArray::reserve(u64 capacity)
+    [DES]:  - grows in place when the array is the last push of the arena
+    [IN ]:
+            - capacity (u64): number of elements the array can hold
+    -----------------------------------------------------*/
+    void reserve(u64 capacity)
+    {
+        if(capacity <= _capacity) return;
+        if(_data && _arena->try_grow((u8 *)_data, _capacity * sizeof(T), capacity * sizeof(T)))
+        {
+            _capacity = capacity;
+            return;
+        }
+        T *data = (T *)_arena->push_aligned(capacity * sizeof(T), alignof(T));
+        if(_count) memcpy(data, _data, _count * sizeof(T));
+        _data = data;
+        _capacity = capacity;
+    }
+
+    void resize(u64 count)
+    {
+        reserve(count);
+        _count = count;
+    }
+
+    void clear()
+    {
+        _count = 0;
+    }
+
+    T &operator[](u64 index)
+    {
+        assert(index < _count);
+        return _data[index];
+    }
+
+    T *begin() { return _data; }
+    T *end() { return _data + _count; }
+    T *get_data() { return _data; }
+    u64 get_count() { return _count; }
+    u64 get_capacity() { return _capacity; }
+
+private:
+    Arena *_arena;
+    T *_data;
+    u64 _count;
+    u64 _capacity;
+};
+
+};
+
+#endif // ARENA_ARRAY_H
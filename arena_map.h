@@ -0,0 +1,243 @@
+#ifndef ARENA_MAP_H
+#define ARENA_MAP_H
+
+#include "arena.h"
+#include <emmintrin.h>
+#include <string.h>
+#include <type_traits>
+#include <assert.h>
+
+namespace mem
+{
+
+// NOTE: control byte of every slot, a full slot keeps the low 7 bits of the
+// hash of its key, the probes compare ARENA_MAP_GROUP control bytes at once
+#define ARENA_MAP_GROUP 16
+#define ARENA_MAP_MIN_CAPACITY 16
+#define ARENA_MAP_EMPTY 0x80
+#define ARENA_MAP_DELETED 0xFE
+#define ARENA_MAP_NONE 0xFFFFFFFFFFFFFFFFULL
+
+inline u64 arena_hash_u64(u64 value)
+{
+    value ^= value >> 33;
+    value *= 0xFF51AFD7ED558CCDULL;
+    value ^= value >> 33;
+    value *= 0xC4CEB9FE1A85EC53ULL;
+    value ^= value >> 33;
+    return value;
+}
+
+/*@docs------------------------------------------------
+[DES]:  - default hash of the integer and pointer keys, other key types
+          specialize it (see ArenaString)
+-----------------------------------------------------*/
+template <typename K>
+struct ArenaHash
+{
+    u64 operator()(const K &key) const
+    {
+        return arena_hash_u64((u64)key);
+    }
+};
+
+/*@docs------------------------------------------------
+[DES]:  - open addressing hash map in an arena, the control bytes are probed
+          16 at a time with SSE2, when the map grows the new tables are
+          pushed in the arena and the old ones stay there until the arena
+          is popped, (K) and (V) must be trivially copyable
+-----------------------------------------------------*/
+template <typename K, typename V, typename H = ArenaHash<K>>
+class ArenaMap
+{
+    static_assert(std::is_trivially_copyable<K>::value && std::is_trivially_copyable<V>::value,
+                  "ArenaMap needs trivially copyable types");
+
+public:
+    struct Slot
+    {
+        K _key;
+        V _value;
+    };
+
+    ArenaMap(Arena *arena)
+    {
+        _arena = arena;
+        _ctrl = 0;
+        _slots = 0;
+        _capacity = 0;
+        _count = 0;
+        _deleted = 0;
+    }
+
+    /*@docs------------------------------------------------
+    [FNC]:  - ArenaMap(Arena *arena, u64 count)
+    [DES]:  - makes room for (count) keys so the map doesn't grow before
+    -----------------------------------------------------*/
+    ArenaMap(Arena *arena, u64 count) : ArenaMap(arena)
+    {
+        u64 capacity = ARENA_MAP_MIN_CAPACITY;
+        while(capacity * 7 < count * 8)
+        {
+            capacity *= 2;
+        }
+        rehash(capacity);
+    }
+
+    /*@docs------------------------------------------------
+    [FNC]:  - ArenaMap::find(const K &key)
+    [OUT]:
+            - value (V *): value of (key) or 0, valid until the map grows
+    -----------------------------------------------------*/
+    V *find(const K &key)
+    {
+        u64 index = find_index(key, H()(key));
+        return index == ARENA_MAP_NONE ? 0 : &_slots[index]._value;
+    }
+
+    /*@docs------------------------------------------------
+    [FNC]:  - ArenaMap::insert(const K &key, const V &value)
+    [DES]:  - adds (key) or replaces its value if it is already in the map
+    [OUT]:
+            - value (V *): value in the map, valid until the map grows
+    -----------------------------------------------------*/
+    V *insert(const K &key, const V &value)
+    {
+        u64 hash = H()(key);
+        u64 index = _capacity ? find_index(key, hash) : ARENA_MAP_NONE;
+        if(index == ARENA_MAP_NONE)
+        {
+            if((_count + _deleted + 1) * 8 > _capacity * 7)
+            {
+                // NOTE: a map full of tombstones is cleaned at the same capacity
+                rehash(_count * 2 >= _capacity ? (_capacity ? _capacity * 2 : ARENA_MAP_MIN_CAPACITY) : _capacity);
+            }
+            index = find_free(hash);
+            if(_ctrl[index] == ARENA_MAP_DELETED) --_deleted;
+            set_ctrl(index, (u8)(hash & 0x7F));
+            _slots[index]._key = key;
+            ++_count;
+        }
+        _slots[index]._value = value;
+        return &_slots[index]._value;
+    }
+
+    /*@docs------------------------------------------------
+    [FNC]:  - ArenaMap::remove(const K &key)
+    [OUT]:
+            - removed (bool): false if (key) wasn't in the map
+    -----------------------------------------------------*/
+    bool remove(const K &key)
+    {
+        u64 index = _capacity ? find_index(key, H()(key)) : ARENA_MAP_NONE;
+        if(index == ARENA_MAP_NONE) return false;
+        set_ctrl(index, ARENA_MAP_DELETED);
+        --_count;
+        ++_deleted;
+        return true;
+    }
+
+    /*@docs------------------------------------------------
+    [FNC]:  - ArenaMap::for_each(F function)
+    [DES]:  - calls function(const K &key, V &value) for every key, the map
+              must not be changed meanwhile
+    -----------------------------------------------------*/
+    template <typename F>
+    void for_each(F function)
+    {
+        for(u64 index = 0; index < _capacity; ++index)
+        {
+            if(_ctrl[index] & 0x80) continue;
+            function((const K &)_slots[index]._key, _slots[index]._value);
+        }
+    }
+
+    void clear()
+    {
+        if(_capacity) memset(_ctrl, ARENA_MAP_EMPTY, _capacity + ARENA_MAP_GROUP);
+        _count = 0;
+        _deleted = 0;
+    }
+
+    u64 get_count() { return _count; }
+    u64 get_capacity() { return _capacity; }
+
+private:
+    Arena *_arena;
+    u8 *_ctrl;
+    Slot *_slots;
+    u64 _capacity;
+    u64 _count;
+    u64 _deleted;
+
+    void set_ctrl(u64 index, u8 ctrl)
+    {
+        // NOTE: the first group is copied after the end so a probe starting
+        // near the end reads a whole group without wrapping
+        _ctrl[index] = ctrl;
+        if(index < ARENA_MAP_GROUP) _ctrl[_capacity + index] = ctrl;
+    }
+
+    u64 find_index(const K &key, u64 hash)
+    {
+        if(!_capacity) return ARENA_MAP_NONE;
+        u64 mask = _capacity - 1;
+        __m128i h2 = _mm_set1_epi8((char)(hash & 0x7F));
+        __m128i empty = _mm_set1_epi8((char)ARENA_MAP_EMPTY);
+        u64 position = (hash >> 7) & mask;
+        for(u64 step = ARENA_MAP_GROUP; ; step += ARENA_MAP_GROUP)
+        {
+            __m128i group = _mm_loadu_si128((__m128i *)(_ctrl + position));
+            u32 match = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(group, h2));
+            while(match)
+            {
+                u64 index = (position + __builtin_ctz(match)) & mask;
+                if(_slots[index]._key == key) return index;
+                match &= match - 1;
+            }
+            if(_mm_movemask_epi8(_mm_cmpeq_epi8(group, empty))) return ARENA_MAP_NONE;
+            // NOTE: triangular steps visit every group of a power of two table
+            position = (position + step) & mask;
+        }
+    }
+
+    u64 find_free(u64 hash)
+    {
+        u64 mask = _capacity - 1;
+        u64 position = (hash >> 7) & mask;
+        for(u64 step = ARENA_MAP_GROUP; ; step += ARENA_MAP_GROUP)
+        {
+            // NOTE: empty and deleted are the only control bytes with the high bit
+            __m128i group = _mm_loadu_si128((__m128i *)(_ctrl + position));
+            u32 free = (u32)_mm_movemask_epi8(group);
+            if(free) return (position + __builtin_ctz(free)) & mask;
+            position = (position + step) & mask;
+        }
+    }
+
+    void rehash(u64 capacity)
+    {
+        u8 *old_ctrl = _ctrl;
+        Slot *old_slots = _slots;
+        u64 old_capacity = _capacity;
+
+        _ctrl = _arena->push_size(capacity + ARENA_MAP_GROUP);
+        _slots = (Slot *)_arena->push_aligned(capacity * sizeof(Slot), alignof(Slot));
+        _capacity = capacity;
+        _deleted = 0;
+        memset(_ctrl, ARENA_MAP_EMPTY, capacity + ARENA_MAP_GROUP);
+
+        for(u64 index = 0; index < old_capacity; ++index)
+        {
+            if(old_ctrl[index] & 0x80) continue;
+            u64 hash = H()(old_slots[index]._key);
+            u64 free = find_free(hash);
+            set_ctrl(free, (u8)(hash & 0x7F));
+            _slots[free] = old_slots[index];
+        }
+    }
+};
+
+};
+
+#endif // ARENA_MAP_H
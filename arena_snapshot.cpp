@@ -0,0 +1,257 @@
+#include "arena_snapshot.h"
+#include <Windows.h>
+#include <string.h>
+#include <assert.h>
+
+namespace mem
+{
+
+// NOTE: the exception handler is process wide, it looks for the snapshot of
+// the faulting page in the active ones, the lock also serializes the copies,
+// once added it's never removed so a fault raised just before the last
+// snapshot is destroyed still reaches it
+static SRWLOCK snapshot_lock = SRWLOCK_INIT;
+static ArenaSnapshot *snapshot_active[SNAPSHOT_MAX_ACTIVE];
+static u32 snapshot_active_count;
+static void *snapshot_handler;
+
+static bool snapshot_page_writable(u8 *address)
+{
+    MEMORY_BASIC_INFORMATION info;
+    if(!VirtualQuery(address, &info, sizeof(info)) || info.State != MEM_COMMIT) return false;
+    return (info.Protect & (PAGE_READWRITE | PAGE_WRITECOPY | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY)) != 0;
+}
+
+static LONG WINAPI snapshot_fault(EXCEPTION_POINTERS *info)
+{
+    // NOTE: ExceptionInformation[0] is 1 for a write, [1] is the address
+    EXCEPTION_RECORD *record = info->ExceptionRecord;
+    if(record->ExceptionCode != EXCEPTION_ACCESS_VIOLATION || record->ExceptionInformation[0] != 1)
+    {
+        return EXCEPTION_CONTINUE_SEARCH;
+    }
+    u8 *address = (u8 *)record->ExceptionInformation[1];
+    bool saved = false;
+    AcquireSRWLockExclusive(&snapshot_lock);
+    for(u32 index = 0; index < snapshot_active_count && !saved; ++index)
+    {
+        saved = snapshot_active[index]->save_page(address);
+    }
+    ReleaseSRWLockExclusive(&snapshot_lock);
+    // NOTE: the snapshot of the page can have been destroyed between the
+    // fault and the lock, the page is writable again and the write is retried
+    if(!saved) saved = snapshot_page_writable(address);
+    return saved ? EXCEPTION_CONTINUE_EXECUTION : EXCEPTION_CONTINUE_SEARCH;
+}
+
+static u64 snapshot_arena_size(Arena *arena)
+{
+    u64 page_count = (arena->get_used() + MEMORY_PAGE_SIZE - 1) / MEMORY_PAGE_SIZE;
+    return sizeof(ArenaHeader) + page_count * sizeof(u8 *) + MEMORY_PAGE_SIZE + page_count * MEMORY_PAGE_SIZE;
+}
+
+///////////////////////////////////////////////////////
+//      ArenaSnapshot methods:
+//      Public interface
+///////////////////////////////////////////////////////
+
+/*@docs------------------------------------------------
+[FNC]:  - ArenaSnapshot(Memory *mem, Arena *arena)
+[DES]:  - takes the snapshot of (arena), its header is saved like a clean
+          close in the snapshot and stays dirty in the arena
+[IN ]:
+        - mem (Memory *): the saved pages are taken from (mem)
+        - arena (Arena *): arena on a span of a Memory object
+[OUT]:
+        - snapshot (ArenaSnapshot): new ArenaSnapshot object
+-----------------------------------------------------*/
+ArenaSnapshot::ArenaSnapshot(Memory *mem, Arena *arena) :
+    _arena(mem, snapshot_arena_size(arena))
+{
+    // NOTE: the write that marks the header dirty again saves its page
+    arena->sync_header();
+    protect(arena);
+    arena->mark_header_dirty();
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - ArenaSnapshot(Memory *mem, Heap *heap)
+[DES]:  - the quick lists of (heap) are flushed first so the image is a
+          heap that can be restored
+[IN ]:
+        - mem (Memory *): the saved pages are taken from (mem)
+        - heap (Heap *): heap on a span of a Memory object
+[OUT]:
+        - snapshot (ArenaSnapshot): new ArenaSnapshot object
+-----------------------------------------------------*/
+ArenaSnapshot::ArenaSnapshot(Memory *mem, Heap *heap) :
+    _arena(mem, snapshot_arena_size(heap))
+{
+    heap->sync_header();
+    protect(heap);
+    heap->mark_header_dirty();
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - ~ArenaSnapshot()
+[DES]:  - makes the pages of the arena writable again, no thread must
+          still read the snapshot
+-----------------------------------------------------*/
+ArenaSnapshot::~ArenaSnapshot()
+{
+    AcquireSRWLockExclusive(&snapshot_lock);
+    DWORD old_protect;
+    BOOL unprotected_pages = VirtualProtect(_base, _page_count * MEMORY_PAGE_SIZE, PAGE_READWRITE, &old_protect);
+    assert(unprotected_pages);
+    u32 index = 0;
+    while(snapshot_active[index] != this)
+    {
+        ++index;
+    }
+    snapshot_active[index] = snapshot_active[--snapshot_active_count];
+    ReleaseSRWLockExclusive(&snapshot_lock);
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - ArenaSnapshot::read(u64 offset, u8 *data, u64 size)
+[DES]:  - copies bytes of the arena as they were when the snapshot was
+          taken, from any thread
+[IN ]:
+        - offset (u64): offset in the arena
+        - data (u8 *): destination
+        - size (u64): number of bytes, offset + size <= get_size()
+-----------------------------------------------------*/
+void ArenaSnapshot::read(u64 offset, u8 *data, u64 size)
+{
+    assert(offset + size <= _size);
+    while(size)
+    {
+        u64 page = offset / MEMORY_PAGE_SIZE;
+        u64 page_offset = offset % MEMORY_PAGE_SIZE;
+        u64 count = MEMORY_PAGE_SIZE - page_offset < size ? MEMORY_PAGE_SIZE - page_offset : size;
+        u8 *saved = _pages[page].load(std::memory_order_acquire);
+        if(!saved)
+        {
+            // NOTE: a page is saved before it is made writable, if there is
+            // still no copy after reading the live page it wasn't written
+            // during the read, otherwise the copy is used
+            memcpy(data, _base + offset, count);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            saved = _pages[page].load(std::memory_order_acquire);
+        }
+        if(saved) memcpy(data, saved + page_offset, count);
+        data += count;
+        offset += count;
+        size -= count;
+    }
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - ArenaSnapshot::write_to_file(const char *path)
+[DES]:  - raw image of the arena at the snapshot, from any thread, the
+          file has the size of the arena rounded to a page so a file
+          backed Memory of that size restores it in its first span
+[IN ]:
+        - path (const char *): path of the file, replaced if it exists
+[OUT]:
+        - written (bool): false if the file couldn't be written
+-----------------------------------------------------*/
+bool ArenaSnapshot::write_to_file(const char *path)
+{
+    HANDLE file = CreateFileA(path, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+    if(file == INVALID_HANDLE_VALUE) return false;
+    u8 page[MEMORY_PAGE_SIZE];
+    bool written = true;
+    for(u64 offset = 0; offset < _size && written; offset += MEMORY_PAGE_SIZE)
+    {
+        u64 count = _size - offset < MEMORY_PAGE_SIZE ? _size - offset : MEMORY_PAGE_SIZE;
+        read(offset, page, count);
+        DWORD bytes = 0;
+        written = WriteFile(file, page, (DWORD)count, &bytes, 0) && bytes == count;
+    }
+    if(written)
+    {
+        LARGE_INTEGER end;
+        end.QuadPart = (_arena_size + MEMORY_PAGE_SIZE - 1) & ~(u64)(MEMORY_PAGE_SIZE - 1);
+        written = SetFilePointerEx(file, end, 0, FILE_BEGIN) && SetEndOfFile(file);
+    }
+    CloseHandle(file);
+    return written;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - ArenaSnapshot::save_page(u8 *address)
+[DES]:  - called by the exception handler on a write fault
+[OUT]:
+        - saved (bool): true if (address) is in a page of this snapshot
+-----------------------------------------------------*/
+bool ArenaSnapshot::save_page(u8 *address)
+{
+    if(address < _base || address >= _base + _page_count * MEMORY_PAGE_SIZE) return false;
+    u64 page = (u64)(address - _base) / MEMORY_PAGE_SIZE;
+    // NOTE: another thread faulted on the same page and already saved it
+    if(_pages[page].load(std::memory_order_relaxed)) return true;
+
+    u8 *page_base = _base + page * MEMORY_PAGE_SIZE;
+    u8 *saved = _arena.push_aligned(MEMORY_PAGE_SIZE, MEMORY_PAGE_SIZE);
+    memcpy(saved, page_base, MEMORY_PAGE_SIZE);
+    _pages[page].store(saved, std::memory_order_release);
+    DWORD old_protect;
+    BOOL unprotected_page = VirtualProtect(page_base, MEMORY_PAGE_SIZE, PAGE_READWRITE, &old_protect);
+    assert(unprotected_page);
+    _copied_pages.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+u64 ArenaSnapshot::get_size()
+{
+    return _size;
+}
+
+SnapshotStats ArenaSnapshot::get_stats()
+{
+    SnapshotStats stats;
+    stats._pages = _page_count;
+    stats._copied_pages = _copied_pages.load(std::memory_order_relaxed);
+    return stats;
+}
+
+///////////////////////////////////////////////////////
+//      ArenaSnapshot methods:
+//      Private
+///////////////////////////////////////////////////////
+
+void ArenaSnapshot::protect(Arena *arena)
+{
+    // NOTE: the saved pages are only committed, they use physical memory
+    // when a page is written after the snapshot
+    _base = arena->get_base();
+    assert(((u64)_base & (MEMORY_PAGE_SIZE - 1)) == 0);
+    _size = arena->get_used();
+    _arena_size = arena->get_size();
+    _page_count = (_size + MEMORY_PAGE_SIZE - 1) / MEMORY_PAGE_SIZE;
+    _pages = (std::atomic<u8 *> *)_arena.push_size(_page_count * sizeof(u8 *));
+    for(u64 page = 0; page < _page_count; ++page)
+    {
+        _pages[page] = 0;
+    }
+    _copied_pages = 0;
+
+    AcquireSRWLockExclusive(&snapshot_lock);
+    assert(snapshot_active_count < SNAPSHOT_MAX_ACTIVE);
+    for(u32 index = 0; index < snapshot_active_count; ++index)
+    {
+        // NOTE: a page saved by one snapshot would be writable for the other
+        ArenaSnapshot *active = snapshot_active[index];
+        assert(_base + _page_count * MEMORY_PAGE_SIZE <= active->_base ||
+               active->_base + active->_page_count * MEMORY_PAGE_SIZE <= _base);
+    }
+    if(!snapshot_handler) snapshot_handler = AddVectoredExceptionHandler(1, snapshot_fault);
+    snapshot_active[snapshot_active_count++] = this;
+    DWORD old_protect;
+    BOOL protected_pages = VirtualProtect(_base, _page_count * MEMORY_PAGE_SIZE, PAGE_READONLY, &old_protect);
+    assert(protected_pages);
+    ReleaseSRWLockExclusive(&snapshot_lock);
+}
+
+};
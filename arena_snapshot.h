@@ -0,0 +1,111 @@
+#ifndef ARENA_SNAPSHOT_H
+#define ARENA_SNAPSHOT_H
+
+#include "heap.h"
+#include <atomic>
+
+namespace mem
+{
+
+#define SNAPSHOT_MAX_ACTIVE 16
+
+struct SnapshotStats
+{
+    u64 _pages;
+    u64 _copied_pages;
+};
+
+/*@docs------------------------------------------------
+[DES]:  - copy on write image of the used part of an arena, taking it only
+          makes the pages read only, the first write to a page after that
+          faults and a process wide exception handler saves the page before
+          it is made writable again, so the cost follows the pages written
+          after the snapshot and not the size of the arena, the snapshot can
+          be read or written to a file by another thread while the owner
+          keeps using the arena, the arena must not be on large pages and
+          the OS can't write in it while the snapshot lives (a ReadFile into
+          a protected page fails instead of faulting)
+-----------------------------------------------------*/
+class ArenaSnapshot
+{
+public:
+    /*@docs------------------------------------------------
+    [FNC]:  - ArenaSnapshot(Memory *mem, Arena *arena)
+    [DES]:  - takes the snapshot of (arena), its header is saved like a clean
+              close in the snapshot and stays dirty in the arena
+    [IN ]:
+            - mem (Memory *): the saved pages are taken from (mem)
+            - arena (Arena *): arena on a span of a Memory object
+    [OUT]:
+            - snapshot (ArenaSnapshot): new ArenaSnapshot object
+    -----------------------------------------------------*/
+    ArenaSnapshot(Memory *mem, Arena *arena);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - ArenaSnapshot(Memory *mem, Heap *heap)
+    [DES]:  - the quick lists of (heap) are flushed first so the image is a
+              heap that can be restored
+    [IN ]:
+            - mem (Memory *): the saved pages are taken from (mem)
+            - heap (Heap *): heap on a span of a Memory object
+    [OUT]:
+            - snapshot (ArenaSnapshot): new ArenaSnapshot object
+    -----------------------------------------------------*/
+    ArenaSnapshot(Memory *mem, Heap *heap);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - ~ArenaSnapshot()
+    [DES]:  - makes the pages of the arena writable again, no thread must
+              still read the snapshot
+    -----------------------------------------------------*/
+    ~ArenaSnapshot();
+
+    /*@docs------------------------------------------------
+    [FNC]:  - ArenaSnapshot::read(u64 offset, u8 *data, u64 size)
+    [DES]:  - copies bytes of the arena as they were when the snapshot was
+              taken, from any thread
+    [IN ]:
+            - offset (u64): offset in the arena
+            - data (u8 *): destination
+            - size (u64): number of bytes, offset + size <= get_size()
+    -----------------------------------------------------*/
+    void read(u64 offset, u8 *data, u64 size);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - ArenaSnapshot::write_to_file(const char *path)
+    [DES]:  - raw image of the arena at the snapshot, from any thread, the
+              file has the size of the arena rounded to a page so a file
+              backed Memory of that size restores it in its first span
+    [IN ]:
+            - path (const char *): path of the file, replaced if it exists
+    [OUT]:
+            - written (bool): false if the file couldn't be written
+    -----------------------------------------------------*/
+    bool write_to_file(const char *path);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - ArenaSnapshot::save_page(u8 *address)
+    [DES]:  - called by the exception handler on a write fault
+    [OUT]:
+            - saved (bool): true if (address) is in a page of this snapshot
+    -----------------------------------------------------*/
+    bool save_page(u8 *address);
+
+    u64 get_size();
+    SnapshotStats get_stats();
+
+private:
+    Arena _arena;
+    u8 *_base;
+    u64 _size;
+    u64 _arena_size;
+    u64 _page_count;
+    std::atomic<u8 *> *_pages;
+    std::atomic<u64> _copied_pages;
+
+    void protect(Arena *arena);
+};
+
+};
+
+#endif // ARENA_SNAPSHOT_H
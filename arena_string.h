@@ -0,0 +1,196 @@
+#ifndef ARENA_STRING_H
+#define ARENA_STRING_H
+
+#include "arena_map.h"
+#include <stdio.h>
+#include <stdarg.h>
+
+namespace mem
+{
+
+#define ARENA_STRING_MIN_CAPACITY 64
+
+/*@docs------------------------------------------------
+[DES]:  - string in an arena, (_data) is always null terminated but
+          (_length) doesn't count the terminator
+-----------------------------------------------------*/
+struct ArenaString
+{
+    const char *_data;
+    u64 _length;
+};
+
+inline bool operator==(const ArenaString &left, const ArenaString &right)
+{
+    return left._length == right._length &&
+           (left._data == right._data || memcmp(left._data, right._data, left._length) == 0);
+}
+
+template <>
+struct ArenaHash<ArenaString>
+{
+    u64 operator()(const ArenaString &key) const
+    {
+        // NOTE: FNV-1a, then mixed so the low bits are good for the control bytes
+        u64 hash = 0xCBF29CE484222325ULL;
+        for(u64 index = 0; index < key._length; ++index)
+        {
+            hash = (hash ^ (u8)key._data[index]) * 0x100000001B3ULL;
+        }
+        return arena_hash_u64(hash);
+    }
+};
+
+/*@docs------------------------------------------------
+[DES]:  - builds a string at the top of an arena, the appends grow it in
+          place while nothing else is pushed, finish gives back the unused
+          bytes when the string is still the last push
+-----------------------------------------------------*/
+class ArenaStringBuilder
+{
+public:
+    ArenaStringBuilder(Arena *arena)
+    {
+        _arena = arena;
+        _data = 0;
+        _length = 0;
+        _capacity = 0;
+        _end_marker = 0;
+    }
+
+    void append(const char *data, u64 length)
+    {
+        reserve(_length + length + 1);
+        memcpy(_data + _length, data, length);
+        _length += length;
+    }
+
+    void append(const char *data)
+    {
+        append(data, strlen(data));
+    }
+
+    void append(ArenaString string)
+    {
+        append(string._data, string._length);
+    }
+
+    /*@docs------------------------------------------------
+    [FNC]:  - ArenaStringBuilder::appendf(const char *format, ...)
+    [DES]:  - printf formatted append
+    -----------------------------------------------------*/
+    void appendf(const char *format, ...)
+    {
+        va_list args;
+        va_start(args, format);
+        va_list size_args;
+        va_copy(size_args, args);
+        s32 length = vsnprintf(0, 0, format, size_args);
+        va_end(size_args);
+        if(length > 0)
+        {
+            reserve(_length + length + 1);
+            vsnprintf(_data + _length, length + 1, format, args);
+            _length += length;
+        }
+        va_end(args);
+    }
+
+    /*@docs------------------------------------------------
+    [FNC]:  - ArenaStringBuilder::finish()
+    [DES]:  - ends the string, the builder starts a new one after it
+    [OUT]:
+            - string (ArenaString): the built string, in the arena
+    -----------------------------------------------------*/
+    ArenaString finish()
+    {
+        reserve(_length + 1);
+        _data[_length] = 0;
+        if(_arena->get_marker() == _end_marker)
+        {
+            _arena->free_size(_capacity - _length - 1);
+        }
+        ArenaString string = { _data, _length };
+        _data = 0;
+        _length = 0;
+        _capacity = 0;
+        return string;
+    }
+
+    u64 get_length() { return _length; }
+
+private:
+    Arena *_arena;
+    char *_data;
+    u64 _length;
+    u64 _capacity;
+    u64 _end_marker;
+
+    void reserve(u64 capacity)
+    {
+        if(capacity <= _capacity) return;
+        u64 new_capacity = _capacity ? _capacity * 2 : ARENA_STRING_MIN_CAPACITY;
+        while(new_capacity < capacity)
+        {
+            new_capacity *= 2;
+        }
+        if(!_data || !_arena->try_grow((u8 *)_data, _capacity, new_capacity))
+        {
+            char *data = (char *)_arena->push_size(new_capacity);
+            if(_length) memcpy(data, _data, _length);
+            _data = data;
+        }
+        _capacity = new_capacity;
+        _end_marker = _arena->get_marker();
+    }
+};
+
+/*@docs------------------------------------------------
+[DES]:  - keeps one copy of every string in an arena, two interned strings
+          are equal if their pointers are equal
+-----------------------------------------------------*/
+class ArenaInterner
+{
+public:
+    ArenaInterner(Arena *arena) : _strings(arena)
+    {
+        _arena = arena;
+    }
+
+    /*@docs------------------------------------------------
+    [FNC]:  - ArenaInterner::intern(const char *data, u64 length)
+    [IN ]:
+            - data (const char *): characters of the string, copied if new
+            - length (u64): number of characters
+    [OUT]:
+            - string (ArenaString): the single copy of the string
+    -----------------------------------------------------*/
+    ArenaString intern(const char *data, u64 length)
+    {
+        ArenaString key = { data, length };
+        ArenaString *found = _strings.find(key);
+        if(found) return *found;
+
+        char *copy = (char *)_arena->push_size(length + 1);
+        memcpy(copy, data, length);
+        copy[length] = 0;
+        ArenaString string = { copy, length };
+        _strings.insert(string, string);
+        return string;
+    }
+
+    ArenaString intern(const char *data)
+    {
+        return intern(data, strlen(data));
+    }
+
+    u64 get_count() { return _strings.get_count(); }
+
+private:
+    Arena *_arena;
+    ArenaMap<ArenaString, ArenaString> _strings;
+};
+
+};
+
+#endif // ARENA_STRING_H
@@ -1,10 +1,15 @@
 @echo off
 
 set TARGET=mem.exe
+set TARGET_WIDE=mem_wide.exe
+set TARGET_GEN=size_class_gen.exe
 set CC=clang++
-set CFLAGS=-O0 -g -Wall -Wextra -Werror -Wno-unused-variable
-set SRCS=profiler.cpp memory.cpp arena.cpp heap.cpp mem_test.cpp
+set CFLAGS=-std=c++20 -O0 -g -Wall -Wextra -Werror -Wno-unused-variable
+set LIBS=-ldbghelp -ladvapi32
+set SRCS=profiler.cpp memory.cpp arena.cpp free_tree.cpp heap.cpp sub_heap.cpp small_heap.cpp maintenance.cpp size_histogram.cpp coro_frame.cpp heap_profiler.cpp heap_tags.cpp tracer.cpp concurrent_pool.cpp epoch.cpp io_buffer_pool.cpp arena_snapshot.cpp mem_test.cpp
 
 if not exist .\build mkdir .\build
 
-%CC% %CFLAGS% %SRCS% -o ./build/%TARGET%
+%CC% %CFLAGS% %SRCS% %LIBS% -o ./build/%TARGET%
+%CC% %CFLAGS% -DHEAP_COMPACT_LINKS=0 %SRCS% %LIBS% -o ./build/%TARGET_WIDE%
+%CC% %CFLAGS% size_histogram.cpp size_class_gen.cpp -o ./build/%TARGET_GEN%
@@ -0,0 +1,267 @@
+#include "concurrent_pool.h"
+#include <Windows.h>
+#include <assert.h>
+
+namespace mem
+{
+
+#define POOL_LINK_NEXT 0
+#define POOL_LINK_CHAIN 1
+#define POOL_LINK_COUNT 2
+
+/*@docs------------------------------------------------
+[DES]:  - last cache used by the thread, in the pool with id (_owner)
+-----------------------------------------------------*/
+struct PoolThreadBinding
+{
+    u64 _owner;
+    PoolThreadCache *_cache;
+};
+
+static thread_local PoolThreadBinding pool_thread_binding;
+static std::atomic<u64> pool_next_id(1);
+
+///////////////////////////////////////////////////////
+//      ConcurrentPool methods:
+//      Public interface
+///////////////////////////////////////////////////////
+
+/*@docs------------------------------------------------
+[FNC]:  - ConcurrentPool(Memory *mem, u64 size, u64 object_size)
+[IN ]:
+        - mem (Memory *): pointer to a memory object
+        - size (u64): bytes taken from (mem) for the objects
+        - object_size (u64): size of every object
+[OUT]:
+        - pool (ConcurrentPool): new ConcurrentPool object
+-----------------------------------------------------*/
+ConcurrentPool::ConcurrentPool(Memory *mem, u64 size, u64 object_size) :
+    _arena(mem, size)
+{
+    _object_size = align8(object_size < POOL_MIN_OBJECT_SIZE ? POOL_MIN_OBJECT_SIZE : object_size);
+    _caches = (PoolThreadCache *)_arena.push_aligned(POOL_MAX_THREADS * sizeof(PoolThreadCache), alignof(PoolThreadCache));
+    for(u32 index = 0; index < POOL_MAX_THREADS; ++index)
+    {
+        _caches[index]._thread_id.store(0, std::memory_order_relaxed);
+        _caches[index]._head = 0;
+        _caches[index]._count = 0;
+    }
+
+    // NOTE: the whole rest of the arena is taken now so the slabs can be
+    // carved with an atomic add instead of a locked push_size
+    u64 free_size = _arena.get_marker() <= size ? size - _arena.get_marker() : 0;
+    assert(free_size / _object_size > 0 && free_size / _object_size < 0xFFFFFFFF);
+    _capacity = (u32)(free_size / _object_size);
+    _data = _arena.push_size(_capacity * _object_size);
+    _id = pool_next_id.fetch_add(1);
+    _cache_count = 0;
+    _free_chains = 0;
+    _carved = 0;
+    _chain_pushes = 0;
+    _chain_pops = 0;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - ConcurrentPool::allocate()
+[OUT]:
+        - data (u8 *): new object, 0 if the pool is exhausted or
+          POOL_MAX_THREADS other threads hold a cache
+-----------------------------------------------------*/
+u8 *ConcurrentPool::allocate()
+{
+    PoolThreadCache *cache = get_thread_cache();
+    if(!cache || (!cache->_head && !refill(cache))) return 0;
+    u32 index = cache->_head - 1;
+    cache->_head = get_links(index)[POOL_LINK_NEXT];
+    --cache->_count;
+    return get_object(index);
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - ConcurrentPool::deallocate(u8 *data)
+[DES]:  - a thread without a cache pushes the object alone to the
+          shared stack
+[IN ]:
+        - data (u8 *): object of this pool, from any thread
+-----------------------------------------------------*/
+void ConcurrentPool::deallocate(u8 *data)
+{
+    PoolThreadCache *cache = get_thread_cache();
+    u32 index = get_index(data);
+    if(!cache)
+    {
+        get_links(index)[POOL_LINK_NEXT] = 0;
+        push_chain(index + 1, 1);
+        return;
+    }
+    get_links(index)[POOL_LINK_NEXT] = cache->_head;
+    cache->_head = index + 1;
+    if(++cache->_count < POOL_MAGAZINE_SIZE * 2) return;
+
+    // NOTE: a full magazine goes to the shared stack, the other one stays
+    // so a thread freeing and allocating around the limit doesn't bounce
+    u32 head = cache->_head;
+    u32 last = head - 1;
+    for(u32 count = 1; count < POOL_MAGAZINE_SIZE; ++count)
+    {
+        last = get_links(last)[POOL_LINK_NEXT] - 1;
+    }
+    cache->_head = get_links(last)[POOL_LINK_NEXT];
+    cache->_count -= POOL_MAGAZINE_SIZE;
+    get_links(last)[POOL_LINK_NEXT] = 0;
+    push_chain(head, POOL_MAGAZINE_SIZE);
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - ConcurrentPool::flush_thread()
+[DES]:  - gives the cached objects of the calling thread back to the
+          other threads and frees its cache for another thread, to call
+          before a thread stops using the pool
+-----------------------------------------------------*/
+void ConcurrentPool::flush_thread()
+{
+    PoolThreadCache *cache = get_thread_cache();
+    if(!cache) return;
+    if(cache->_head) push_chain(cache->_head, cache->_count);
+    cache->_head = 0;
+    cache->_count = 0;
+    cache->_thread_id.store(0, std::memory_order_release);
+    pool_thread_binding._owner = 0;
+}
+
+PoolStats ConcurrentPool::get_stats()
+{
+    PoolStats stats;
+    stats._carved = _carved.load(std::memory_order_relaxed);
+    stats._chain_pushes = _chain_pushes.load(std::memory_order_relaxed);
+    stats._chain_pops = _chain_pops.load(std::memory_order_relaxed);
+    return stats;
+}
+
+u64 ConcurrentPool::get_object_size()
+{
+    return _object_size;
+}
+
+///////////////////////////////////////////////////////
+//      ConcurrentPool methods:
+//      Private
+///////////////////////////////////////////////////////
+
+u32 *ConcurrentPool::get_links(u32 index)
+{
+    return (u32 *)(_data + index * _object_size);
+}
+
+u8 *ConcurrentPool::get_object(u32 index)
+{
+    return _data + index * _object_size;
+}
+
+u32 ConcurrentPool::get_index(u8 *data)
+{
+    assert(data >= _data && data < _data + _capacity * _object_size);
+    assert((u64)(data - _data) % _object_size == 0);
+    return (u32)((u64)(data - _data) / _object_size);
+}
+
+PoolThreadCache *ConcurrentPool::get_thread_cache()
+{
+    PoolThreadBinding *binding = &pool_thread_binding;
+    if(binding->_owner == _id) return binding->_cache;
+
+    // NOTE: slow path when the thread changes pool, its cache is found
+    // again from its thread id or a new one is claimed
+    u32 thread_id = GetCurrentThreadId();
+    u32 count = _cache_count.load(std::memory_order_acquire);
+    PoolThreadCache *cache = 0;
+    for(u32 index = 0; index < count; ++index)
+    {
+        if(_caches[index]._thread_id.load(std::memory_order_acquire) == thread_id) cache = &_caches[index];
+    }
+    while(!cache)
+    {
+        // NOTE: a free cache is claimed with an exchange of its thread id,
+        // a new one is only added to the count and claimed by the next scan
+        for(u32 index = 0; index < count && !cache; ++index)
+        {
+            u32 free_id = 0;
+            if(_caches[index]._thread_id.compare_exchange_strong(free_id, thread_id, std::memory_order_acq_rel))
+            {
+                cache = &_caches[index];
+            }
+        }
+        if(cache) break;
+        if(count == POOL_MAX_THREADS) return 0;
+        if(_cache_count.compare_exchange_weak(count, count + 1, std::memory_order_acq_rel)) ++count;
+    }
+    binding->_owner = _id;
+    binding->_cache = cache;
+    return cache;
+}
+
+bool ConcurrentPool::refill(PoolThreadCache *cache)
+{
+    u32 head = pop_chain();
+    if(head)
+    {
+        cache->_head = head;
+        cache->_count = get_links(head - 1)[POOL_LINK_COUNT];
+        return true;
+    }
+
+    // NOTE: the counter stops at the capacity, an add past it would wrap
+    // after enough failed refills and carve objects in use again
+    u32 first = _carved.load(std::memory_order_relaxed);
+    u32 carved;
+    do
+    {
+        if(first >= _capacity) return false;
+        carved = _capacity - first < POOL_MAGAZINE_SIZE ? _capacity : first + POOL_MAGAZINE_SIZE;
+    } while(!_carved.compare_exchange_weak(first, carved, std::memory_order_relaxed));
+    u32 count = _capacity - first < POOL_MAGAZINE_SIZE ? _capacity - first : POOL_MAGAZINE_SIZE;
+    for(u32 index = first; index < first + count; ++index)
+    {
+        get_links(index)[POOL_LINK_NEXT] = index + 1 < first + count ? index + 2 : 0;
+    }
+    cache->_head = first + 1;
+    cache->_count = count;
+    return true;
+}
+
+void ConcurrentPool::push_chain(u32 head, u32 count)
+{
+    // NOTE: the high 32 bits of the stack head count the changes, a pop
+    // that read a head that was popped and pushed back meanwhile fails
+    u32 *links = get_links(head - 1);
+    links[POOL_LINK_COUNT] = count;
+    u64 old_head = _free_chains.load(std::memory_order_relaxed);
+    u64 new_head;
+    do
+    {
+        std::atomic_ref<u32>(links[POOL_LINK_CHAIN]).store((u32)old_head, std::memory_order_relaxed);
+        new_head = (((old_head >> 32) + 1) << 32) | head;
+    } while(!_free_chains.compare_exchange_weak(old_head, new_head, std::memory_order_release, std::memory_order_relaxed));
+    _chain_pushes.fetch_add(1, std::memory_order_relaxed);
+}
+
+u32 ConcurrentPool::pop_chain()
+{
+    u64 old_head = _free_chains.load(std::memory_order_acquire);
+    while((u32)old_head)
+    {
+        // NOTE: the link can be read after another thread took the chain and
+        // reused the object, the value is then stale and the tag makes the
+        // exchange fail, the pool memory is never given back so it stays readable
+        u32 next = std::atomic_ref<u32>(get_links((u32)old_head - 1)[POOL_LINK_CHAIN]).load(std::memory_order_relaxed);
+        u64 new_head = (((old_head >> 32) + 1) << 32) | next;
+        if(_free_chains.compare_exchange_weak(old_head, new_head, std::memory_order_acquire, std::memory_order_acquire))
+        {
+            _chain_pops.fetch_add(1, std::memory_order_relaxed);
+            return (u32)old_head;
+        }
+    }
+    return 0;
+}
+
+};
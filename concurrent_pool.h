@@ -0,0 +1,111 @@
+#ifndef CONCURRENT_POOL_H
+#define CONCURRENT_POOL_H
+
+#include "arena.h"
+#include <atomic>
+
+namespace mem
+{
+
+// NOTE: a free object keeps 3 u32 links (next object, next chain and count
+// of its chain), objects are addressed by index + 1 so 0 means none
+#define POOL_MIN_OBJECT_SIZE 16
+#define POOL_MAGAZINE_SIZE 32
+#define POOL_MAX_THREADS 64
+
+/*@docs------------------------------------------------
+[DES]:  - objects cached by one thread, on its own cache line so the
+          threads don't share lines, only its thread touches it, except
+          (_thread_id) that the other threads read to find their cache,
+          0 if the cache is free
+-----------------------------------------------------*/
+struct alignas(64) PoolThreadCache
+{
+    std::atomic<u32> _thread_id;
+    u32 _head;
+    u32 _count;
+};
+
+struct PoolStats
+{
+    u64 _carved;
+    u64 _chain_pushes;
+    u64 _chain_pops;
+};
+
+/*@docs------------------------------------------------
+[DES]:  - fixed size pool for many threads, every thread allocates and
+          frees in its own cache without atomics, the caches exchange
+          chains of POOL_MAGAZINE_SIZE objects through a lock-free stack
+          whose head is tagged with a counter against ABA, new objects are
+          carved from the arena a chain at a time with one atomic add, an
+          object can be freed by another thread than the one that
+          allocated it
+-----------------------------------------------------*/
+class ConcurrentPool
+{
+public:
+    /*@docs------------------------------------------------
+    [FNC]:  - ConcurrentPool(Memory *mem, u64 size, u64 object_size)
+    [IN ]:
+            - mem (Memory *): pointer to a memory object
+            - size (u64): bytes taken from (mem) for the objects
+            - object_size (u64): size of every object
+    [OUT]:
+            - pool (ConcurrentPool): new ConcurrentPool object
+    -----------------------------------------------------*/
+    ConcurrentPool(Memory *mem, u64 size, u64 object_size);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - ConcurrentPool::allocate()
+    [OUT]:
+            - data (u8 *): new object, 0 if the pool is exhausted or
+              POOL_MAX_THREADS other threads hold a cache
+    -----------------------------------------------------*/
+    u8 *allocate();
+
+    /*@docs------------------------------------------------
+    [FNC]:  - ConcurrentPool::deallocate(u8 *data)
+    [DES]:  - a thread without a cache pushes the object alone to the
+              shared stack
+    [IN ]:
+            - data (u8 *): object of this pool, from any thread
+    -----------------------------------------------------*/
+    void deallocate(u8 *data);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - ConcurrentPool::flush_thread()
+    [DES]:  - gives the cached objects of the calling thread back to the
+              other threads and frees its cache for another thread, to call
+              before a thread stops using the pool
+    -----------------------------------------------------*/
+    void flush_thread();
+
+    PoolStats get_stats();
+    u64 get_object_size();
+
+private:
+    Arena _arena;
+    u8 *_data;
+    u64 _object_size;
+    u32 _capacity;
+    u64 _id;
+    PoolThreadCache *_caches;
+    std::atomic<u32> _cache_count;
+    alignas(64) std::atomic<u64> _free_chains;
+    alignas(64) std::atomic<u32> _carved;
+    std::atomic<u64> _chain_pushes;
+    std::atomic<u64> _chain_pops;
+
+    u32 *get_links(u32 index);
+    u8 *get_object(u32 index);
+    u32 get_index(u8 *data);
+    PoolThreadCache *get_thread_cache();
+    bool refill(PoolThreadCache *cache);
+    void push_chain(u32 head, u32 count);
+    u32 pop_chain();
+};
+
+};
+
+#endif // CONCURRENT_POOL_H
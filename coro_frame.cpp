@@ -0,0 +1,455 @@
+#include "coro_frame.h"
+#include "tracer.h"
+#include <Windows.h>
+#include <atomic>
+#include <assert.h>
+
+namespace mem
+{
+
+/*@docs------------------------------------------------
+[DES]:  - frame lists of a thread, they belong to (_allocator) with id
+          (_owner), they go back to it when the thread starts using another
+          allocator or exits
+-----------------------------------------------------*/
+struct CoroThreadCache
+{
+    u64 _owner;
+    CoroFrameAllocator *_allocator;
+    u8 *_free[CORO_FRAME_CLASS_COUNT];
+    u32 _count[CORO_FRAME_CLASS_COUNT];
+    CoroChunk *_chunk;
+    u64 _chunk_used;
+    CoroTaskTree *_tree;
+
+    ~CoroThreadCache()
+    {
+        CoroFrameAllocator::unbind_thread_cache(this);
+    }
+};
+
+static thread_local CoroThreadCache coro_thread_cache;
+static std::atomic<u64> coro_next_allocator_id(1);
+static CoroFrameAllocator *coro_current_allocator = 0;
+
+// NOTE: the live allocators, a thread cache only goes back to its allocator
+// if it's still in the list, the lock keeps it alive meanwhile
+static SRWLOCK coro_allocators_lock = SRWLOCK_INIT;
+static CoroFrameAllocator *coro_allocators = 0;
+
+static u8 *align16(u8 *data)
+{
+    return (u8 *)(((u64)data + 15) & ~15ULL);
+}
+
+static u8 *list_tail(u8 *first, u32 count)
+{
+    u8 *last = first;
+    for(u32 index = 1; index < count; ++index)
+    {
+        last = ((CoroFrameHeader *)last)->_owner;
+    }
+    return last;
+}
+
+///////////////////////////////////////////////////////
+//      CoroTaskTree methods:
+//      Public interface
+///////////////////////////////////////////////////////
+
+CoroTaskTree::CoroTaskTree(CoroFrameAllocator *allocator)
+{
+    _allocator = allocator;
+    _chunks = 0;
+    _chunk_used = CORO_CHUNK_SIZE;
+    _frame_count = 0;
+}
+
+CoroTaskTree::~CoroTaskTree()
+{
+    release();
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - CoroTaskTree::release()
+[DES]:  - frees all the frames of the tree, the coroutines of the tree
+          must be finished or destroyed
+-----------------------------------------------------*/
+void CoroTaskTree::release()
+{
+    assert(coro_thread_cache._tree != this);
+    if(_chunks) _allocator->release_chunks(_chunks);
+    _chunks = 0;
+    _chunk_used = CORO_CHUNK_SIZE;
+    _frame_count = 0;
+}
+
+u64 CoroTaskTree::get_frame_count()
+{
+    return _frame_count;
+}
+
+///////////////////////////////////////////////////////
+//      CoroTaskTree methods:
+//      Private
+///////////////////////////////////////////////////////
+
+u8 *CoroTaskTree::push_frame(u64 size)
+{
+    size = (size + 15) & ~15ULL;
+    if(_chunk_used + size > CORO_CHUNK_SIZE)
+    {
+        CoroChunk *chunk = _allocator->get_chunk();
+        chunk->_next = _chunks;
+        _chunks = chunk;
+        _chunk_used = sizeof(CoroChunk);
+    }
+    u8 *data = (u8 *)_chunks + _chunk_used;
+    _chunk_used += size;
+    ++_frame_count;
+    return data;
+}
+
+///////////////////////////////////////////////////////
+//      CoroTaskScope methods:
+//      Public interface
+///////////////////////////////////////////////////////
+
+CoroTaskScope::CoroTaskScope(CoroTaskTree *tree)
+{
+    _prev = coro_thread_cache._tree;
+    coro_thread_cache._tree = tree;
+}
+
+CoroTaskScope::~CoroTaskScope()
+{
+    coro_thread_cache._tree = _prev;
+}
+
+///////////////////////////////////////////////////////
+//      CoroFrameAllocator methods:
+//      Public interface
+///////////////////////////////////////////////////////
+
+/*@docs------------------------------------------------
+[FNC]:  - CoroFrameAllocator(Memory *mem, u64 size)
+[IN ]:
+        - mem (Memory *): pointer to a memory object
+        - size (u64): size of the heap the frames are taken from
+[OUT]:
+        - allocator (CoroFrameAllocator): new CoroFrameAllocator object
+-----------------------------------------------------*/
+CoroFrameAllocator::CoroFrameAllocator(Memory *mem, u64 size) :
+    _heap(mem, size)
+{
+    static_assert(sizeof(_lock) == sizeof(SRWLOCK), "SRWLOCK must fit in _lock");
+    static_assert(sizeof(CoroFrameHeader) == 16 && sizeof(CoroChunk) == 16, "frames must stay 16 byte aligned");
+    InitializeSRWLock((PSRWLOCK)&_lock);
+    _free_chunks = 0;
+    for(u32 index = 0; index < CORO_FRAME_CLASS_COUNT; ++index)
+    {
+        _shared_free[index] = 0;
+        _shared_count[index] = 0;
+    }
+    // NOTE: ids are never reused, so the lists of a destroyed allocator are
+    // never taken for the ones of a new allocator at the same address
+    _id = coro_next_allocator_id.fetch_add(1);
+
+    AcquireSRWLockExclusive(&coro_allocators_lock);
+    _next_allocator = coro_allocators;
+    coro_allocators = this;
+    ReleaseSRWLockExclusive(&coro_allocators_lock);
+}
+
+CoroFrameAllocator::~CoroFrameAllocator()
+{
+    if(coro_current_allocator == this) coro_current_allocator = 0;
+    AcquireSRWLockExclusive(&coro_allocators_lock);
+    CoroFrameAllocator **link = &coro_allocators;
+    while(*link != this)
+    {
+        link = &(*link)->_next_allocator;
+    }
+    *link = _next_allocator;
+    ReleaseSRWLockExclusive(&coro_allocators_lock);
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - CoroFrameAllocator::allocate(u64 size)
+[DES]:  - the frame comes from the current task tree of the thread if
+          there is one, else from the thread free lists
+[IN ]:
+        - size (u64): size of the coroutine frame
+[OUT]:
+        - data (u8 *): 16 byte aligned frame
+-----------------------------------------------------*/
+u8 *CoroFrameAllocator::allocate(u64 size)
+{
+    CoroThreadCache *cache = &coro_thread_cache;
+    u64 total_size = size + sizeof(CoroFrameHeader);
+    if(total_size > CORO_FRAME_MAX_SIZE)
+    {
+        return allocate_big(size);
+    }
+
+    CoroFrameHeader *header = 0;
+    CoroTaskTree *tree = cache->_tree;
+    if(tree && tree->_allocator == this)
+    {
+        header = (CoroFrameHeader *)tree->push_frame(total_size);
+        header->_class = CORO_FRAME_IN_TREE;
+        header->_owner = (u8 *)tree;
+        return (u8 *)(header + 1);
+    }
+
+    if(cache->_owner != _id) bind_thread_cache(cache);
+
+    u32 size_class = (u32)((total_size + CORO_FRAME_GRANULE - 1) / CORO_FRAME_GRANULE) - 1;
+    if(!cache->_free[size_class] && _shared_count[size_class].load(std::memory_order_relaxed))
+    {
+        take_shared(cache, size_class);
+    }
+    if(cache->_free[size_class])
+    {
+        header = (CoroFrameHeader *)cache->_free[size_class];
+        cache->_free[size_class] = header->_owner;
+        --cache->_count[size_class];
+    }
+    else
+    {
+        u64 slot_size = (u64)(size_class + 1) * CORO_FRAME_GRANULE;
+        if(cache->_chunk_used + slot_size > CORO_CHUNK_SIZE)
+        {
+            // NOTE: a full chunk stays with its frames, they are recycled
+            // through the free lists
+            cache->_chunk = get_chunk();
+            cache->_chunk_used = sizeof(CoroChunk);
+        }
+        header = (CoroFrameHeader *)((u8 *)cache->_chunk + cache->_chunk_used);
+        cache->_chunk_used += slot_size;
+    }
+    header->_class = size_class;
+    header->_owner = 0;
+    return (u8 *)(header + 1);
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - CoroFrameAllocator::deallocate(u8 *data, u64 size)
+[DES]:  - the frame goes to the free list of the calling thread, it can
+          be another thread than the one that allocated it, the excess
+          of the list goes to the shared list
+[IN ]:
+        - data (u8 *): frame returned by allocate
+        - size (u64): size used to allocate the frame
+-----------------------------------------------------*/
+void CoroFrameAllocator::deallocate(u8 *data, u64 size)
+{
+    CoroFrameHeader *header = (CoroFrameHeader *)data - 1;
+    if(header->_class == CORO_FRAME_IN_TREE)
+    {
+        return;
+    }
+    if(header->_class == CORO_FRAME_BIG)
+    {
+        lock();
+        _heap.deallocate(header->_owner);
+        unlock();
+        return;
+    }
+
+    assert(header->_class == (size + sizeof(CoroFrameHeader) + CORO_FRAME_GRANULE - 1) / CORO_FRAME_GRANULE - 1);
+    CoroThreadCache *cache = &coro_thread_cache;
+    if(cache->_owner != _id) bind_thread_cache(cache);
+    u32 size_class = (u32)header->_class;
+    header->_owner = cache->_free[size_class];
+    cache->_free[size_class] = (u8 *)header;
+    if(++cache->_count[size_class] > CORO_FRAME_CACHE_LIMIT) trim_thread_list(cache, size_class);
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - CoroFrameAllocator::set_current(CoroFrameAllocator *allocator)
+[DES]:  - allocator used by CoroFramePromise, shared by all the threads,
+          it must not change while coroutines made with it are alive
+[IN ]:
+        - allocator (CoroFrameAllocator *): allocator or 0
+-----------------------------------------------------*/
+void CoroFrameAllocator::set_current(CoroFrameAllocator *allocator)
+{
+    coro_current_allocator = allocator;
+}
+
+CoroFrameAllocator *CoroFrameAllocator::get_current()
+{
+    return coro_current_allocator;
+}
+
+///////////////////////////////////////////////////////
+//      CoroFrameAllocator methods:
+//      Private
+///////////////////////////////////////////////////////
+
+void CoroFrameAllocator::bind_thread_cache(CoroThreadCache *cache)
+{
+    unbind_thread_cache(cache);
+    for(u32 index = 0; index < CORO_FRAME_CLASS_COUNT; ++index)
+    {
+        cache->_free[index] = 0;
+        cache->_count[index] = 0;
+    }
+    cache->_owner = _id;
+    cache->_allocator = this;
+    cache->_chunk = 0;
+    cache->_chunk_used = CORO_CHUNK_SIZE;
+}
+
+void CoroFrameAllocator::unbind_thread_cache(CoroThreadCache *cache)
+{
+    if(!cache->_allocator) return;
+    AcquireSRWLockShared(&coro_allocators_lock);
+    for(CoroFrameAllocator *allocator = coro_allocators; allocator; allocator = allocator->_next_allocator)
+    {
+        if(allocator == cache->_allocator && allocator->_id == cache->_owner)
+        {
+            allocator->give_back(cache);
+            break;
+        }
+    }
+    ReleaseSRWLockShared(&coro_allocators_lock);
+    cache->_allocator = 0;
+    cache->_owner = 0;
+}
+
+void CoroFrameAllocator::give_back(CoroThreadCache *cache)
+{
+    lock();
+    for(u32 size_class = 0; size_class < CORO_FRAME_CLASS_COUNT; ++size_class)
+    {
+        u32 count = cache->_count[size_class];
+        if(!count) continue;
+        u8 *first = cache->_free[size_class];
+        CoroFrameHeader *last = (CoroFrameHeader *)list_tail(first, count);
+        last->_owner = _shared_free[size_class];
+        _shared_free[size_class] = first;
+        _shared_count[size_class].fetch_add(count, std::memory_order_relaxed);
+    }
+
+    // NOTE: the rest of the chunk is cut in the biggest frames that fit
+    while(cache->_chunk && cache->_chunk_used + CORO_FRAME_GRANULE <= CORO_CHUNK_SIZE)
+    {
+        u64 class_count = (CORO_CHUNK_SIZE - cache->_chunk_used) / CORO_FRAME_GRANULE;
+        u32 size_class = (u32)(class_count < CORO_FRAME_CLASS_COUNT ? class_count : CORO_FRAME_CLASS_COUNT) - 1;
+        CoroFrameHeader *header = (CoroFrameHeader *)((u8 *)cache->_chunk + cache->_chunk_used);
+        header->_class = size_class;
+        header->_owner = _shared_free[size_class];
+        _shared_free[size_class] = (u8 *)header;
+        _shared_count[size_class].fetch_add(1, std::memory_order_relaxed);
+        cache->_chunk_used += (u64)(size_class + 1) * CORO_FRAME_GRANULE;
+    }
+    unlock();
+}
+
+void CoroFrameAllocator::trim_thread_list(CoroThreadCache *cache, u32 size_class)
+{
+    u32 count = CORO_FRAME_CACHE_LIMIT / 2;
+    u8 *first = cache->_free[size_class];
+    CoroFrameHeader *last = (CoroFrameHeader *)list_tail(first, count);
+    cache->_free[size_class] = last->_owner;
+    cache->_count[size_class] -= count;
+
+    lock();
+    last->_owner = _shared_free[size_class];
+    _shared_free[size_class] = first;
+    _shared_count[size_class].fetch_add(count, std::memory_order_relaxed);
+    unlock();
+}
+
+void CoroFrameAllocator::take_shared(CoroThreadCache *cache, u32 size_class)
+{
+    lock();
+    u32 count = _shared_count[size_class].load(std::memory_order_relaxed);
+    if(count > CORO_FRAME_CACHE_LIMIT / 2) count = CORO_FRAME_CACHE_LIMIT / 2;
+    if(count)
+    {
+        u8 *first = _shared_free[size_class];
+        CoroFrameHeader *last = (CoroFrameHeader *)list_tail(first, count);
+        _shared_free[size_class] = last->_owner;
+        _shared_count[size_class].fetch_sub(count, std::memory_order_relaxed);
+        last->_owner = cache->_free[size_class];
+        cache->_free[size_class] = first;
+        cache->_count[size_class] += count;
+    }
+    unlock();
+}
+
+CoroChunk *CoroFrameAllocator::get_chunk()
+{
+    TraceScope trace("CoroFrameAllocator::get_chunk");
+    lock();
+    CoroChunk *chunk = _free_chunks;
+    if(chunk)
+    {
+        _free_chunks = chunk->_next;
+    }
+    else
+    {
+        u8 *origin = _heap.allocate(CORO_CHUNK_SIZE + 16);
+        chunk = (CoroChunk *)align16(origin);
+        chunk->_origin = origin;
+    }
+    unlock();
+    chunk->_next = 0;
+    return chunk;
+}
+
+void CoroFrameAllocator::release_chunks(CoroChunk *chunks)
+{
+    CoroChunk *last = chunks;
+    while(last->_next)
+    {
+        last = last->_next;
+    }
+    lock();
+    last->_next = _free_chunks;
+    _free_chunks = chunks;
+    unlock();
+}
+
+u8 *CoroFrameAllocator::allocate_big(u64 size)
+{
+    TraceScope trace("CoroFrameAllocator::allocate_big");
+    lock();
+    u8 *origin = _heap.allocate(size + sizeof(CoroFrameHeader) + 16);
+    unlock();
+    CoroFrameHeader *header = (CoroFrameHeader *)align16(origin);
+    header->_class = CORO_FRAME_BIG;
+    header->_owner = origin;
+    return (u8 *)(header + 1);
+}
+
+void CoroFrameAllocator::lock()
+{
+    AcquireSRWLockExclusive((PSRWLOCK)&_lock);
+}
+
+void CoroFrameAllocator::unlock()
+{
+    ReleaseSRWLockExclusive((PSRWLOCK)&_lock);
+}
+
+///////////////////////////////////////////////////////
+//      CoroFramePromise methods:
+//      Public interface
+///////////////////////////////////////////////////////
+
+void *CoroFramePromise::operator new(size_t size)
+{
+    assert(coro_current_allocator && "CoroFrameAllocator::set_current was not called");
+    return coro_current_allocator->allocate(size);
+}
+
+void CoroFramePromise::operator delete(void *data, size_t size)
+{
+    coro_current_allocator->deallocate((u8 *)data, size);
+}
+
+};
@@ -0,0 +1,185 @@
+#ifndef CORO_FRAME_H
+#define CORO_FRAME_H
+
+#include "heap.h"
+#include <stddef.h>
+#include <atomic>
+
+namespace mem
+{
+
+// NOTE: frames are recycled in classes of CORO_FRAME_GRANULE bytes (header
+// included), bigger frames go straight to the heap
+#define CORO_FRAME_GRANULE 64
+#define CORO_FRAME_CLASS_COUNT 32
+#define CORO_FRAME_MAX_SIZE (CORO_FRAME_GRANULE * CORO_FRAME_CLASS_COUNT)
+#define CORO_CHUNK_SIZE KB(64)
+#define CORO_FRAME_BIG 0xFFFFFFFF
+#define CORO_FRAME_IN_TREE 0xFFFFFFFE
+// NOTE: a thread keeps at most this many frames per class, half of them go
+// to the shared lists when it has more
+#define CORO_FRAME_CACHE_LIMIT 64
+
+class CoroTaskTree;
+class CoroFrameAllocator;
+struct CoroThreadCache;
+
+/*@docs------------------------------------------------
+[DES]:  - 16 bytes in front of every frame, so the frame keeps the 16 byte
+          alignment coroutine frames need, (_owner) is the task tree of a
+          tree frame or the heap pointer of a big frame
+-----------------------------------------------------*/
+struct CoroFrameHeader
+{
+    u64 _class;
+    u8 *_owner;
+};
+
+struct CoroChunk
+{
+    CoroChunk *_next;
+    u8 *_origin;
+};
+
+/*@docs------------------------------------------------
+[DES]:  - all the frames allocated while a tree is the current one of the
+          thread (see CoroTaskScope) are pushed in the tree chunks, their
+          delete does nothing and the chunks go back to the allocator at
+          once when the tree is released, a tree is used by one thread at
+          a time
+-----------------------------------------------------*/
+class CoroTaskTree
+{
+public:
+    CoroTaskTree(CoroFrameAllocator *allocator);
+    ~CoroTaskTree();
+
+    /*@docs------------------------------------------------
+    [FNC]:  - CoroTaskTree::release()
+    [DES]:  - frees all the frames of the tree, the coroutines of the tree
+              must be finished or destroyed
+    -----------------------------------------------------*/
+    void release();
+
+    u64 get_frame_count();
+
+private:
+    friend class CoroFrameAllocator;
+
+    CoroFrameAllocator *_allocator;
+    CoroChunk *_chunks;
+    u64 _chunk_used;
+    u64 _frame_count;
+
+    u8 *push_frame(u64 size);
+};
+
+/*@docs------------------------------------------------
+[DES]:  - makes (tree) the current task tree of the thread until the scope
+          ends, scopes can be nested
+-----------------------------------------------------*/
+class CoroTaskScope
+{
+public:
+    CoroTaskScope(CoroTaskTree *tree);
+    ~CoroTaskScope();
+
+private:
+    CoroTaskTree *_prev;
+};
+
+/*@docs------------------------------------------------
+[DES]:  - coroutine frame allocator, every thread recycles the frames it
+          frees in its own per class lists without locks, new frames are
+          bumped from a per thread chunk, only the chunks, the big frames
+          and the shared lists take the lock, a thread list over
+          CORO_FRAME_CACHE_LIMIT frames gives half of them to the shared
+          list of its class and an empty one takes from it, so frames freed
+          on another thread than the one that made them come back, when a
+          thread changes allocator or exits its lists and the rest of its
+          chunk go back to the shared lists
+-----------------------------------------------------*/
+class CoroFrameAllocator
+{
+public:
+    /*@docs------------------------------------------------
+    [FNC]:  - CoroFrameAllocator(Memory *mem, u64 size)
+    [IN ]:
+            - mem (Memory *): pointer to a memory object
+            - size (u64): size of the heap the frames are taken from
+    [OUT]:
+            - allocator (CoroFrameAllocator): new CoroFrameAllocator object
+    -----------------------------------------------------*/
+    CoroFrameAllocator(Memory *mem, u64 size);
+    ~CoroFrameAllocator();
+
+    /*@docs------------------------------------------------
+    [FNC]:  - CoroFrameAllocator::allocate(u64 size)
+    [DES]:  - the frame comes from the current task tree of the thread if
+              there is one, else from the thread free lists
+    [IN ]:
+            - size (u64): size of the coroutine frame
+    [OUT]:
+            - data (u8 *): 16 byte aligned frame
+    -----------------------------------------------------*/
+    u8 *allocate(u64 size);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - CoroFrameAllocator::deallocate(u8 *data, u64 size)
+    [DES]:  - the frame goes to the free list of the calling thread, it can
+              be another thread than the one that allocated it, the excess
+              of the list goes to the shared list
+    [IN ]:
+            - data (u8 *): frame returned by allocate
+            - size (u64): size used to allocate the frame
+    -----------------------------------------------------*/
+    void deallocate(u8 *data, u64 size);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - CoroFrameAllocator::set_current(CoroFrameAllocator *allocator)
+    [DES]:  - allocator used by CoroFramePromise, shared by all the threads,
+              it must not change while coroutines made with it are alive
+    [IN ]:
+            - allocator (CoroFrameAllocator *): allocator or 0
+    -----------------------------------------------------*/
+    static void set_current(CoroFrameAllocator *allocator);
+    static CoroFrameAllocator *get_current();
+
+private:
+    friend class CoroTaskTree;
+    friend struct CoroThreadCache;
+
+    Heap _heap;
+    void *_lock;
+    CoroChunk *_free_chunks;
+    u8 *_shared_free[CORO_FRAME_CLASS_COUNT];
+    std::atomic<u32> _shared_count[CORO_FRAME_CLASS_COUNT];
+    CoroFrameAllocator *_next_allocator;
+    u64 _id;
+
+    void bind_thread_cache(CoroThreadCache *cache);
+    static void unbind_thread_cache(CoroThreadCache *cache);
+    void give_back(CoroThreadCache *cache);
+    void trim_thread_list(CoroThreadCache *cache, u32 size_class);
+    void take_shared(CoroThreadCache *cache, u32 size_class);
+    CoroChunk *get_chunk();
+    void release_chunks(CoroChunk *chunks);
+    u8 *allocate_big(u64 size);
+    void lock();
+    void unlock();
+};
+
+/*@docs------------------------------------------------
+[DES]:  - mixin for promise types, the frames of the coroutine are taken
+          from CoroFrameAllocator::get_current()
+          struct promise_type : mem::CoroFramePromise { ... };
+-----------------------------------------------------*/
+struct CoroFramePromise
+{
+    static void *operator new(size_t size);
+    static void operator delete(void *data, size_t size);
+};
+
+};
+
+#endif // CORO_FRAME_H
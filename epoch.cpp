@@ -0,0 +1,342 @@
+#include "epoch.h"
+#include <Windows.h>
+#include <assert.h>
+
+namespace mem
+{
+
+static std::atomic<u64> epoch_next_domain_id(1);
+
+static void free_to_heap(void *owner, u8 **data, u64 count)
+{
+    ((Heap *)owner)->deallocate_batch(data, count);
+}
+
+static void free_to_maintainer(void *owner, u8 **data, u64 count)
+{
+    for(u64 index = 0; index < count; ++index)
+    {
+        ((HeapMaintainer *)owner)->deallocate(data[index]);
+    }
+}
+
+static void free_to_pool(void *owner, u8 **data, u64 count)
+{
+    for(u64 index = 0; index < count; ++index)
+    {
+        ((ConcurrentPool *)owner)->deallocate(data[index]);
+    }
+}
+
+///////////////////////////////////////////////////////
+//      EpochDomain methods:
+//      Public interface
+///////////////////////////////////////////////////////
+
+/*@docs------------------------------------------------
+[FNC]:  - EpochDomain(Memory *mem)
+[DES]:  - the thread states and retire lists are taken from (mem)
+[IN ]:
+        - mem (Memory *): pointer to a memory object
+[OUT]:
+        - domain (EpochDomain): new EpochDomain object
+-----------------------------------------------------*/
+EpochDomain::EpochDomain(Memory *mem) :
+    _arena(mem, sizeof(ArenaHeader) + 64 +
+                EPOCH_MAX_THREADS * (sizeof(EpochThread) + EPOCH_LIST_COUNT * EPOCH_LIST_CAPACITY * sizeof(EpochRetired))),
+    _overflow_heap(mem, EPOCH_OVERFLOW_HEAP_SIZE)
+{
+    InitializeSRWLock((PSRWLOCK)&_lock);
+    _threads = (EpochThread *)_arena.push_aligned(EPOCH_MAX_THREADS * sizeof(EpochThread), alignof(EpochThread));
+    for(u32 index = 0; index < EPOCH_MAX_THREADS; ++index)
+    {
+        EpochThread *thread = &_threads[index];
+        thread->_state = 0;
+        thread->_thread_id.store(0, std::memory_order_relaxed);
+        thread->_nesting = 0;
+        for(u32 list = 0; list < EPOCH_LIST_COUNT; ++list)
+        {
+            thread->_lists[list]._epoch = 0;
+            thread->_lists[list]._count = 0;
+            thread->_lists[list]._entries = (EpochRetired *)_arena.push_size(EPOCH_LIST_CAPACITY * sizeof(EpochRetired));
+            thread->_lists[list]._overflow = 0;
+        }
+    }
+    _thread_count = 0;
+    _id = epoch_next_domain_id.fetch_add(1);
+    _epoch = 0;
+    _advances = 0;
+    _freed = 0;
+    _leaked = 0;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - ~EpochDomain()
+[DES]:  - frees all the retired pointers of all the threads, no thread
+          must use the domain anymore
+-----------------------------------------------------*/
+EpochDomain::~EpochDomain()
+{
+    u32 thread_count = _thread_count.load(std::memory_order_acquire);
+    for(u32 index = 0; index < thread_count; ++index)
+    {
+        assert(!_threads[index]._nesting);
+        for(u32 list = 0; list < EPOCH_LIST_COUNT; ++list)
+        {
+            free_list(&_threads[index]._lists[list]);
+        }
+    }
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - EpochDomain::retire(void *owner, EpochFreeFunction free, u8 *data)
+[DES]:  - (data) is already unreachable from the structure, it is freed
+          with (free) when no critical section can still see it, a full
+          list makes the thread wait for the readers outside a critical
+          section and grows inside one, (data) leaks if it can't grow
+[IN ]:
+        - owner (void *): passed back to (free)
+        - free (EpochFreeFunction): batch free of the owner
+        - data (u8 *): pointer to free
+-----------------------------------------------------*/
+void EpochDomain::retire(void *owner, EpochFreeFunction free, u8 *data)
+{
+    EpochThread *thread = get_thread();
+    u64 epoch = _epoch.load(std::memory_order_acquire);
+    collect(thread, epoch);
+    EpochRetireList *list = &thread->_lists[epoch % EPOCH_LIST_COUNT];
+
+    // NOTE: a full list can only be freed two epochs later, the thread
+    // waits for the readers, in a critical section it would wait on itself
+    // so the list grows instead
+    while(list->_count == EPOCH_LIST_CAPACITY && !thread->_nesting)
+    {
+        if(!try_advance()) SwitchToThread();
+        epoch = _epoch.load(std::memory_order_acquire);
+        collect(thread, epoch);
+        list = &thread->_lists[epoch % EPOCH_LIST_COUNT];
+    }
+
+    if(!list->_count) list->_epoch = epoch;
+    EpochRetired *retired = list->_count < EPOCH_LIST_CAPACITY ? &list->_entries[list->_count++] : push_overflow(list);
+    if(!retired)
+    {
+        // NOTE: a reader may still hold (data), it can't be freed now
+        _leaked.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    retired->_data = data;
+    retired->_owner = owner;
+    retired->_free = free;
+
+    if(list->_count % EPOCH_ADVANCE_COUNT == 0 && try_advance())
+    {
+        collect(thread, _epoch.load(std::memory_order_acquire));
+    }
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - EpochDomain::retire(Heap *heap, u8 *data)
+[DES]:  - freed with deallocate_batch, (heap) must be owned by the
+          calling thread
+-----------------------------------------------------*/
+void EpochDomain::retire(Heap *heap, u8 *data)
+{
+    retire(heap, free_to_heap, data);
+}
+
+void EpochDomain::retire(HeapMaintainer *maintainer, u8 *data)
+{
+    retire(maintainer, free_to_maintainer, data);
+}
+
+void EpochDomain::retire(ConcurrentPool *pool, u8 *data)
+{
+    retire(pool, free_to_pool, data);
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - EpochDomain::try_advance()
+[DES]:  - moves the global epoch forward if every thread in a critical
+          section has seen the current one, never waits
+[OUT]:
+        - advanced (bool): true if the epoch changed
+-----------------------------------------------------*/
+bool EpochDomain::try_advance()
+{
+    u64 epoch = _epoch.load(std::memory_order_acquire);
+    // NOTE: the readers only do a plain store in enter, this barrier makes
+    // every store issued before it visible, a reader that enters after it
+    // also sees the pointers unlinked before it
+    FlushProcessWriteBuffers();
+
+    u32 thread_count = _thread_count.load(std::memory_order_acquire);
+    for(u32 index = 0; index < thread_count; ++index)
+    {
+        u64 state = _threads[index]._state.load(std::memory_order_acquire);
+        if((state & EPOCH_ACTIVE) && (state >> 1) != epoch) return false;
+    }
+    if(!_epoch.compare_exchange_strong(epoch, epoch + 1, std::memory_order_acq_rel)) return false;
+    _advances.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - EpochDomain::synchronize()
+[DES]:  - waits until all the pointers retired by the calling thread are
+          freed, it must not be called inside a critical section
+-----------------------------------------------------*/
+void EpochDomain::synchronize()
+{
+    EpochThread *thread = get_thread();
+    assert(!thread->_nesting);
+    u64 target = _epoch.load(std::memory_order_acquire) + 2;
+    u64 epoch = target - 2;
+    while(epoch < target)
+    {
+        if(!try_advance()) SwitchToThread();
+        epoch = _epoch.load(std::memory_order_acquire);
+    }
+    collect(thread, epoch);
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - EpochDomain::release_thread()
+[DES]:  - frees the retired pointers of the calling thread and gives its
+          state to another thread, to call before a thread stops using
+          the domain, a thread past EPOCH_MAX_THREADS waits for it
+-----------------------------------------------------*/
+void EpochDomain::release_thread()
+{
+    EpochThread *thread = get_thread();
+    synchronize();
+    thread->_thread_id.store(0, std::memory_order_release);
+    _binding._owner = 0;
+}
+
+EpochStats EpochDomain::get_stats()
+{
+    EpochStats stats;
+    stats._epoch = _epoch.load(std::memory_order_relaxed);
+    stats._advances = _advances.load(std::memory_order_relaxed);
+    stats._freed = _freed.load(std::memory_order_relaxed);
+    stats._leaked = _leaked.load(std::memory_order_relaxed);
+    return stats;
+}
+
+///////////////////////////////////////////////////////
+//      EpochDomain methods:
+//      Private
+///////////////////////////////////////////////////////
+
+EpochThread *EpochDomain::bind_thread()
+{
+    // NOTE: slow path when the thread changes domain, its state is found
+    // again from its thread id or a new one is claimed
+    u32 thread_id = GetCurrentThreadId();
+    u32 count = _thread_count.load(std::memory_order_acquire);
+    EpochThread *thread = 0;
+    for(u32 index = 0; index < count; ++index)
+    {
+        if(_threads[index]._thread_id.load(std::memory_order_acquire) == thread_id) thread = &_threads[index];
+    }
+    while(!thread)
+    {
+        // NOTE: a free state is claimed with an exchange of its thread id,
+        // a new one is only added to the count and claimed by the next scan
+        for(u32 index = 0; index < count && !thread; ++index)
+        {
+            u32 free_id = 0;
+            if(_threads[index]._thread_id.compare_exchange_strong(free_id, thread_id, std::memory_order_acq_rel))
+            {
+                thread = &_threads[index];
+            }
+        }
+        if(thread) break;
+        if(count == EPOCH_MAX_THREADS)
+        {
+            SwitchToThread();
+            count = _thread_count.load(std::memory_order_acquire);
+        }
+        else if(_thread_count.compare_exchange_weak(count, count + 1, std::memory_order_acq_rel))
+        {
+            ++count;
+        }
+    }
+    _binding._owner = _id;
+    _binding._thread = thread;
+    return thread;
+}
+
+void EpochDomain::collect(EpochThread *thread, u64 epoch)
+{
+    for(u32 index = 0; index < EPOCH_LIST_COUNT; ++index)
+    {
+        EpochRetireList *list = &thread->_lists[index];
+        if(list->_count && list->_epoch + 2 <= epoch) free_list(list);
+    }
+}
+
+EpochRetired *EpochDomain::push_overflow(EpochRetireList *list)
+{
+    EpochRetireBlock *block = list->_overflow;
+    if(!block || block->_count == EPOCH_LIST_CAPACITY)
+    {
+        lock();
+        block = (EpochRetireBlock *)_overflow_heap.try_allocate(sizeof(EpochRetireBlock));
+        unlock();
+        if(!block) return 0;
+        block->_next = list->_overflow;
+        block->_count = 0;
+        list->_overflow = block;
+    }
+    return &block->_entries[block->_count++];
+}
+
+void EpochDomain::free_list(EpochRetireList *list)
+{
+    u64 freed = free_entries(list->_entries, list->_count);
+    while(list->_overflow)
+    {
+        EpochRetireBlock *block = list->_overflow;
+        freed += free_entries(block->_entries, block->_count);
+        list->_overflow = block->_next;
+        lock();
+        _overflow_heap.deallocate((u8 *)block);
+        unlock();
+    }
+    _freed.fetch_add(freed, std::memory_order_relaxed);
+    list->_count = 0;
+}
+
+u64 EpochDomain::free_entries(EpochRetired *entries, u64 count)
+{
+    // NOTE: the runs of pointers with the same owner are freed in one call
+    u8 *batch[EPOCH_FREE_BATCH];
+    u64 batch_count = 0;
+    for(u64 index = 0; index < count; ++index)
+    {
+        EpochRetired *retired = &entries[index];
+        batch[batch_count++] = retired->_data;
+        EpochRetired *next = index + 1 < count ? retired + 1 : 0;
+        bool same = next && next->_owner == retired->_owner && next->_free == retired->_free;
+        if(!same || batch_count == EPOCH_FREE_BATCH)
+        {
+            retired->_free(retired->_owner, batch, batch_count);
+            batch_count = 0;
+        }
+    }
+    return count;
+}
+
+void EpochDomain::lock()
+{
+    AcquireSRWLockExclusive((PSRWLOCK)&_lock);
+}
+
+void EpochDomain::unlock()
+{
+    ReleaseSRWLockExclusive((PSRWLOCK)&_lock);
+}
+
+};
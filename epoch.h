@@ -0,0 +1,232 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include "maintenance.h"
+#include "concurrent_pool.h"
+#include <atomic>
+
+namespace mem
+{
+
+// NOTE: a pointer retired in epoch E is freed once the global epoch is
+// E + 2, so every thread keeps EPOCH_LIST_COUNT retire lists
+#define EPOCH_MAX_THREADS 64
+#define EPOCH_LIST_COUNT 3
+#define EPOCH_LIST_CAPACITY 1024
+#define EPOCH_ADVANCE_COUNT 64
+#define EPOCH_FREE_BATCH 256
+#define EPOCH_ACTIVE 1ULL
+// NOTE: a list that fills inside a critical section of its thread grows
+// with blocks taken from a heap of this size
+#define EPOCH_OVERFLOW_HEAP_SIZE MB(4)
+
+/*@docs------------------------------------------------
+[DES]:  - frees (count) retired pointers of the same owner at once
+-----------------------------------------------------*/
+typedef void (*EpochFreeFunction)(void *owner, u8 **data, u64 count);
+
+struct EpochRetired
+{
+    u8 *_data;
+    void *_owner;
+    EpochFreeFunction _free;
+};
+
+/*@docs------------------------------------------------
+[DES]:  - more entries of a full retire list, chained through (_next)
+-----------------------------------------------------*/
+struct EpochRetireBlock
+{
+    EpochRetireBlock *_next;
+    u64 _count;
+    EpochRetired _entries[EPOCH_LIST_CAPACITY];
+};
+
+struct EpochRetireList
+{
+    u64 _epoch;
+    u64 _count;
+    EpochRetired *_entries;
+    EpochRetireBlock *_overflow;
+};
+
+/*@docs------------------------------------------------
+[DES]:  - state of one thread, (_state) is (epoch << 1) | EPOCH_ACTIVE while
+          the thread is in a critical section, (_thread_id) is 0 if the
+          state is free, the rest is only touched by its thread
+-----------------------------------------------------*/
+struct alignas(64) EpochThread
+{
+    std::atomic<u64> _state;
+    std::atomic<u32> _thread_id;
+    u32 _nesting;
+    EpochRetireList _lists[EPOCH_LIST_COUNT];
+};
+
+struct EpochBinding
+{
+    u64 _owner;
+    EpochThread *_thread;
+};
+
+struct EpochStats
+{
+    u64 _epoch;
+    u64 _advances;
+    u64 _freed;
+    u64 _leaked;
+};
+
+/*@docs------------------------------------------------
+[DES]:  - epoch based reclamation, the readers of a lock-free structure
+          enter a critical section, a pointer removed from the structure
+          is retired instead of freed and goes back to its heap or pool in
+          a batch once no reader can still hold it, the critical sections
+          only store the epoch of the thread, the writer side pays for the
+          ordering with a process wide barrier when it advances the epoch,
+          a retired pointer is freed by the thread that retired it so it
+          can go to a Heap owned by that thread
+-----------------------------------------------------*/
+class EpochDomain
+{
+public:
+    /*@docs------------------------------------------------
+    [FNC]:  - EpochDomain(Memory *mem)
+    [DES]:  - the thread states and retire lists are taken from (mem)
+    [IN ]:
+            - mem (Memory *): pointer to a memory object
+    [OUT]:
+            - domain (EpochDomain): new EpochDomain object
+    -----------------------------------------------------*/
+    EpochDomain(Memory *mem);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - ~EpochDomain()
+    [DES]:  - frees all the retired pointers of all the threads, no thread
+              must use the domain anymore
+    -----------------------------------------------------*/
+    ~EpochDomain();
+
+    /*@docs------------------------------------------------
+    [FNC]:  - EpochDomain::enter()
+    [DES]:  - starts a critical section of the thread, they can be nested,
+              the pointers read from the structure stay valid until exit
+    -----------------------------------------------------*/
+    void enter()
+    {
+        EpochThread *thread = get_thread();
+        if(thread->_nesting++) return;
+        // NOTE: no fence here, try_advance runs a process wide barrier
+        // before it reads the thread states
+        thread->_state.store((_epoch.load(std::memory_order_relaxed) << 1) | EPOCH_ACTIVE, std::memory_order_relaxed);
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+    }
+
+    void exit()
+    {
+        EpochThread *thread = get_thread();
+        if(--thread->_nesting) return;
+        thread->_state.store(0, std::memory_order_release);
+    }
+
+    /*@docs------------------------------------------------
+    [FNC]:  - EpochDomain::retire(void *owner, EpochFreeFunction free, u8 *data)
+    [DES]:  - (data) is already unreachable from the structure, it is freed
+              with (free) when no critical section can still see it, a full
+              list makes the thread wait for the readers outside a critical
+              section and grows inside one, (data) leaks if it can't grow
+    [IN ]:
+            - owner (void *): passed back to (free)
+            - free (EpochFreeFunction): batch free of the owner
+            - data (u8 *): pointer to free
+    -----------------------------------------------------*/
+    void retire(void *owner, EpochFreeFunction free, u8 *data);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - EpochDomain::retire(Heap *heap, u8 *data)
+    [DES]:  - freed with deallocate_batch, (heap) must be owned by the
+              calling thread
+    -----------------------------------------------------*/
+    void retire(Heap *heap, u8 *data);
+    void retire(HeapMaintainer *maintainer, u8 *data);
+    void retire(ConcurrentPool *pool, u8 *data);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - EpochDomain::try_advance()
+    [DES]:  - moves the global epoch forward if every thread in a critical
+              section has seen the current one, never waits
+    [OUT]:
+            - advanced (bool): true if the epoch changed
+    -----------------------------------------------------*/
+    bool try_advance();
+
+    /*@docs------------------------------------------------
+    [FNC]:  - EpochDomain::synchronize()
+    [DES]:  - waits until all the pointers retired by the calling thread are
+              freed, it must not be called inside a critical section
+    -----------------------------------------------------*/
+    void synchronize();
+
+    /*@docs------------------------------------------------
+    [FNC]:  - EpochDomain::release_thread()
+    [DES]:  - frees the retired pointers of the calling thread and gives its
+              state to another thread, to call before a thread stops using
+              the domain, a thread past EPOCH_MAX_THREADS waits for it
+    -----------------------------------------------------*/
+    void release_thread();
+
+    EpochStats get_stats();
+
+private:
+    static inline thread_local EpochBinding _binding = {};
+
+    Arena _arena;
+    Heap _overflow_heap;
+    void *_lock;
+    EpochThread *_threads;
+    std::atomic<u32> _thread_count;
+    u64 _id;
+    alignas(64) std::atomic<u64> _epoch;
+    std::atomic<u64> _advances;
+    std::atomic<u64> _freed;
+    std::atomic<u64> _leaked;
+
+    EpochThread *get_thread()
+    {
+        if(_binding._owner == _id) return _binding._thread;
+        return bind_thread();
+    }
+
+    EpochThread *bind_thread();
+    void collect(EpochThread *thread, u64 epoch);
+    EpochRetired *push_overflow(EpochRetireList *list);
+    void free_list(EpochRetireList *list);
+    u64 free_entries(EpochRetired *entries, u64 count);
+    void lock();
+    void unlock();
+};
+
+/*@docs------------------------------------------------
+[DES]:  - critical section of (domain) until the scope ends
+-----------------------------------------------------*/
+class EpochGuard
+{
+public:
+    EpochGuard(EpochDomain *domain)
+    {
+        _domain = domain;
+        _domain->enter();
+    }
+
+    ~EpochGuard()
+    {
+        _domain->exit();
+    }
+
+private:
+    EpochDomain *_domain;
+};
+
+};
+
+#endif // EPOCH_H
@@ -0,0 +1,166 @@
+#ifndef FIXED_ARENA_H
+#define FIXED_ARENA_H
+
+#include "heap.h"
+#include <assert.h>
+
+namespace mem
+{
+
+/*@docs------------------------------------------------
+[DES]:  - position in a FixedArena, the inline top plus the last overflow
+          chunk at the time of the marker
+-----------------------------------------------------*/
+struct FixedArenaMarker
+{
+    u64 _used;
+    u8 *_overflow;
+};
+
+/*@docs------------------------------------------------
+[DES]:  - header in front of every overflow chunk, the chunks are a LIFO
+          list so they are given back to the parent in reverse order
+-----------------------------------------------------*/
+struct FixedArenaOverflow
+{
+    FixedArenaOverflow *_prev;
+    u64 _parent_marker;
+};
+
+/*@docs------------------------------------------------
+[DES]:  - arena with (N) bytes of inline storage, it doesn't need a Memory
+          object so it can live on the stack or inside another object,
+          push_size is a pointer bump while the inline storage lasts, then
+          the pushes go to the parent Arena or Heap (or assert without one),
+          a parent Arena must not be pushed by anyone else while the
+          FixedArena has overflow chunks in it
+-----------------------------------------------------*/
+template <u64 N>
+class FixedArena
+{
+public:
+    FixedArena()
+    {
+        _used = 0;
+        _overflow = 0;
+        _parent_arena = 0;
+        _parent_heap = 0;
+    }
+
+    FixedArena(Arena *parent) : FixedArena()
+    {
+        _parent_arena = parent;
+    }
+
+    FixedArena(Heap *parent) : FixedArena()
+    {
+        _parent_heap = parent;
+    }
+
+    ~FixedArena()
+    {
+        pop_overflow(0);
+    }
+
+    FixedArena(const FixedArena &) = delete;
+    FixedArena &operator=(const FixedArena &) = delete;
+
+    /*@docs------------------------------------------------
+    [FNC]:  - FixedArena::push_size(u64 size)
+    [IN ]:
+            - size (u64): number of bytes to push
+    [OUT]:
+            - data (u8 *): pointer to the pushed bytes
+    -----------------------------------------------------*/
+    u8 *push_size(u64 size)
+    {
+        if(_used + size <= N)
+        {
+            u8 *result = _data + _used;
+            _used += size;
+            return result;
+        }
+        return push_overflow(size);
+    }
+
+    /*@docs------------------------------------------------
+    [FNC]:  - FixedArena::get_marker() / pop_to_marker(FixedArenaMarker marker)
+    [DES]:  - same as the Arena markers, popping also gives back the overflow
+              chunks pushed after the marker
+    -----------------------------------------------------*/
+    FixedArenaMarker get_marker()
+    {
+        return { _used, (u8 *)_overflow };
+    }
+
+    void pop_to_marker(FixedArenaMarker marker)
+    {
+        assert(marker._used <= _used);
+        pop_overflow((FixedArenaOverflow *)marker._overflow);
+        _used = marker._used;
+    }
+
+    u64 get_used()
+    {
+        return _used;
+    }
+
+    u64 get_capacity()
+    {
+        return N;
+    }
+
+    bool has_overflow()
+    {
+        return _overflow != 0;
+    }
+
+private:
+    alignas(16) u8 _data[N];
+    u64 _used;
+    FixedArenaOverflow *_overflow;
+    Arena *_parent_arena;
+    Heap *_parent_heap;
+
+    u8 *push_overflow(u64 size)
+    {
+        assert((_parent_arena || _parent_heap) && "FixedArena overflow without a parent");
+        FixedArenaOverflow *chunk = 0;
+        if(_parent_arena)
+        {
+            u64 parent_marker = _parent_arena->get_marker();
+            chunk = (FixedArenaOverflow *)_parent_arena->push_size(sizeof(FixedArenaOverflow) + size);
+            chunk->_parent_marker = parent_marker;
+        }
+        else
+        {
+            chunk = (FixedArenaOverflow *)_parent_heap->allocate(sizeof(FixedArenaOverflow) + size);
+            chunk->_parent_marker = 0;
+        }
+        chunk->_prev = _overflow;
+        _overflow = chunk;
+        return (u8 *)(chunk + 1);
+    }
+
+    void pop_overflow(FixedArenaOverflow *marker)
+    {
+        while(_overflow != marker)
+        {
+            assert(_overflow && "marker already popped");
+            FixedArenaOverflow *chunk = _overflow;
+            _overflow = chunk->_prev;
+            if(_parent_arena)
+            {
+                _parent_arena->pop_to_marker(chunk->_parent_marker);
+            }
+            else
+            {
+                _parent_heap->deallocate((u8 *)chunk);
+            }
+        }
+    }
+};
+
+};
+
+#endif // FIXED_ARENA_H
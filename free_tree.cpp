@@ -0,0 +1,416 @@
+#include "free_tree.h"
+#include "heap.h"
+#include <assert.h>
+
+namespace mem
+{
+
+///////////////////////////////////////////////////////
+//      FreeTree methods:
+//      Public interface
+///////////////////////////////////////////////////////
+
+FreeTree::FreeTree(u8 *base, BlockLink root)
+{
+    _base = base;
+    _root = root;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - FreeTree::insert(Block *block)
+[DES]:  - adds a free block to the tree in O(log n)
+[IN ]:
+        - block (Block *): free block with size >= FREE_TREE_MIN_SIZE
+-----------------------------------------------------*/
+void FreeTree::insert(Block *block)
+{
+    assert(block->get_size() >= FREE_TREE_MIN_SIZE);
+    set_left(block, 0);
+    set_right(block, 0);
+    get_node(block)->_red = 1;
+
+    Block *parent = 0;
+    Block *current = get_block(_root);
+    while(current)
+    {
+        parent = current;
+        current = less(block, current) ? get_left(current) : get_right(current);
+    }
+
+    set_parent(block, parent);
+    if(!parent)
+    {
+        _root = get_link(block);
+    }
+    else if(less(block, parent))
+    {
+        set_left(parent, block);
+    }
+    else
+    {
+        set_right(parent, block);
+    }
+    insert_fixup(block);
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - FreeTree::remove(Block *block)
+[DES]:  - removes a block from the tree in O(log n)
+[IN ]:
+        - block (Block *): block already inserted in the tree
+-----------------------------------------------------*/
+void FreeTree::remove(Block *block)
+{
+    Block *child = 0;
+    Block *child_parent = 0;
+    bool removed_red = is_red(block);
+
+    if(!get_left(block))
+    {
+        child = get_right(block);
+        child_parent = get_parent(block);
+        transplant(block, child);
+    }
+    else if(!get_right(block))
+    {
+        child = get_left(block);
+        child_parent = get_parent(block);
+        transplant(block, child);
+    }
+    else
+    {
+        Block *next = minimum(get_right(block));
+        removed_red = is_red(next);
+        child = get_right(next);
+        if(get_parent(next) == block)
+        {
+            child_parent = next;
+        }
+        else
+        {
+            child_parent = get_parent(next);
+            transplant(next, child);
+            set_right(next, get_right(block));
+            set_parent(get_right(next), next);
+        }
+        transplant(block, next);
+        set_left(next, get_left(block));
+        set_parent(get_left(next), next);
+        set_red(next, is_red(block));
+    }
+
+    if(!removed_red)
+    {
+        remove_fixup(child, child_parent);
+    }
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - FreeTree::find_best_fit(u64 size)
+[DES]:  - returns the smallest block with at least (size) bytes, if
+          there are several with the same size the lowest address wins
+[IN ]:
+        - size (u64): requested size
+[OUT]:
+        - block (Block *): best fit block or 0 if there is none
+-----------------------------------------------------*/
+Block *FreeTree::find_best_fit(u64 size)
+{
+    Block *best_block = 0;
+    Block *block = get_block(_root);
+    while(block)
+    {
+        if(block->get_size() >= size)
+        {
+            best_block = block;
+            block = get_left(block);
+        }
+        else
+        {
+            block = get_right(block);
+        }
+    }
+    return best_block;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - FreeTree::get_next(Block *block)
+[DES]:  - returns the next block in (size, address) order, with
+          find_best_fit it's used to walk the blocks above a size
+[IN ]:
+        - block (Block *): block already inserted in the tree
+[OUT]:
+        - block (Block *): next block or 0 if (block) is the last one
+-----------------------------------------------------*/
+Block *FreeTree::get_next(Block *block)
+{
+    if(get_right(block))
+    {
+        return minimum(get_right(block));
+    }
+    Block *parent = get_parent(block);
+    while(parent && block == get_right(parent))
+    {
+        block = parent;
+        parent = get_parent(block);
+    }
+    return parent;
+}
+
+bool FreeTree::is_empty()
+{
+    return _root == 0;
+}
+
+BlockLink FreeTree::get_root()
+{
+    return _root;
+}
+
+///////////////////////////////////////////////////////
+//      FreeTree methods:
+//      Private
+///////////////////////////////////////////////////////
+
+Block *FreeTree::get_block(BlockLink link)
+{
+    return link ? (Block *)(_base + ((u64)link << BLOCK_LINK_SHIFT)) : 0;
+}
+
+BlockLink FreeTree::get_link(Block *block)
+{
+    return block ? (BlockLink)((u64)((u8 *)block - _base) >> BLOCK_LINK_SHIFT) : 0;
+}
+
+FreeNode *FreeTree::get_node(Block *block)
+{
+    return (FreeNode *)block->get_data();
+}
+
+Block *FreeTree::get_left(Block *block)
+{
+    return get_block(get_node(block)->_left);
+}
+
+Block *FreeTree::get_right(Block *block)
+{
+    return get_block(get_node(block)->_right);
+}
+
+Block *FreeTree::get_parent(Block *block)
+{
+    return get_block(get_node(block)->_parent);
+}
+
+void FreeTree::set_left(Block *block, Block *left)
+{
+    get_node(block)->_left = get_link(left);
+}
+
+void FreeTree::set_right(Block *block, Block *right)
+{
+    get_node(block)->_right = get_link(right);
+}
+
+void FreeTree::set_parent(Block *block, Block *parent)
+{
+    get_node(block)->_parent = get_link(parent);
+}
+
+bool FreeTree::is_red(Block *block)
+{
+    return block && get_node(block)->_red;
+}
+
+void FreeTree::set_red(Block *block, bool red)
+{
+    if(block) get_node(block)->_red = red;
+}
+
+bool FreeTree::less(Block *a, Block *b)
+{
+    u64 a_size = a->get_size();
+    u64 b_size = b->get_size();
+    if(a_size != b_size) return a_size < b_size;
+    return a < b;
+}
+
+Block *FreeTree::minimum(Block *block)
+{
+    while(get_left(block))
+    {
+        block = get_left(block);
+    }
+    return block;
+}
+
+void FreeTree::transplant(Block *block, Block *other_block)
+{
+    Block *parent = get_parent(block);
+    if(!parent)
+    {
+        _root = get_link(other_block);
+    }
+    else if(block == get_left(parent))
+    {
+        set_left(parent, other_block);
+    }
+    else
+    {
+        set_right(parent, other_block);
+    }
+    if(other_block) set_parent(other_block, parent);
+}
+
+void FreeTree::rotate_left(Block *block)
+{
+    Block *right = get_right(block);
+    set_right(block, get_left(right));
+    if(get_left(right)) set_parent(get_left(right), block);
+    transplant(block, right);
+    set_left(right, block);
+    set_parent(block, right);
+}
+
+void FreeTree::rotate_right(Block *block)
+{
+    Block *left = get_left(block);
+    set_left(block, get_right(left));
+    if(get_right(left)) set_parent(get_right(left), block);
+    transplant(block, left);
+    set_right(left, block);
+    set_parent(block, left);
+}
+
+void FreeTree::insert_fixup(Block *block)
+{
+    while(is_red(get_parent(block)))
+    {
+        Block *parent = get_parent(block);
+        Block *grand_parent = get_parent(parent);
+        if(parent == get_left(grand_parent))
+        {
+            Block *uncle = get_right(grand_parent);
+            if(is_red(uncle))
+            {
+                set_red(parent, false);
+                set_red(uncle, false);
+                set_red(grand_parent, true);
+                block = grand_parent;
+            }
+            else
+            {
+                if(block == get_right(parent))
+                {
+                    block = parent;
+                    rotate_left(block);
+                    parent = get_parent(block);
+                }
+                set_red(parent, false);
+                set_red(grand_parent, true);
+                rotate_right(grand_parent);
+            }
+        }
+        else
+        {
+            Block *uncle = get_left(grand_parent);
+            if(is_red(uncle))
+            {
+                set_red(parent, false);
+                set_red(uncle, false);
+                set_red(grand_parent, true);
+                block = grand_parent;
+            }
+            else
+            {
+                if(block == get_left(parent))
+                {
+                    block = parent;
+                    rotate_right(block);
+                    parent = get_parent(block);
+                }
+                set_red(parent, false);
+                set_red(grand_parent, true);
+                rotate_left(grand_parent);
+            }
+        }
+    }
+    set_red(get_block(_root), false);
+}
+
+// NOTE: (block) can be 0, that's why the parent is passed explicitly
+void FreeTree::remove_fixup(Block *block, Block *parent)
+{
+    while(block != get_block(_root) && !is_red(block))
+    {
+        if(block == get_left(parent))
+        {
+            Block *sibling = get_right(parent);
+            if(is_red(sibling))
+            {
+                set_red(sibling, false);
+                set_red(parent, true);
+                rotate_left(parent);
+                sibling = get_right(parent);
+            }
+            if(!is_red(get_left(sibling)) && !is_red(get_right(sibling)))
+            {
+                set_red(sibling, true);
+                block = parent;
+                parent = get_parent(block);
+            }
+            else
+            {
+                if(!is_red(get_right(sibling)))
+                {
+                    set_red(get_left(sibling), false);
+                    set_red(sibling, true);
+                    rotate_right(sibling);
+                    sibling = get_right(parent);
+                }
+                set_red(sibling, is_red(parent));
+                set_red(parent, false);
+                set_red(get_right(sibling), false);
+                rotate_left(parent);
+                block = get_block(_root);
+                parent = 0;
+            }
+        }
+        else
+        {
+            Block *sibling = get_left(parent);
+            if(is_red(sibling))
+            {
+                set_red(sibling, false);
+                set_red(parent, true);
+                rotate_right(parent);
+                sibling = get_left(parent);
+            }
+            if(!is_red(get_left(sibling)) && !is_red(get_right(sibling)))
+            {
+                set_red(sibling, true);
+                block = parent;
+                parent = get_parent(block);
+            }
+            else
+            {
+                if(!is_red(get_left(sibling)))
+                {
+                    set_red(get_right(sibling), false);
+                    set_red(sibling, true);
+                    rotate_left(sibling);
+                    sibling = get_left(parent);
+                }
+                set_red(sibling, is_red(parent));
+                set_red(parent, false);
+                set_red(get_left(sibling), false);
+                rotate_right(parent);
+                block = get_block(_root);
+                parent = 0;
+            }
+        }
+    }
+    set_red(block, false);
+}
+
+};
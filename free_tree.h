@@ -0,0 +1,119 @@
+#ifndef FREE_TREE_H
+#define FREE_TREE_H
+
+#include "types.h"
+
+namespace mem
+{
+
+// NOTE: free blocks with a size >= FREE_TREE_MIN_SIZE are kept in the tree,
+// smaller ones stay in the heap linear freelist
+#define FREE_TREE_MIN_SIZE 256
+
+// NOTE: links between blocks are offsets from the heap base, by default 32-bit
+// in units of 8 bytes (heaps up to 32GB), build with HEAP_COMPACT_LINKS=0
+// to get 64-bit byte offsets
+#ifndef HEAP_COMPACT_LINKS
+#define HEAP_COMPACT_LINKS 1
+#endif
+
+#if HEAP_COMPACT_LINKS
+typedef u32 BlockLink;
+#define BLOCK_LINK_SHIFT 3
+#else
+typedef u64 BlockLink;
+#define BLOCK_LINK_SHIFT 0
+#endif
+
+#define BLOCK_LINK_MAX_OFFSET ((u64)(BlockLink)~0 << BLOCK_LINK_SHIFT)
+
+struct Block;
+
+/*@docs------------------------------------------------
+[DES]:  - intrusive red-black tree of free blocks keyed by (size, address),
+          the tree node lives inside the payload of the free block so
+          the index doesn't need extra memory, links are offsets from the
+          heap base so the tree survives a re-map of the region
+-----------------------------------------------------*/
+struct FreeNode
+{
+    BlockLink _left;
+    BlockLink _right;
+    BlockLink _parent;
+    BlockLink _red;
+};
+
+class FreeTree
+{
+public:
+    FreeTree(u8 *base, BlockLink root);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - FreeTree::insert(Block *block)
+    [DES]:  - adds a free block to the tree in O(log n)
+    [IN ]:
+            - block (Block *): free block with size >= FREE_TREE_MIN_SIZE
+    -----------------------------------------------------*/
+    void insert(Block *block);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - FreeTree::remove(Block *block)
+    [DES]:  - removes a block from the tree in O(log n)
+    [IN ]:
+            - block (Block *): block already inserted in the tree
+    -----------------------------------------------------*/
+    void remove(Block *block);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - FreeTree::find_best_fit(u64 size)
+    [DES]:  - returns the smallest block with at least (size) bytes, if
+              there are several with the same size the lowest address wins
+    [IN ]:
+            - size (u64): requested size
+    [OUT]:
+            - block (Block *): best fit block or 0 if there is none
+    -----------------------------------------------------*/
+    Block *find_best_fit(u64 size);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - FreeTree::get_next(Block *block)
+    [DES]:  - returns the next block in (size, address) order, with
+              find_best_fit it's used to walk the blocks above a size
+    [IN ]:
+            - block (Block *): block already inserted in the tree
+    [OUT]:
+            - block (Block *): next block or 0 if (block) is the last one
+    -----------------------------------------------------*/
+    Block *get_next(Block *block);
+
+    bool is_empty();
+    BlockLink get_root();
+
+private:
+    u8 *_base;
+    BlockLink _root;
+
+    Block *get_block(BlockLink link);
+    BlockLink get_link(Block *block);
+    FreeNode *get_node(Block *block);
+    Block *get_left(Block *block);
+    Block *get_right(Block *block);
+    Block *get_parent(Block *block);
+    void set_left(Block *block, Block *left);
+    void set_right(Block *block, Block *right);
+    void set_parent(Block *block, Block *parent);
+    bool is_red(Block *block);
+    void set_red(Block *block, bool red);
+    bool less(Block *a, Block *b);
+
+    Block *minimum(Block *block);
+    void transplant(Block *block, Block *other_block);
+    void rotate_left(Block *block);
+    void rotate_right(Block *block);
+    void insert_fixup(Block *block);
+    void remove_fixup(Block *block, Block *parent);
+};
+
+};
+
+#endif // FREE_TREE_H
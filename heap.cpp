@@ -1,5 +1,7 @@
 #include "heap.h"
+#include "tracer.h"
 #include <stdio.h>
+#include <assert.h>
 
 namespace mem
 {
@@ -17,7 +19,7 @@ namespace mem
 -----------------------------------------------------*/
 void Block::set_used(bool used)
 {
-    used == false ? _size |= 0x1 : _size &= ~0x1;
+    used == false ? _size |= 0x1 : _size &= ~(0x5 | BLOCK_TAG_MASK);
 }
 
 /*@docs------------------------------------------------
@@ -31,9 +33,99 @@ bool Block::is_used()
     return !(_size & 0x1);
 }
 
+/*@docs------------------------------------------------
+[FNC]:  - Block::set_pending(bool pending)
+[DES]:  - set the second bit of size, used by deallocate_batch to mark
+          the blocks that are going to be free
+[IN ]:
+        - pending (bool): true if the block is waiting to be free
+-----------------------------------------------------*/
+void Block::set_pending(bool pending)
+{
+    pending ? _size |= 0x2 : _size &= ~0x2;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Block::is_pending()
+[OUT]:  
+        - pending (bool): returns if the block is waiting to be free
+-----------------------------------------------------*/
+bool Block::is_pending()
+{
+    return (_size & 0x2) != 0;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Block::set_purged(bool purged)
+[DES]:  - set the third bit of size, marks a free block whose pages were
+          given back to the OS, it's cleared when the size changes or the
+          block is used
+[IN ]:
+        - purged (bool): true if the block pages were purged
+-----------------------------------------------------*/
+void Block::set_purged(bool purged)
+{
+    purged ? _size |= 0x4 : _size &= ~0x4;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Block::is_purged()
+[OUT]:  
+        - purged (bool): returns if the block pages were purged
+-----------------------------------------------------*/
+bool Block::is_purged()
+{
+    return (_size & 0x4) != 0;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Block::set_quick(bool quick)
+[DES]:  - set the third bit of size on a used block waiting in a quick
+          list, the bit means purged only on a free block
+[IN ]:
+        - quick (bool): true if the block is in a quick list
+-----------------------------------------------------*/
+void Block::set_quick(bool quick)
+{
+    quick ? _size |= 0x4 : _size &= ~0x4;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Block::is_quick()
+[OUT]:  
+        - quick (bool): returns if the used block is in a quick list
+-----------------------------------------------------*/
+bool Block::is_quick()
+{
+    return is_used() && (_size & 0x4) != 0;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Block::set_tag(u8 tag)
+[DES]:  - set the high byte of size, the tag of a used block, it's
+          cleared when the block is used again
+[IN ]:
+        - tag (u8): tag of the allocation
+-----------------------------------------------------*/
+void Block::set_tag(u8 tag)
+{
+    _size = (_size & ~BLOCK_TAG_MASK) | ((u64)tag << BLOCK_TAG_SHIFT);
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Block::get_tag()
+[OUT]:  
+        - tag (u8): tag of the allocation
+-----------------------------------------------------*/
+u8 Block::get_tag()
+{
+    return (u8)(_size >> BLOCK_TAG_SHIFT);
+}
+
 /*@docs------------------------------------------------
 [FNC]:  - Block::set_size()
-[DES]:  - set the size of a block without modifying the used state 
+[DES]:  - set the size of a block without modifying the used state,
+          a used block keeps its tag
 [IN ]:
         - size (u64): size of the block
 -----------------------------------------------------*/
@@ -46,7 +138,7 @@ void Block::set_size(u64 size)
     }
     else
     {
-        _size = size;
+        _size = size | (_size & BLOCK_TAG_MASK);
     }
 }
 
@@ -58,7 +150,7 @@ void Block::set_size(u64 size)
 -----------------------------------------------------*/
 u64 Block::get_size()
 {
-    return _size & ~0x1;
+    return _size & BLOCK_SIZE_MASK;
 }
 
 /*@docs------------------------------------------------
@@ -78,22 +170,15 @@ u8 *Block::get_data()
 //
 ///////////////////////////////////////////////////////
 
-inline bool next_block_have_size(Block *block, u64 size)
+// NOTE: size of (block) if it absorbs (other_block) and its header
+inline u64 merged_size(Block *block, Block *other_block)
 {
-    if(block->_next)
-    {
-        return (block->get_size() + block->_next->get_size()) >= size;
-    }
-    return false;
+    return block->get_size() + sizeof(Block) + other_block->get_size();
 }
 
-inline bool prev_block_have_size(Block *block, u64 size)
+inline bool block_is_free(Block *block)
 {
-    if(block->_prev)
-    {
-        return (block->get_size() + block->_prev->get_size()) >= size;
-    }
-    return false;
+    return block && !block->is_used();
 }
 
 ///////////////////////////////////////////////////////
@@ -103,6 +188,8 @@ inline bool prev_block_have_size(Block *block, u64 size)
 
 /*@docs------------------------------------------------
 [FNC]:  - Heap(Memory *mem, u64 size)
+[DES]:  - if (mem) is file backed and was closed cleanly the heap
+          state is restored from the previous run
 [IN ]:
         - mem (Memory *): pointer to a memory object
         - size (u64): total size of the heap in bytes
@@ -110,10 +197,31 @@ inline bool prev_block_have_size(Block *block, u64 size)
         - heap (Heap): new Heap object
 -----------------------------------------------------*/
 Heap::Heap(Memory *mem, u64 size) :
-    Arena(mem, size)
+    Arena(mem, size),
+    _free_tree(_base, 0)
 {
-    _top = 0;
-    _freelist = 0;
+    init();
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Heap(u8 *data, u64 size)
+[DES]:  - heap over a region owned by someone else, used by SubHeap
+[IN ]:
+        - data (u8 *): 8 byte aligned start of the region
+        - size (u64): size of the region in bytes
+[OUT]:
+        - heap (Heap): new Heap object
+-----------------------------------------------------*/
+Heap::Heap(u8 *data, u64 size) :
+    Arena(data, size),
+    _free_tree(_base, 0)
+{
+    init();
+}
+
+Heap::~Heap()
+{
+    sync_header();
 }
 
 /*@docs------------------------------------------------
@@ -125,38 +233,232 @@ Heap::Heap(Memory *mem, u64 size) :
 -----------------------------------------------------*/
 u8 *Heap::allocate(u64 size)
 {
+    u8 *data = allocate_tagged(size, _tags ? HeapTagScope::get_current() : HEAP_TAG_NONE);
+    // NOTE: only a hard budget can make allocate fail, a full heap is a bug
+    assert(data || _tags);
+    return data;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Heap::allocate(u64 size, u8 tag)
+[DES]:  - allocate with an explicit tag instead of the one of the current
+          HeapTagScope, the tag is only used after set_tags
+[IN ]:
+        - size (u64): number of bytes to allocate 
+        - tag (u8): tag of the allocation
+[OUT]:
+        - data (u8 *): pointer to the new allocated data, 0 if the tag
+          has a hard budget and the allocation doesn't fit in it
+-----------------------------------------------------*/
+u8 *Heap::allocate(u64 size, u8 tag)
+{
+    u8 *data = allocate_tagged(size, tag);
+    // NOTE: only a hard budget can make allocate fail, a full heap is a bug
+    assert(data || _tags);
+    return data;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Heap::try_allocate(u64 size, u8 tag)
+[DES]:  - like allocate but a full heap returns 0 instead of asserting
+[IN ]:
+        - size (u64): number of bytes to allocate 
+        - tag (u8): tag of the allocation
+[OUT]:
+        - data (u8 *): pointer to the new allocated data or 0
+-----------------------------------------------------*/
+u8 *Heap::try_allocate(u64 size, u8 tag)
+{
+    return allocate_tagged(size, tag);
+}
+
+u8 *Heap::try_allocate(u64 size)
+{
+    return allocate_tagged(size, _tags ? HeapTagScope::get_current() : HEAP_TAG_NONE);
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Heap::deallocate(u8 *base)
+[IN ]:
+        - base (u8 *): already allocated pointer to be free 
+-----------------------------------------------------*/
+void Heap::deallocate(u8 *base)
+{
+    TraceScope trace("Heap::deallocate");
+    if(_profiler) _profiler->record_free(base);
+    Block *block = get_block_from_data(base);
+    assert(block->is_used() && !block->is_quick());
+    release_block(block, block->get_size());
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Heap::deallocate(u8 *base, u64 size)
+[DES]:  - sized free, the size must be the one used to allocate the block,
+          it's checked against the block header in release builds too, a
+          wrong size or a block already free or in a quick list is ignored
+          and the block leaks instead of going to a quick list twice
+[IN ]:
+        - base (u8 *): already allocated pointer to be free 
+        - size (u64): size used to allocate the pointer
+-----------------------------------------------------*/
+void Heap::deallocate(u8 *base, u64 size)
+{
+    TraceScope trace("Heap::deallocate");
+    Block *block = get_block_from_data(base);
+    u64 block_size = block->get_size();
+    // NOTE: a block can be bigger than requested if the split remainder was too small
+    bool valid = block->is_used() && !block->is_quick() && block_size - align8(size) < BLOCK_MIN_SIZE;
+    assert(valid);
+    if(!valid) return;
+    if(_profiler) _profiler->record_free(base);
+    release_block(block, block_size);
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Heap::allocate_batch(u64 count, u64 size, u8 **data)
+[DES]:  - allocates (count) blocks of (size) bytes contiguous in memory,
+          with a single freelist lookup or a single push_size,
+          they take the tag of the current HeapTagScope, all the pointers
+          are 0 if the batch doesn't fit in a hard budget
+[IN ]:
+        - count (u64): number of blocks to allocate
+        - size (u64): number of bytes of each block
+        - data (u8 **): array of (count) pointers filled with the new blocks
+-----------------------------------------------------*/
+void Heap::allocate_batch(u64 count, u64 size, u8 **data)
+{
+    TraceScope trace("Heap::allocate_batch");
+    if(count == 0) return;
+    if(_size_histogram)
+    {
+        for(u64 index = 0; index < count; ++index)
+        {
+            _size_histogram->record(size);
+        }
+    }
     size = align8(size);
-    
-    Block *block = get_best_fit_from_freelist(size);
-    if(block) 
+    u64 stride = sizeof(Block) + size;
+    u64 total_size = count * stride - sizeof(Block);
+
+    u8 tag = _tags ? HeapTagScope::get_current() : HEAP_TAG_NONE;
+    if(_tags && !_tags->check(tag, count * size))
+    {
+        for(u64 index = 0; index < count; ++index)
+        {
+            data[index] = 0;
+        }
+        return;
+    }
+
+    Block *block = get_best_fit_from_freelist(total_size);
+    if(block)
     {
-        try_to_split_block(block, size); 
         remove_block_from_freelist(block);
         block->set_used(true);
-        return block->get_data();
+        try_to_split_block(block, total_size);
+        
+        // NOTE: the last block keeps the split remainder if it was too small
+        u64 last_size = block->get_size() - (count - 1) * stride;
+        block->set_size(count == 1 ? last_size : size);
+        data[0] = block->get_data();
+        for(u64 index = 1; index < count; ++index)
+        {
+            Block *new_block = (Block *)(block->get_data() + block->get_size());
+            new_block->set_used(true);
+            new_block->set_size(index == count - 1 ? last_size : size);
+            new_block->_next_free = 0;
+            new_block->_prev_free = 0;
+            insert_block_after(block, new_block);
+            data[index] = new_block->get_data();
+            block = new_block;
+        }
+    }
+    else
+    {
+        u8 *memory = push_size(count * stride);
+        for(u64 index = 0; index < count; ++index)
+        {
+            block = (Block *)(memory + index * stride);
+            add_block(block, size);
+            data[index] = block->get_data();
+        }
+    }
+
+    for(u64 index = 0; _tags && index < count; ++index)
+    {
+        Block *tagged_block = get_block_from_data(data[index]);
+        tagged_block->set_tag(tag);
+        _tags->add(tag, tagged_block->get_size());
+    }
+    for(u64 index = 0; _profiler && index < count; ++index)
+    {
+        if(_profiler->should_sample(size)) _profiler->record_allocation(data[index], size, 1);
     }
-    
-    block = (Block *)push_size(sizeof(Block) + size);
-    add_block(block, size);
-    
-    return block->get_data();
 }
 
 /*@docs------------------------------------------------
-[FNC]:  - Heap::deallocate(u8 *base)
+[FNC]:  - Heap::deallocate_batch(u8 **data, u64 count)
+[DES]:  - frees (count) pointers, contiguous blocks are merged together
+          before touching the freelist so each run is inserted once
 [IN ]:
-        - base (u8 *): already allocated pointer to be free 
+        - data (u8 **): array of already allocated pointers to be free
+        - count (u64): number of pointers in the array
 -----------------------------------------------------*/
-void Heap::deallocate(u8 *base)
+void Heap::deallocate_batch(u8 **data, u64 count)
 {
-    Block *block = get_block_from_data(base);
-    add_block_to_freelist(block);
-    block = try_to_merge_block(block);
-    block->set_used(false);
+    TraceScope trace("Heap::deallocate_batch");
+    for(u64 index = 0; index < count; ++index)
+    {
+        if(_profiler) _profiler->record_free(data[index]);
+        Block *block = get_block_from_data(data[index]);
+        if(_tags) _tags->release(block->get_tag(), block->get_size());
+        block->set_pending(true);
+    }
+
+    // NOTE: the first block of each run of pending blocks absorbs the run,
+    // the heads are kept used and chained with _next_free until all runs are built
+    BlockLink runs = 0;
+    for(u64 index = 0; index < count; ++index)
+    {
+        Block *block = get_block_from_data(data[index]);
+        Block *prev = get_block(block->_prev);
+        if(!block->is_pending() || (prev && prev->is_pending())) continue;
+
+        block->set_pending(false);
+        Block *next = get_block(block->_next);
+        while(next && (next->is_pending() || !next->is_used()))
+        {
+            if(next->is_pending())
+            {
+                next->set_pending(false);
+            }
+            else
+            {
+                remove_block_from_freelist(next);
+            }
+            u64 total_size = next->get_size() + sizeof(Block);
+            remove_block(next);
+            block->set_size(block->get_size() + total_size);
+            next = get_block(block->_next);
+        }
+        block->_next_free = runs;
+        runs = get_link(block);
+    }
+
+    while(runs)
+    {
+        Block *block = get_block(runs);
+        runs = block->_next_free;
+        free_block(block);
+    }
 }
 
 /*@docs------------------------------------------------
 [FNC]:  - Heap::reallocate(u64 size)
+[DES]:  - the paths are tried in order, the ones that don't copy first:
+          grow or shrink the top block, shrink in place, grow into a free
+          right block, merge with a free left block big enough alone and
+          copy, allocate a new block and copy
 [IN ]:
         - data (u8 *): pointer to the memory buffer to be reallocated 
         - size (u64): size of the new memory buffer 
@@ -165,30 +467,161 @@ void Heap::deallocate(u8 *base)
 -----------------------------------------------------*/
 u8 *Heap::reallocate(u8 *data, u64 size)
 {
+    TraceScope trace("Heap::reallocate");
+    if(!_profiler && !_tags) return reallocate_block(data, size);
+
+    // NOTE: a reallocation is profiled as a free and a new allocation and
+    // keeps the tag of the old block, the profiler and the tags are off
+    // meanwhile so the slow path isn't recorded twice
+    HeapProfiler *profiler = _profiler;
+    HeapTags *tags = _tags;
     Block *block = get_block_from_data(data);
+    u8 tag = block->get_tag();
     u64 block_size = block->get_size();
-    if(block_size == size) return data;
-    
-    if(last_allocated_block(block))
+    if(tags && align8(size) > block_size && !tags->check(tag, align8(size) - block_size)) return 0;
+
+    if(profiler) profiler->record_free(data);
+    _profiler = 0;
+    _tags = 0;
+    u8 *new_data = reallocate_block(data, size);
+    _profiler = profiler;
+    _tags = tags;
+
+    if(tags)
     {
-        resize_block(block, size);
-        return data;
+        Block *new_block = get_block_from_data(new_data);
+        new_block->set_tag(tag);
+        tags->release(tag, block_size);
+        tags->add(tag, new_block->get_size());
     }
-    else if(size > block_size)
+    if(profiler && profiler->should_sample(size)) profiler->record_allocation(new_data, size, 1);
+    return new_data;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Heap::get_realloc_stats()
+[OUT]:
+        - stats (HeapReallocStats): how many times each reallocate path was taken
+-----------------------------------------------------*/
+HeapReallocStats Heap::get_realloc_stats()
+{
+    return _realloc_stats;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Heap::sync_header()
+[DES]:  - flushes the quick lists and saves the heap and arena headers
+          like a clean close, the heap stays usable, mark_header_dirty
+          must follow once the headers were copied
+-----------------------------------------------------*/
+void Heap::sync_header()
+{
+    // NOTE: the quick lists are not saved, its blocks go back to the freelist
+    flush_quicklists();
+    _heap_header->_top = _top;
+    _heap_header->_freelist = _freelist;
+    _heap_header->_tree_root = _free_tree.get_root();
+    _heap_header->_magic = HEAP_MAGIC;
+    Arena::sync_header();
+}
+
+void Heap::mark_header_dirty()
+{
+    _heap_header->_magic = 0;
+    Arena::mark_header_dirty();
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Heap::flush_quicklists()
+[DES]:  - frees all the blocks waiting in the quick lists, merging them
+          with their neighbours and moving them to the freelist
+-----------------------------------------------------*/
+void Heap::flush_quicklists()
+{
+    TraceScope trace("Heap::flush_quicklists");
+    for(u32 index = 0; index < QUICKLIST_COUNT && _quick_count; ++index)
     {
-        if(next_block_have_size(block, size))
+        while(_quicklist[index])
         {
-            try_to_merge_block_right(block);
-            return data;
+            Block *block = get_block(_quicklist[index]);
+            _quicklist[index] = block->_next_free;
+            block->_next_free = 0;
+            block->set_quick(false);
+            --_quick_count;
+            free_block(block);
         }
-        else if(prev_block_have_size(block, size))
+    }
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Heap::purge_free_blocks(u64 min_size)
+[DES]:  - gives back to the OS the pages inside the free blocks of at
+          least (min_size) bytes, the block header and tree node are kept
+[IN ]:
+        - min_size (u64): smallest block size to purge
+[OUT]:
+        - purged (u64): number of bytes purged
+-----------------------------------------------------*/
+u64 Heap::purge_free_blocks(u64 min_size)
+{
+    TraceScope trace("Heap::purge_free_blocks");
+    if(min_size < FREE_TREE_MIN_SIZE) min_size = FREE_TREE_MIN_SIZE;
+    
+    u64 purged = 0;
+    Block *block = _free_tree.find_best_fit(min_size);
+    while(block)
+    {
+        if(!block->is_purged())
         {
-            Block *new_block = try_to_merge_block_left(block);
-            safe_memcpy(new_block->get_data(), block->get_data(), block->get_size());
-            return new_block->get_data();
+            u8 *data = block->get_data() + sizeof(FreeNode);
+            purged += purge_pages(data, block->get_size() - sizeof(FreeNode));
+            block->set_purged(true);
         }
+        block = _free_tree.get_next(block);
     }
-    return slow_realloc(block, size);
+    return purged;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Heap::set_size_histogram(SizeHistogram *histogram)
+[DES]:  - from now on every allocate records its requested size in
+          (histogram), 0 stops the recording
+[IN ]:
+        - histogram (SizeHistogram *): histogram to fill or 0
+-----------------------------------------------------*/
+void Heap::set_size_histogram(SizeHistogram *histogram)
+{
+    _size_histogram = histogram;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Heap::set_profiler(HeapProfiler *profiler)
+[DES]:  - from now on the allocations are sampled by (profiler), the
+          pointers sampled before a change are not tracked anymore
+[IN ]:
+        - profiler (HeapProfiler *): profiler or 0 to stop profiling
+-----------------------------------------------------*/
+void Heap::set_profiler(HeapProfiler *profiler)
+{
+    _profiler = profiler;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Heap::set_tags(HeapTags *tags)
+[DES]:  - from now on the used bytes of every tag are counted in (tags)
+          and the tag budgets are checked, it must be set before the
+          first allocation so every block has a valid tag
+[IN ]:
+        - tags (HeapTags *): tag table or 0 to stop the accounting
+-----------------------------------------------------*/
+void Heap::set_tags(HeapTags *tags)
+{
+    _tags = tags;
+}
+
+u8 Heap::get_tag(u8 *data)
+{
+    return get_block_from_data(data)->get_tag();
 }
 
 ///////////////////////////////////////////////////////
@@ -198,14 +631,193 @@ u8 *Heap::reallocate(u8 *data, u64 size)
 
 // (Heap) functions.
 
+void Heap::init()
+{
+    _realloc_stats = {};
+    for(u32 index = 0; index < QUICKLIST_COUNT; ++index)
+    {
+        _quicklist[index] = 0;
+    }
+    _quick_count = 0;
+    _size_histogram = 0;
+    _profiler = 0;
+    _tags = 0;
+    assert(_size <= BLOCK_LINK_MAX_OFFSET);
+    _heap_header = (HeapHeader *)(_base + sizeof(ArenaHeader));
+    if(_restored && _heap_header->_magic == HEAP_MAGIC)
+    {
+        _top = _heap_header->_top;
+        _freelist = _heap_header->_freelist;
+        _free_tree = FreeTree(_base, _heap_header->_tree_root);
+    }
+    else
+    {
+        // NOTE: the headers are the first bytes of the arena, so offset 0
+        // is never a valid block and can be used as the null link
+        assert(sizeof(ArenaHeader) + sizeof(HeapHeader) <= _size);
+        _used = sizeof(ArenaHeader) + sizeof(HeapHeader);
+        _top = 0;
+        _freelist = 0;
+    }
+    _heap_header->_magic = 0;
+}
+
+// NOTE: every allocate and try_allocate calls this directly so the profiler
+// always has the same two Heap frames to skip
+u8 *Heap::allocate_tagged(u64 size, u8 tag)
+{
+    TraceScope trace("Heap::allocate");
+    if(_size_histogram) _size_histogram->record(size);
+    if(_tags && !_tags->check(tag, align8(size))) return 0;
+    u8 *data = allocate_block(size);
+    if(!data) return 0;
+    if(_tags)
+    {
+        Block *block = get_block_from_data(data);
+        block->set_tag(tag);
+        _tags->add(tag, block->get_size());
+    }
+    if(_profiler && _profiler->should_sample(size)) _profiler->record_allocation(data, size, 2);
+    return data;
+}
+
+u8 *Heap::allocate_block(u64 size)
+{
+    size = align8(size);
+    
+    if(size && size <= QUICKLIST_MAX_SIZE)
+    {
+        BlockLink *quicklist = &_quicklist[(size >> 3) - 1];
+        if(*quicklist)
+        {
+            Block *block = get_block(*quicklist);
+            *quicklist = block->_next_free;
+            block->_next_free = 0;
+            block->set_quick(false);
+            --_quick_count;
+            return block->get_data();
+        }
+    }
+    
+    Block *block = get_best_fit_from_freelist(size);
+    if(!block && _quick_count)
+    {
+        flush_quicklists();
+        block = get_best_fit_from_freelist(size);
+    }
+    if(block) 
+    {
+        remove_block_from_freelist(block);
+        block->set_used(true);
+        try_to_split_block(block, size); 
+        return block->get_data();
+    }
+    
+    if(_used + sizeof(Block) + size > _size) return 0;
+    block = (Block *)push_size(sizeof(Block) + size);
+    add_block(block, size);
+    
+    return block->get_data();
+}
+
+u8 *Heap::reallocate_block(u8 *data, u64 size)
+{
+    size = align8(size);
+    Block *block = get_block_from_data(data);
+    u64 block_size = block->get_size();
+    if(block_size == size)
+    {
+        ++_realloc_stats._same_size;
+        return data;
+    }
+    
+    if(last_allocated_block(block))
+    {
+        resize_block(block, size);
+        ++_realloc_stats._top;
+        return data;
+    }
+    
+    if(size < block_size)
+    {
+        try_to_split_block(block, size);
+        ++_realloc_stats._shrink;
+        return data;
+    }
+    
+    Block *next = get_block(block->_next);
+    if(block_is_free(next) && merged_size(block, next) >= size)
+    {
+        try_to_merge_block_right(block);
+        try_to_split_block(block, size);
+        ++_realloc_stats._grow_right;
+        return data;
+    }
+    
+    // NOTE: merging left copies the same bytes as slow_realloc, it's only
+    // taken when the left block is enough so a free right block stays next
+    // to the data and the next grow is in place instead of a larger copy
+    Block *prev = get_block(block->_prev);
+    if(block_is_free(prev) && merged_size(prev, block) >= size)
+    {
+        Block *new_block = try_to_merge_block_left(block);
+        new_block->set_used(true);
+        safe_memcpy(new_block->get_data(), data, block_size);
+        try_to_split_block(new_block, size);
+        ++_realloc_stats._merge_left;
+        return new_block->get_data();
+    }
+    
+    ++_realloc_stats._slow;
+    return slow_realloc(block, size);
+}
+
 u8 *Heap::slow_realloc(Block *block, u64 size)
 {
     u8 *new_data = allocate(size);
-    safe_memcpy(new_data, block->get_data(), block->get_size());
+    u64 block_size = block->get_size();
+    safe_memcpy(new_data, block->get_data(), block_size < size ? block_size : size);
     deallocate(block->get_data());
     return new_data;
 }
 
+void Heap::release_block(Block *block, u64 block_size)
+{
+    if(_tags) _tags->release(block->get_tag(), block_size);
+    if(block_size && block_size <= QUICKLIST_MAX_SIZE)
+    {
+        // NOTE: the block stays marked as used so the neighbours don't merge
+        // with it, the quick bit tells a second free of it
+        BlockLink *quicklist = &_quicklist[(block_size >> 3) - 1];
+        block->set_quick(true);
+        block->_next_free = *quicklist;
+        *quicklist = get_link(block);
+        if(++_quick_count > QUICKLIST_FLUSH_COUNT)
+        {
+            flush_quicklists();
+        }
+        return;
+    }
+    free_block(block);
+}
+
+void Heap::free_block(Block *block)
+{
+    block->set_used(false);
+    block = try_to_merge_block(block);
+    add_block_to_freelist(block);
+}
+
+Block *Heap::get_block(BlockLink link)
+{
+    return link ? (Block *)(_base + ((u64)link << BLOCK_LINK_SHIFT)) : 0;
+}
+
+BlockLink Heap::get_link(Block *block)
+{
+    return block ? (BlockLink)((u64)((u8 *)block - _base) >> BLOCK_LINK_SHIFT) : 0;
+}
+
 // (Heap - Block) functions.
 
 
@@ -227,10 +839,10 @@ void Heap::add_block(Block *block, u64 size)
     
     if(_top)
     {
-        _top->_next = block;
+        get_block(_top)->_next = get_link(block);
         block->_prev = _top;
     }
-    _top = block;
+    _top = get_link(block);
 }
 
 /*@docs------------------------------------------------
@@ -242,10 +854,12 @@ void Heap::add_block(Block *block, u64 size)
 -----------------------------------------------------*/
 void Heap::insert_block_after(Block *block, Block *other_block)
 {
+    BlockLink other_link = get_link(other_block);
     other_block->_next = block->_next;
-    other_block->_prev = block;
-    block->_next = other_block;
-    if(block == _top) _top = other_block;
+    other_block->_prev = get_link(block);
+    if(block->_next) get_block(block->_next)->_prev = other_link;
+    block->_next = other_link;
+    if(!other_block->_next) _top = other_link;
 }
 
 /*@docs------------------------------------------------
@@ -259,14 +873,14 @@ void Heap::remove_block(Block *block)
     if(!block->_next)
     {
         _top = block->_prev; 
-        _top->_next = 0;
+        if(_top) get_block(_top)->_next = 0;
     }
     else
     {
-        Block *prev = block->_prev; 
-        Block *next = block->_next;
-        prev->_next = next;
-        next->_prev = prev;
+        Block *prev = get_block(block->_prev); 
+        Block *next = get_block(block->_next);
+        prev->_next = block->_next;
+        next->_prev = block->_prev;
     }
     block->_prev = 0;
     block->_next = 0;
@@ -310,12 +924,13 @@ void Heap::resize_block(Block *block, u64 size)
 -----------------------------------------------------*/
 bool Heap::last_allocated_block(Block *block)
 {
-    return _top == block;
+    return get_block(_top) == block;
 }
 
 /*@docs------------------------------------------------
 [FNC]:  - Heap::try_to_merge_block(Block *block)
-[DES]:  - try to merge the block with the _next or _prev block if one of those are free
+[DES]:  - try to merge the block with the _next or _prev block if one of those are free,
+          the block itself must not be in the freelist, the free neighbours are removed from it
 [IN ]:
         - block (Block *): pointer to the heap block 
 [OUT]:
@@ -330,25 +945,25 @@ Block *Heap::try_to_merge_block(Block *block)
 
 void Heap::try_to_merge_block_right(Block *block)
 {
-    Block *right_block = block->_next;
+    Block *right_block = get_block(block->_next);
     if(right_block && !right_block->is_used())
     {
         u64 total_size = right_block->get_size() + sizeof(Block);
-        block->set_size(block->get_size() + total_size);
         remove_block_from_freelist(right_block);
         remove_block(right_block);
+        block->set_size(block->get_size() + total_size);
     }
 }
 
 Block *Heap::try_to_merge_block_left(Block *block)
 {
-    Block *left_block = block->_prev;
+    Block *left_block = get_block(block->_prev);
     if(left_block && !left_block->is_used())
     {
         u64 total_size = block->get_size() + sizeof(Block);
-        left_block->set_size(left_block->get_size() + total_size);
-        remove_block_from_freelist(block);
+        remove_block_from_freelist(left_block);
         remove_block(block);
+        left_block->set_size(left_block->get_size() + total_size);
         block = left_block;
     }
     return block;
@@ -356,7 +971,8 @@ Block *Heap::try_to_merge_block_left(Block *block)
 
 /*@docs------------------------------------------------
 [FNC]:  - Heap::try_to_split_block(Block *block, u64 size)
-[DES]:  - if the block size is larger than size, it will try to split it in a small block
+[DES]:  - if the block size is larger than size, it will try to split it in a small block,
+          the new free block is merged with the next one if that one is free too
 [IN ]:
         - block (Block *): pointer to the heap block 
         - size (u64): new block size
@@ -378,85 +994,92 @@ void Heap::split_block(Block *block, u64 size, u64 new_block_size)
     new_block->set_used(false);
     new_block->set_size(new_block_size - sizeof(Block));
     insert_block_after(block, new_block);
-    insert_block_after_freelist(block, new_block);
+    try_to_merge_block_right(new_block);
+    add_block_to_freelist(new_block);
 }
 
 // (Heap - Freelist) functions
 
 Block *Heap::get_first_fit_from_freelist(u64 size)
 {
-    Block *block = _freelist;
+    Block *block = get_block(_freelist);
     while(block)
     {
         if(block->get_size() >= size)
         {
             return block;
         }
-        block = block->_next_free;
+        block = get_block(block->_next_free);
     }
     return block;
 }
 
+// NOTE: the linear freelist only holds blocks smaller than FREE_TREE_MIN_SIZE,
+// so any block found there is a better fit than the ones in the tree
 Block *Heap::get_best_fit_from_freelist(u64 size)
 {
-    Block *best_block = get_first_fit_from_freelist(size);
-    if(!best_block)
+    if(size < FREE_TREE_MIN_SIZE)
     {
-        return 0;
-    }
-    
-    Block *block = best_block->_next_free;
-    while(block)
-    {
-        u64 block_size = block->get_size();
-        if(block_size >= size && block_size < best_block->get_size())
+        Block *best_block = get_first_fit_from_freelist(size);
+        if(best_block)
         {
-            best_block = block;
+            Block *block = get_block(best_block->_next_free);
+            while(block && best_block->get_size() != size)
+            {
+                u64 block_size = block->get_size();
+                if(block_size >= size && block_size < best_block->get_size())
+                {
+                    best_block = block;
+                }
+                block = get_block(block->_next_free);
+            }
+            return best_block;
         }
-        block = block->_next_free;
     }
-    return best_block;
+    return _free_tree.find_best_fit(size);
 }
 
 void Heap::add_block_to_freelist(Block *block)
 {
-    if(!_freelist)
-    {
-        _freelist = block;
-    }
-    else
+    if(block->get_size() >= FREE_TREE_MIN_SIZE)
     {
-        _freelist->_prev_free = block;
-        block->_next_free = _freelist;
-        _freelist = block;
+        _free_tree.insert(block);
+        return;
     }
+    
+    BlockLink link = get_link(block);
+    block->_prev_free = 0;
+    block->_next_free = _freelist;
+    if(_freelist) get_block(_freelist)->_prev_free = link;
+    _freelist = link;
 }
 
-void Heap::insert_block_after_freelist(Block *block, Block *other_block)
-{
-    other_block->_next_free = block->_next_free;
-    other_block->_prev_free = block;
-    block->_next_free = other_block;
-}
-
+// NOTE: the size of a block must not change while it is in the freelist,
+// it's used to know if the block lives in the linear list or in the tree
 void Heap::remove_block_from_freelist(Block *block)
 {
+    if(block->get_size() >= FREE_TREE_MIN_SIZE)
+    {
+        _free_tree.remove(block);
+        return;
+    }
+    
     if(!block->_prev_free)
     {
         _freelist = block->_next_free;
-        if(_freelist) _freelist->_prev_free = 0; 
+        if(_freelist) get_block(_freelist)->_prev_free = 0; 
     }
     else if(!block->_next_free)
     {
-        Block *prev = block->_prev_free; 
+        Block *prev = get_block(block->_prev_free); 
         prev->_next_free = 0;
     }
     else
     {
-        Block *prev = block->_prev_free; 
-        Block *next = block->_next_free;
-        prev->_next_free = next;
-        next->_prev_free = prev;
+        Block *prev = get_block(block->_prev_free); 
+        Block *next = get_block(block->_next_free);
+        prev->_next_free = block->_next_free;
+        next->_prev_free = block->_prev_free;
     }
     block->_prev_free = 0;
     block->_next_free = 0;
@@ -464,7 +1087,7 @@ void Heap::remove_block_from_freelist(Block *block)
 
 bool Heap::freelist_have_blocks()
 {
-    return _freelist != 0;
+    return _freelist != 0 || !_free_tree.is_empty();
 }
 
 void Heap::debug_print_block(Block *block)
@@ -477,7 +1100,7 @@ void Heap::debug_print_block(Block *block)
 void Heap::debug_print_state()
 {
     u32 count = 0;
-    Block *block = (Block *)_base;
+    Block *block = _top ? (Block *)(_base + sizeof(ArenaHeader) + sizeof(HeapHeader)) : 0;
 
     printf("memory info:\n");
     printf("-----------------------------\n");
@@ -485,7 +1108,7 @@ void Heap::debug_print_state()
     {
         printf("-------- block: %d ----------\n", ++count);
         debug_print_block(block);
-        block = block->_next;
+        block = get_block(block->_next);
         printf("-----------------------------\n");
     }
     printf("\n\n");
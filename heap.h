@@ -2,12 +2,31 @@
 #define HEAP_H
 
 #include "arena.h"
+#include "free_tree.h"
+#include "size_histogram.h"
+#include "heap_profiler.h"
+#include "heap_tags.h"
 
 namespace mem
 {
 
 #define BLOCK_MIN_SIZE (sizeof(Block) + sizeof(u64))
 
+// NOTE: freed blocks up to QUICKLIST_MAX_SIZE go to an exact size LIFO list
+// without merging, the lists are merged back when they hold more than
+// QUICKLIST_FLUSH_COUNT blocks or before the heap grows for a request that
+// doesn't fit in the freelist
+#define QUICKLIST_MAX_SIZE 256
+#define QUICKLIST_COUNT (QUICKLIST_MAX_SIZE / 8)
+#define QUICKLIST_FLUSH_COUNT 128
+#define HEAP_MAGIC (0x50414548ULL | ((u64)sizeof(BlockLink) << 32))
+
+// NOTE: the low 3 bits of the block size are the free/pending/purged flags,
+// the high byte is the tag of a used block
+#define BLOCK_TAG_SHIFT 56
+#define BLOCK_TAG_MASK (0xFFULL << BLOCK_TAG_SHIFT)
+#define BLOCK_SIZE_MASK (~BLOCK_TAG_MASK & ~0x7ULL)
+
 struct Block
 {
     /*@docs------------------------------------------------
@@ -26,6 +45,71 @@ struct Block
     -----------------------------------------------------*/
     bool is_used();
 
+    /*@docs------------------------------------------------
+    [FNC]:  - Block::set_pending(bool pending)
+    [DES]:  - set the second bit of size, used by deallocate_batch to mark
+              the blocks that are going to be free
+    [IN ]:
+            - pending (bool): true if the block is waiting to be free
+    -----------------------------------------------------*/
+    void set_pending(bool pending);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Block::is_pending()
+    [OUT]:  
+            - pending (bool): returns if the block is waiting to be free
+    -----------------------------------------------------*/
+    bool is_pending();
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Block::set_purged(bool purged)
+    [DES]:  - set the third bit of size, marks a free block whose pages were
+              given back to the OS, it's cleared when the size changes or the
+              block is used
+    [IN ]:
+            - purged (bool): true if the block pages were purged
+    -----------------------------------------------------*/
+    void set_purged(bool purged);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Block::is_purged()
+    [OUT]:  
+            - purged (bool): returns if the block pages were purged
+    -----------------------------------------------------*/
+    bool is_purged();
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Block::set_quick(bool quick)
+    [DES]:  - set the third bit of size on a used block waiting in a quick
+              list, the bit means purged only on a free block
+    [IN ]:
+            - quick (bool): true if the block is in a quick list
+    -----------------------------------------------------*/
+    void set_quick(bool quick);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Block::is_quick()
+    [OUT]:  
+            - quick (bool): returns if the used block is in a quick list
+    -----------------------------------------------------*/
+    bool is_quick();
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Block::set_tag(u8 tag)
+    [DES]:  - set the high byte of size, the tag of a used block, it's
+              cleared when the block is used again
+    [IN ]:
+            - tag (u8): tag of the allocation
+    -----------------------------------------------------*/
+    void set_tag(u8 tag);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Block::get_tag()
+    [OUT]:  
+            - tag (u8): tag of the allocation
+    -----------------------------------------------------*/
+    u8 get_tag();
+
     /*@docs------------------------------------------------
     [FNC]:  - Block::set_size()
     [DES]:  - set the size of a block without modifying the used state 
@@ -50,20 +134,49 @@ struct Block
     -----------------------------------------------------*/
     u8 *get_data();
     
-    Block *_next;
-    Block *_prev;
+    // NOTE: links are offsets from the heap base (0 means no block), so
+    // the heap image doesn't depend on the address it is mapped at
+    BlockLink _next;
+    BlockLink _prev;
 
-    Block *_next_free;
-    Block *_prev_free;
+    BlockLink _next_free;
+    BlockLink _prev_free;
 private:
     u64 _size;
 };
 
+/*@docs------------------------------------------------
+[DES]:  - heap state saved after the arena header, like the arena header
+          magic is only valid after a clean close
+-----------------------------------------------------*/
+struct HeapHeader
+{
+    u64 _magic;
+    u64 _top;
+    u64 _freelist;
+    u64 _tree_root;
+};
+
+/*@docs------------------------------------------------
+[DES]:  - number of times each Heap::reallocate path was taken
+-----------------------------------------------------*/
+struct HeapReallocStats
+{
+    u64 _same_size;
+    u64 _top;
+    u64 _shrink;
+    u64 _grow_right;
+    u64 _merge_left;
+    u64 _slow;
+};
+
 class Heap : public Arena 
 {
 public:
     /*@docs------------------------------------------------
     [FNC]:  - Heap(Memory *mem, u64 size)
+    [DES]:  - if (mem) is file backed and was closed cleanly the heap
+              state is restored from the previous run
     [IN ]:
             - mem (Memory *): pointer to a memory object
             - size (u64): total size of the heap in bytes
@@ -71,6 +184,17 @@ public:
             - heap (Heap): new Heap object
     -----------------------------------------------------*/
     Heap(Memory *mem, u64 size);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Heap(u8 *data, u64 size)
+    [DES]:  - heap over a region owned by someone else, used by SubHeap
+    [IN ]:
+            - data (u8 *): 8 byte aligned start of the region
+            - size (u64): size of the region in bytes
+    [OUT]:
+            - heap (Heap): new Heap object
+    -----------------------------------------------------*/
+    Heap(u8 *data, u64 size);
     
     /*@docs------------------------------------------------
     [FNC]:  - Heap::allocate(u64 size)
@@ -81,6 +205,31 @@ public:
     -----------------------------------------------------*/
     u8 *allocate(u64 size);
 
+    /*@docs------------------------------------------------
+    [FNC]:  - Heap::allocate(u64 size, u8 tag)
+    [DES]:  - allocate with an explicit tag instead of the one of the current
+              HeapTagScope, the tag is only used after set_tags
+    [IN ]:
+            - size (u64): number of bytes to allocate 
+            - tag (u8): tag of the allocation
+    [OUT]:
+            - data (u8 *): pointer to the new allocated data, 0 if the tag
+              has a hard budget and the allocation doesn't fit in it
+    -----------------------------------------------------*/
+    u8 *allocate(u64 size, u8 tag);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Heap::try_allocate(u64 size, u8 tag)
+    [DES]:  - like allocate but a full heap returns 0 instead of asserting
+    [IN ]:
+            - size (u64): number of bytes to allocate 
+            - tag (u8): tag of the allocation
+    [OUT]:
+            - data (u8 *): pointer to the new allocated data or 0
+    -----------------------------------------------------*/
+    u8 *try_allocate(u64 size, u8 tag);
+    u8 *try_allocate(u64 size);
+
     /*@docs------------------------------------------------
     [FNC]:  - Heap::deallocate(u8 *base)
     [IN ]:
@@ -88,8 +237,47 @@ public:
     -----------------------------------------------------*/
     void deallocate(u8 *base);
 
+    /*@docs------------------------------------------------
+    [FNC]:  - Heap::deallocate(u8 *base, u64 size)
+    [DES]:  - sized free, the size must be the one used to allocate the block,
+              it's checked against the block header in release builds too, a
+              wrong size or a block already free or in a quick list is ignored
+              and the block leaks instead of going to a quick list twice
+    [IN ]:
+            - base (u8 *): already allocated pointer to be free 
+            - size (u64): size used to allocate the pointer
+    -----------------------------------------------------*/
+    void deallocate(u8 *base, u64 size);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Heap::allocate_batch(u64 count, u64 size, u8 **data)
+    [DES]:  - allocates (count) blocks of (size) bytes contiguous in memory,
+              with a single freelist lookup or a single push_size,
+              they take the tag of the current HeapTagScope, all the pointers
+              are 0 if the batch doesn't fit in a hard budget
+    [IN ]:
+            - count (u64): number of blocks to allocate
+            - size (u64): number of bytes of each block
+            - data (u8 **): array of (count) pointers filled with the new blocks
+    -----------------------------------------------------*/
+    void allocate_batch(u64 count, u64 size, u8 **data);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Heap::deallocate_batch(u8 **data, u64 count)
+    [DES]:  - frees (count) pointers, contiguous blocks are merged together
+              before touching the freelist so each run is inserted once
+    [IN ]:
+            - data (u8 **): array of already allocated pointers to be free
+            - count (u64): number of pointers in the array
+    -----------------------------------------------------*/
+    void deallocate_batch(u8 **data, u64 count);
+
     /*@docs------------------------------------------------
     [FNC]:  - Heap::reallocate(u64 size)
+    [DES]:  - the paths are tried in order, the ones that don't copy first:
+              grow or shrink the top block, shrink in place, grow into a free
+              right block, merge with a free left block big enough alone and
+              copy, allocate a new block and copy
     [IN ]:
             - data (u8 *): pointer to the memory buffer to be reallocated 
             - size (u64): size of the new memory buffer 
@@ -98,18 +286,98 @@ public:
     -----------------------------------------------------*/
     u8 *reallocate(u8 *data, u64 size);
 
-    ~Heap() = default;
+    /*@docs------------------------------------------------
+    [FNC]:  - Heap::get_realloc_stats()
+    [OUT]:
+            - stats (HeapReallocStats): how many times each reallocate path was taken
+    -----------------------------------------------------*/
+    HeapReallocStats get_realloc_stats();
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Heap::sync_header()
+    [DES]:  - flushes the quick lists and saves the heap and arena headers
+              like a clean close, the heap stays usable, mark_header_dirty
+              must follow once the headers were copied
+    -----------------------------------------------------*/
+    void sync_header();
+    void mark_header_dirty();
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Heap::flush_quicklists()
+    [DES]:  - frees all the blocks waiting in the quick lists, merging them
+              with their neighbours and moving them to the freelist
+    -----------------------------------------------------*/
+    void flush_quicklists();
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Heap::purge_free_blocks(u64 min_size)
+    [DES]:  - gives back to the OS the pages inside the free blocks of at
+              least (min_size) bytes, the block header and tree node are kept
+    [IN ]:
+            - min_size (u64): smallest block size to purge
+    [OUT]:
+            - purged (u64): number of bytes purged
+    -----------------------------------------------------*/
+    u64 purge_free_blocks(u64 min_size);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Heap::set_size_histogram(SizeHistogram *histogram)
+    [DES]:  - from now on every allocate records its requested size in
+              (histogram), 0 stops the recording
+    [IN ]:
+            - histogram (SizeHistogram *): histogram to fill or 0
+    -----------------------------------------------------*/
+    void set_size_histogram(SizeHistogram *histogram);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Heap::set_profiler(HeapProfiler *profiler)
+    [DES]:  - from now on the allocations are sampled by (profiler), the
+              pointers sampled before a change are not tracked anymore
+    [IN ]:
+            - profiler (HeapProfiler *): profiler or 0 to stop profiling
+    -----------------------------------------------------*/
+    void set_profiler(HeapProfiler *profiler);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Heap::set_tags(HeapTags *tags)
+    [DES]:  - from now on the used bytes of every tag are counted in (tags)
+              and the tag budgets are checked, it must be set before the
+              first allocation so every block has a valid tag
+    [IN ]:
+            - tags (HeapTags *): tag table or 0 to stop the accounting
+    -----------------------------------------------------*/
+    void set_tags(HeapTags *tags);
+
+    u8 get_tag(u8 *data);
+
+    ~Heap();
 
     void debug_print_block(Block *block);
     void debug_print_state();
 
 private:
     
-    Block *_top;
-    Block *_freelist;
+    HeapHeader *_heap_header;
+    BlockLink _top;
+    BlockLink _freelist;
+    FreeTree _free_tree;
+    HeapReallocStats _realloc_stats;
+    BlockLink _quicklist[QUICKLIST_COUNT];
+    u32 _quick_count;
+    SizeHistogram *_size_histogram;
+    HeapProfiler *_profiler;
+    HeapTags *_tags;
     
     // (Heap) functions.
+    void init();
+    u8 *allocate_tagged(u64 size, u8 tag);
+    u8 *allocate_block(u64 size);
+    u8 *reallocate_block(u8 *data, u64 size);
     u8 *slow_realloc(Block *block, u64 size);
+    void release_block(Block *block, u64 block_size);
+    void free_block(Block *block);
+    Block *get_block(BlockLink link);
+    BlockLink get_link(Block *block);
     
     // (Heap - Block) functions.
     void add_block(Block *block, u64 size);
@@ -128,7 +396,6 @@ private:
     Block *get_first_fit_from_freelist(u64 size);
     Block *get_best_fit_from_freelist(u64 size);
     void add_block_to_freelist(Block *block);
-    void insert_block_after_freelist(Block *block, Block *other_block);
     void remove_block_from_freelist(Block *block);
     bool freelist_have_blocks();
 };
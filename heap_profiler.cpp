@@ -0,0 +1,306 @@
+#include "heap_profiler.h"
+#include <Windows.h>
+#include <DbgHelp.h>
+#include <stdio.h>
+#include <math.h>
+#include <assert.h>
+
+namespace mem
+{
+
+#define HEAP_PROFILER_NO_SITE 0xFFFFFFFF
+
+static u32 sample_slot(u8 *data)
+{
+    return (u32)((((u64)data >> 3) * 0x9E3779B97F4A7C15ULL) >> 32) & (HEAP_PROFILER_SAMPLE_SLOTS - 1);
+}
+
+///////////////////////////////////////////////////////
+//      HeapProfiler methods:
+//      Public interface
+///////////////////////////////////////////////////////
+
+/*@docs------------------------------------------------
+[FNC]:  - HeapProfiler(Memory *mem, u64 sample_interval)
+[DES]:  - the tables are taken from (mem), HEAP_PROFILER_ARENA_SIZE bytes
+[IN ]:
+        - mem (Memory *): pointer to a memory object
+        - sample_interval (u64): mean number of bytes between two samples
+[OUT]:
+        - profiler (HeapProfiler): new HeapProfiler object
+-----------------------------------------------------*/
+HeapProfiler::HeapProfiler(Memory *mem, u64 sample_interval) :
+    _arena(mem, HEAP_PROFILER_ARENA_SIZE)
+{
+    assert(sample_interval > 0);
+    _sites = (HeapProfileSite *)_arena.push_size(HEAP_PROFILER_MAX_SITES * sizeof(HeapProfileSite));
+    _site_slots = (u32 *)_arena.push_size(HEAP_PROFILER_SITE_SLOTS * sizeof(u32));
+    _samples = (HeapProfileSample *)_arena.push_size(HEAP_PROFILER_SAMPLE_SLOTS * sizeof(HeapProfileSample));
+    for(u32 index = 0; index < HEAP_PROFILER_SITE_SLOTS; ++index)
+    {
+        _site_slots[index] = 0;
+    }
+    for(u32 index = 0; index < HEAP_PROFILER_SAMPLE_SLOTS; ++index)
+    {
+        _samples[index]._data = 0;
+    }
+    _site_count = 0;
+    _sample_count = 0;
+    _sample_interval = sample_interval;
+    _random = 0x853C49E6748FEA9BULL ^ (u64)this;
+    _stats = {};
+    _bytes_until_sample = next_sample_distance();
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - HeapProfiler::record_allocation(u8 *data, u64 size, u32 skip)
+[DES]:  - captures the stack of the caller and adds the sample to its site
+[IN ]:
+        - data (u8 *): new allocated pointer
+        - size (u64): requested size of the allocation
+        - skip (u32): number of Heap frames between this function and
+          the code that asked for the allocation
+-----------------------------------------------------*/
+void HeapProfiler::record_allocation(u8 *data, u64 size, u32 skip)
+{
+    _bytes_until_sample = next_sample_distance();
+    ++_stats._samples;
+
+    // NOTE: an allocation of (size) bytes is sampled with probability
+    // 1 - e^(-size / interval), the sample stands for 1 / probability of them
+    f64 probability = 1.0 - exp(-(f64)size / (f64)_sample_interval);
+    if(probability <= 0.0) probability = 1.0;
+    u64 bytes = (u64)((f64)size / probability);
+    u32 count = (u32)(1.0 / probability + 0.5);
+
+    void *frames[HEAP_PROFILER_MAX_DEPTH];
+    ULONG hash = 0;
+    // NOTE: skips this function and the Heap frames so the sites start at
+    // the caller, whatever entry point it used
+    u32 depth = CaptureStackBackTrace(1 + skip, HEAP_PROFILER_MAX_DEPTH, frames, &hash);
+    u32 site_index = find_site(hash, (u64 *)frames, depth);
+    if(site_index == HEAP_PROFILER_NO_SITE || _sample_count >= HEAP_PROFILER_MAX_SAMPLES)
+    {
+        ++_stats._dropped;
+        return;
+    }
+
+    HeapProfileSite *site = &_sites[site_index];
+    site->_live_bytes += bytes;
+    site->_live_count += count;
+    site->_total_bytes += bytes;
+    site->_total_count += count;
+    _stats._live_bytes += bytes;
+    _stats._total_bytes += bytes;
+
+    u32 slot = sample_slot(data);
+    while(_samples[slot]._data)
+    {
+        slot = (slot + 1) & (HEAP_PROFILER_SAMPLE_SLOTS - 1);
+    }
+    _samples[slot]._data = data;
+    _samples[slot]._site = site_index;
+    _samples[slot]._count = count;
+    _samples[slot]._bytes = bytes;
+    ++_sample_count;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - HeapProfiler::record_free(u8 *data)
+[DES]:  - removes the sample of (data) from its site live bytes, if
+          (data) wasn't sampled nothing happens
+[IN ]:
+        - data (u8 *): pointer about to be free
+-----------------------------------------------------*/
+void HeapProfiler::record_free(u8 *data)
+{
+    if(!_sample_count) return;
+    HeapProfileSample *sample = find_sample(data);
+    if(!sample) return;
+
+    HeapProfileSite *site = &_sites[sample->_site];
+    site->_live_bytes -= sample->_bytes;
+    site->_live_count -= sample->_count;
+    _stats._live_bytes -= sample->_bytes;
+    remove_sample(sample);
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - HeapProfiler::write_collapsed(const char *path, bool live)
+[DES]:  - one line per site with the frames from the root separated by
+          ';' and the bytes, the format of flamegraph.pl and speedscope,
+          the frames are symbolized with DbgHelp when possible
+[IN ]:
+        - path (const char *): output file
+        - live (bool): true for the live bytes, false for the total bytes
+[OUT]:
+        - ok (bool): false if the file can't be written
+-----------------------------------------------------*/
+bool HeapProfiler::write_collapsed(const char *path, bool live)
+{
+    FILE *file = fopen(path, "w");
+    if(!file) return false;
+
+    HANDLE process = GetCurrentProcess();
+    bool symbols = SymInitialize(process, 0, TRUE);
+    u8 symbol_buffer[sizeof(SYMBOL_INFO) + 256];
+    SYMBOL_INFO *symbol = (SYMBOL_INFO *)symbol_buffer;
+
+    for(u32 site_index = 0; site_index < _site_count; ++site_index)
+    {
+        HeapProfileSite *site = &_sites[site_index];
+        u64 bytes = live ? site->_live_bytes : site->_total_bytes;
+        if(!bytes) continue;
+        for(u32 frame = site->_depth; frame > 0; --frame)
+        {
+            u64 address = site->_frames[frame - 1];
+            symbol->SizeOfStruct = sizeof(SYMBOL_INFO);
+            symbol->MaxNameLen = 256;
+            DWORD64 displacement = 0;
+            if(symbols && SymFromAddr(process, address, &displacement, symbol))
+            {
+                fprintf(file, "%s%s", symbol->Name, frame > 1 ? ";" : "");
+            }
+            else
+            {
+                fprintf(file, "0x%llx%s", address, frame > 1 ? ";" : "");
+            }
+        }
+        fprintf(file, " %lld\n", bytes);
+    }
+
+    if(symbols) SymCleanup(process);
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - HeapProfiler::write_pprof(const char *path)
+[DES]:  - legacy text heap profile read by pprof, with raw addresses
+          that pprof symbolizes against the binary
+[IN ]:
+        - path (const char *): output file
+[OUT]:
+        - ok (bool): false if the file can't be written
+-----------------------------------------------------*/
+bool HeapProfiler::write_pprof(const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if(!file) return false;
+
+    u64 live_count = 0;
+    u64 total_count = 0;
+    for(u32 site_index = 0; site_index < _site_count; ++site_index)
+    {
+        live_count += _sites[site_index]._live_count;
+        total_count += _sites[site_index]._total_count;
+    }
+
+    // NOTE: the values are already unsampled, "heapprofile" tells pprof
+    // not to scale them again
+    fprintf(file, "heap profile: %lld: %lld [%lld: %lld] @ heapprofile\n",
+            live_count, _stats._live_bytes, total_count, _stats._total_bytes);
+    for(u32 site_index = 0; site_index < _site_count; ++site_index)
+    {
+        HeapProfileSite *site = &_sites[site_index];
+        fprintf(file, "%lld: %lld [%lld: %lld] @",
+                site->_live_count, site->_live_bytes, site->_total_count, site->_total_bytes);
+        for(u32 frame = 0; frame < site->_depth; ++frame)
+        {
+            fprintf(file, " 0x%llx", site->_frames[frame]);
+        }
+        fprintf(file, "\n");
+    }
+
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
+
+HeapProfileStats HeapProfiler::get_stats()
+{
+    return _stats;
+}
+
+///////////////////////////////////////////////////////
+//      HeapProfiler methods:
+//      Private
+///////////////////////////////////////////////////////
+
+u64 HeapProfiler::next_sample_distance()
+{
+    // NOTE: xorshift64*, then an exponential distance with mean _sample_interval
+    _random ^= _random >> 12;
+    _random ^= _random << 25;
+    _random ^= _random >> 27;
+    u64 bits = (_random * 0x2545F4914F6CDD1DULL) >> 11;
+    f64 uniform = ((f64)bits + 1.0) / (f64)(1ULL << 53);
+    return (u64)(-log(uniform) * (f64)_sample_interval) + 1;
+}
+
+u32 HeapProfiler::find_site(u64 hash, u64 *frames, u32 depth)
+{
+    // NOTE: the slots keep site index + 1, 0 is an empty slot
+    u32 slot = (u32)(hash * 0x9E3779B97F4A7C15ULL >> 32) & (HEAP_PROFILER_SITE_SLOTS - 1);
+    while(_site_slots[slot])
+    {
+        HeapProfileSite *site = &_sites[_site_slots[slot] - 1];
+        bool same = site->_hash == hash && site->_depth == depth;
+        for(u32 frame = 0; same && frame < depth; ++frame)
+        {
+            same = site->_frames[frame] == frames[frame];
+        }
+        if(same) return _site_slots[slot] - 1;
+        slot = (slot + 1) & (HEAP_PROFILER_SITE_SLOTS - 1);
+    }
+
+    if(_site_count == HEAP_PROFILER_MAX_SITES) return HEAP_PROFILER_NO_SITE;
+    HeapProfileSite *site = &_sites[_site_count];
+    site->_hash = hash;
+    site->_live_bytes = 0;
+    site->_live_count = 0;
+    site->_total_bytes = 0;
+    site->_total_count = 0;
+    site->_depth = depth;
+    for(u32 frame = 0; frame < depth; ++frame)
+    {
+        site->_frames[frame] = frames[frame];
+    }
+    _site_slots[slot] = ++_site_count;
+    return _site_count - 1;
+}
+
+HeapProfileSample *HeapProfiler::find_sample(u8 *data)
+{
+    u32 slot = sample_slot(data);
+    while(_samples[slot]._data)
+    {
+        if(_samples[slot]._data == data) return &_samples[slot];
+        slot = (slot + 1) & (HEAP_PROFILER_SAMPLE_SLOTS - 1);
+    }
+    return 0;
+}
+
+void HeapProfiler::remove_sample(HeapProfileSample *sample)
+{
+    // NOTE: linear probing without tombstones, the following samples of the
+    // cluster are moved back if the hole is between them and their slot
+    u32 hole = (u32)(sample - _samples);
+    u32 slot = hole;
+    _samples[hole]._data = 0;
+    for(;;)
+    {
+        slot = (slot + 1) & (HEAP_PROFILER_SAMPLE_SLOTS - 1);
+        if(!_samples[slot]._data) break;
+        u32 home = sample_slot(_samples[slot]._data);
+        bool stays = hole <= slot ? (hole < home && home <= slot) : (hole < home || home <= slot);
+        if(stays) continue;
+        _samples[hole] = _samples[slot];
+        _samples[slot]._data = 0;
+        hole = slot;
+    }
+    --_sample_count;
+}
+
+};
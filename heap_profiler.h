@@ -0,0 +1,163 @@
+#ifndef HEAP_PROFILER_H
+#define HEAP_PROFILER_H
+
+#include "arena.h"
+
+namespace mem
+{
+
+#define HEAP_PROFILER_MAX_DEPTH 32
+#define HEAP_PROFILER_MAX_SITES 4096
+#define HEAP_PROFILER_SITE_SLOTS (HEAP_PROFILER_MAX_SITES * 2)
+#define HEAP_PROFILER_MAX_SAMPLES 32768
+#define HEAP_PROFILER_SAMPLE_SLOTS (HEAP_PROFILER_MAX_SAMPLES * 2)
+#define HEAP_PROFILER_DEFAULT_INTERVAL KB(512)
+
+/*@docs------------------------------------------------
+[DES]:  - allocation site, the bytes and counts are estimates of the real
+          ones from the samples taken at this stack
+-----------------------------------------------------*/
+struct HeapProfileSite
+{
+    u64 _hash;
+    u64 _live_bytes;
+    u64 _live_count;
+    u64 _total_bytes;
+    u64 _total_count;
+    u32 _depth;
+    u32 _pad;
+    u64 _frames[HEAP_PROFILER_MAX_DEPTH];
+};
+
+/*@docs------------------------------------------------
+[DES]:  - sampled allocation still alive, (_data) is 0 in an empty slot
+-----------------------------------------------------*/
+struct HeapProfileSample
+{
+    u8 *_data;
+    u32 _site;
+    u32 _count;
+    u64 _bytes;
+};
+
+struct HeapProfileStats
+{
+    u64 _samples;
+    u64 _dropped;
+    u64 _live_bytes;
+    u64 _total_bytes;
+};
+
+#define HEAP_PROFILER_ARENA_SIZE (sizeof(mem::ArenaHeader) + \
+                                  HEAP_PROFILER_MAX_SITES * sizeof(mem::HeapProfileSite) + \
+                                  HEAP_PROFILER_SITE_SLOTS * sizeof(u32) + \
+                                  HEAP_PROFILER_SAMPLE_SLOTS * sizeof(mem::HeapProfileSample))
+
+/*@docs------------------------------------------------
+[DES]:  - sampling heap profiler, one allocation is sampled every
+          (sample_interval) bytes on average, the distance between two
+          samples is random with a geometric distribution so the
+          allocation patterns can't hide from it, every sample captures
+          the stack of the allocation and is weighted to estimate the
+          live and total bytes of its allocation site, an allocation
+          that is not sampled only costs a subtraction
+-----------------------------------------------------*/
+class HeapProfiler
+{
+public:
+    /*@docs------------------------------------------------
+    [FNC]:  - HeapProfiler(Memory *mem, u64 sample_interval)
+    [DES]:  - the tables are taken from (mem), HEAP_PROFILER_ARENA_SIZE bytes
+    [IN ]:
+            - mem (Memory *): pointer to a memory object
+            - sample_interval (u64): mean number of bytes between two samples
+    [OUT]:
+            - profiler (HeapProfiler): new HeapProfiler object
+    -----------------------------------------------------*/
+    HeapProfiler(Memory *mem, u64 sample_interval);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - HeapProfiler::should_sample(u64 size)
+    [DES]:  - fast path called by the heap for every allocation
+    [IN ]:
+            - size (u64): requested size of the allocation
+    [OUT]:
+            - sample (bool): true if record_allocation must be called
+    -----------------------------------------------------*/
+    bool should_sample(u64 size)
+    {
+        if(size < _bytes_until_sample)
+        {
+            _bytes_until_sample -= size;
+            return false;
+        }
+        return true;
+    }
+
+    /*@docs------------------------------------------------
+    [FNC]:  - HeapProfiler::record_allocation(u8 *data, u64 size, u32 skip)
+    [DES]:  - captures the stack of the caller and adds the sample to its site
+    [IN ]:
+            - data (u8 *): new allocated pointer
+            - size (u64): requested size of the allocation
+            - skip (u32): number of Heap frames between this function and
+              the code that asked for the allocation
+    -----------------------------------------------------*/
+    void record_allocation(u8 *data, u64 size, u32 skip);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - HeapProfiler::record_free(u8 *data)
+    [DES]:  - removes the sample of (data) from its site live bytes, if
+              (data) wasn't sampled nothing happens
+    [IN ]:
+            - data (u8 *): pointer about to be free
+    -----------------------------------------------------*/
+    void record_free(u8 *data);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - HeapProfiler::write_collapsed(const char *path, bool live)
+    [DES]:  - one line per site with the frames from the root separated by
+              ';' and the bytes, the format of flamegraph.pl and speedscope,
+              the frames are symbolized with DbgHelp when possible
+    [IN ]:
+            - path (const char *): output file
+            - live (bool): true for the live bytes, false for the total bytes
+    [OUT]:
+            - ok (bool): false if the file can't be written
+    -----------------------------------------------------*/
+    bool write_collapsed(const char *path, bool live);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - HeapProfiler::write_pprof(const char *path)
+    [DES]:  - legacy text heap profile read by pprof, with raw addresses
+              that pprof symbolizes against the binary
+    [IN ]:
+            - path (const char *): output file
+    [OUT]:
+            - ok (bool): false if the file can't be written
+    -----------------------------------------------------*/
+    bool write_pprof(const char *path);
+
+    HeapProfileStats get_stats();
+
+private:
+    Arena _arena;
+    HeapProfileSite *_sites;
+    u32 *_site_slots;
+    HeapProfileSample *_samples;
+    u32 _site_count;
+    u32 _sample_count;
+    u64 _sample_interval;
+    u64 _bytes_until_sample;
+    u64 _random;
+    HeapProfileStats _stats;
+
+    u64 next_sample_distance();
+    u32 find_site(u64 hash, u64 *frames, u32 depth);
+    HeapProfileSample *find_sample(u8 *data);
+    void remove_sample(HeapProfileSample *sample);
+};
+
+};
+
+#endif // HEAP_PROFILER_H
@@ -0,0 +1,89 @@
+#include "heap_tags.h"
+
+namespace mem
+{
+
+static thread_local u8 heap_current_tag = HEAP_TAG_NONE;
+
+///////////////////////////////////////////////////////
+//      HeapTags methods:
+//      Public interface
+///////////////////////////////////////////////////////
+
+HeapTags::HeapTags()
+{
+    for(u32 tag = 0; tag < HEAP_TAG_COUNT; ++tag)
+    {
+        _tags[tag] = {};
+    }
+    _callback = 0;
+    _user = 0;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - HeapTags::set_budget(u8 tag, u64 budget, bool hard)
+[IN ]:
+        - tag (u8): tag of the subsystem
+        - budget (u64): max live bytes of the tag, 0 for no budget
+        - hard (bool): true to make the allocations over budget fail
+-----------------------------------------------------*/
+void HeapTags::set_budget(u8 tag, u64 budget, bool hard)
+{
+    _tags[tag]._budget = budget;
+    _tags[tag]._hard = hard;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - HeapTags::set_callback(HeapBudgetCallback callback, void *user)
+[IN ]:
+        - callback (HeapBudgetCallback): called on every over budget request or 0
+        - user (void *): passed back to the callback
+-----------------------------------------------------*/
+void HeapTags::set_callback(HeapBudgetCallback callback, void *user)
+{
+    _callback = callback;
+    _user = user;
+}
+
+HeapTagStats HeapTags::get_stats(u8 tag)
+{
+    return _tags[tag];
+}
+
+///////////////////////////////////////////////////////
+//      HeapTags methods:
+//      Private
+///////////////////////////////////////////////////////
+
+bool HeapTags::over_budget(u8 tag, u64 size)
+{
+    HeapTagStats *stats = &_tags[tag];
+    ++stats->_over_budget_count;
+    if(_callback) _callback(tag, stats->_live_bytes, size, _user);
+    if(!stats->_hard || stats->_live_bytes + size <= stats->_budget) return true;
+    ++stats->_failed_count;
+    return false;
+}
+
+///////////////////////////////////////////////////////
+//      HeapTagScope methods:
+//      Public interface
+///////////////////////////////////////////////////////
+
+HeapTagScope::HeapTagScope(u8 tag)
+{
+    _prev = heap_current_tag;
+    heap_current_tag = tag;
+}
+
+HeapTagScope::~HeapTagScope()
+{
+    heap_current_tag = _prev;
+}
+
+u8 HeapTagScope::get_current()
+{
+    return heap_current_tag;
+}
+
+};
@@ -0,0 +1,114 @@
+#ifndef HEAP_TAGS_H
+#define HEAP_TAGS_H
+
+#include "types.h"
+
+namespace mem
+{
+
+// NOTE: the tag of a used block is kept in the high byte of its size, tag 0
+// is the default one of the allocations made outside any HeapTagScope
+#define HEAP_TAG_COUNT 256
+#define HEAP_TAG_NONE 0
+
+/*@docs------------------------------------------------
+[DES]:  - called when an allocation of a tag goes over its budget, before
+          the allocation is done, it can free memory of the tag (trim a
+          cache) to make room for the request
+-----------------------------------------------------*/
+typedef void (*HeapBudgetCallback)(u8 tag, u64 live_bytes, u64 request, void *user);
+
+struct HeapTagStats
+{
+    u64 _live_bytes;
+    u64 _peak_bytes;
+    u64 _budget;
+    u64 _over_budget_count;
+    u64 _failed_count;
+    bool _hard;
+};
+
+/*@docs------------------------------------------------
+[DES]:  - live bytes and budget of every tag of a heap, a soft budget only
+          calls the callback, a hard budget also makes the allocation
+          fail (allocate returns 0) if the callback didn't free enough
+-----------------------------------------------------*/
+class HeapTags
+{
+public:
+    HeapTags();
+
+    /*@docs------------------------------------------------
+    [FNC]:  - HeapTags::set_budget(u8 tag, u64 budget, bool hard)
+    [IN ]:
+            - tag (u8): tag of the subsystem
+            - budget (u64): max live bytes of the tag, 0 for no budget
+            - hard (bool): true to make the allocations over budget fail
+    -----------------------------------------------------*/
+    void set_budget(u8 tag, u64 budget, bool hard);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - HeapTags::set_callback(HeapBudgetCallback callback, void *user)
+    [IN ]:
+            - callback (HeapBudgetCallback): called on every over budget request or 0
+            - user (void *): passed back to the callback
+    -----------------------------------------------------*/
+    void set_callback(HeapBudgetCallback callback, void *user);
+
+    HeapTagStats get_stats(u8 tag);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - HeapTags::check(u8 tag, u64 size)
+    [DES]:  - fast path called by the heap before an allocation
+    [IN ]:
+            - tag (u8): tag of the allocation
+            - size (u64): bytes about to be added to the tag
+    [OUT]:
+            - allowed (bool): false if the allocation must fail
+    -----------------------------------------------------*/
+    bool check(u8 tag, u64 size)
+    {
+        HeapTagStats *stats = &_tags[tag];
+        if(!stats->_budget || stats->_live_bytes + size <= stats->_budget) return true;
+        return over_budget(tag, size);
+    }
+
+    void add(u8 tag, u64 size)
+    {
+        HeapTagStats *stats = &_tags[tag];
+        stats->_live_bytes += size;
+        if(stats->_live_bytes > stats->_peak_bytes) stats->_peak_bytes = stats->_live_bytes;
+    }
+
+    void release(u8 tag, u64 size)
+    {
+        _tags[tag]._live_bytes -= size;
+    }
+
+private:
+    HeapTagStats _tags[HEAP_TAG_COUNT];
+    HeapBudgetCallback _callback;
+    void *_user;
+
+    bool over_budget(u8 tag, u64 size);
+};
+
+/*@docs------------------------------------------------
+[DES]:  - the allocations of the thread without an explicit tag get (tag)
+          until the scope ends, scopes can be nested
+-----------------------------------------------------*/
+class HeapTagScope
+{
+public:
+    HeapTagScope(u8 tag);
+    ~HeapTagScope();
+
+    static u8 get_current();
+
+private:
+    u8 _prev;
+};
+
+};
+
+#endif // HEAP_TAGS_H
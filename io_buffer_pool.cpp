@@ -0,0 +1,163 @@
+#include "io_buffer_pool.h"
+#include <assert.h>
+
+namespace mem
+{
+
+///////////////////////////////////////////////////////
+//      IoBufferPool methods:
+//      Public interface
+///////////////////////////////////////////////////////
+
+/*@docs------------------------------------------------
+[FNC]:  - IoBufferPool(Memory *mem, u32 buffer_size, u32 buffer_count)
+[IN ]:
+        - mem (Memory *): pointer to a memory object
+        - buffer_size (u32): size of every buffer, multiple of
+          IO_BUFFER_ALIGNMENT
+        - buffer_count (u32): number of buffers
+[OUT]:
+        - pool (IoBufferPool): new IoBufferPool object
+-----------------------------------------------------*/
+IoBufferPool::IoBufferPool(Memory *mem, u32 buffer_size, u32 buffer_count) :
+    _arena(mem, sizeof(ArenaHeader) + buffer_count * sizeof(IoBufferState) + IO_BUFFER_ALIGNMENT +
+                (u64)buffer_size * buffer_count)
+{
+    assert(buffer_size && buffer_size % IO_BUFFER_ALIGNMENT == 0);
+    assert(buffer_count && buffer_count < IO_BUFFER_NONE);
+    _buffer_size = buffer_size;
+    _buffer_count = buffer_count;
+    _states = (IoBufferState *)_arena.push_size(buffer_count * sizeof(IoBufferState));
+    _data = _arena.push_aligned((u64)buffer_size * buffer_count, IO_BUFFER_ALIGNMENT);
+    for(u32 index = 0; index < buffer_count; ++index)
+    {
+        _states[index]._refs = 0;
+        _states[index]._next = index + 1 < buffer_count ? index + 2 : 0;
+    }
+    _free_buffers = 1;
+    _acquired = 0;
+    _recycled = 0;
+    _failed = 0;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - IoBufferPool::acquire()
+[OUT]:
+        - buffer (u32): index of a free buffer with one reference owned
+          by the caller, IO_BUFFER_NONE if all the buffers are in use
+-----------------------------------------------------*/
+u32 IoBufferPool::acquire()
+{
+    // NOTE: same tagged stack as ConcurrentPool, the high 32 bits count the
+    // changes so a head popped and pushed back meanwhile fails the exchange
+    u64 old_head = _free_buffers.load(std::memory_order_acquire);
+    while((u32)old_head)
+    {
+        u32 buffer = (u32)old_head - 1;
+        u32 next = _states[buffer]._next.load(std::memory_order_relaxed);
+        u64 new_head = (((old_head >> 32) + 1) << 32) | next;
+        if(_free_buffers.compare_exchange_weak(old_head, new_head, std::memory_order_acquire, std::memory_order_acquire))
+        {
+            _states[buffer]._refs.store(1, std::memory_order_relaxed);
+            _acquired.fetch_add(1, std::memory_order_relaxed);
+            return buffer;
+        }
+    }
+    _failed.fetch_add(1, std::memory_order_relaxed);
+    return IO_BUFFER_NONE;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - IoBufferPool::slice(u32 buffer, u32 offset, u32 length)
+[DES]:  - adds a reference to (buffer), the caller must already hold one
+[IN ]:
+        - buffer (u32): index of an acquired buffer
+        - offset (u32): start of the slice in the buffer
+        - length (u32): size of the slice
+[OUT]:
+        - slice (IoSlice): slice to give back with release
+-----------------------------------------------------*/
+IoSlice IoBufferPool::slice(u32 buffer, u32 offset, u32 length)
+{
+    assert(buffer < _buffer_count);
+    assert((u64)offset + length <= _buffer_size);
+    u32 refs = _states[buffer]._refs.fetch_add(1, std::memory_order_relaxed);
+    assert(refs);
+    IoSlice slice;
+    slice._data = get_data(buffer) + offset;
+    slice._length = length;
+    slice._buffer = buffer;
+    return slice;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - IoBufferPool::retain(IoSlice *slice)
+[DES]:  - adds a reference for a copy of (slice)
+-----------------------------------------------------*/
+void IoBufferPool::retain(IoSlice *slice)
+{
+    u32 refs = _states[slice->_buffer]._refs.fetch_add(1, std::memory_order_relaxed);
+    assert(refs);
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - IoBufferPool::release(u32 buffer)
+[DES]:  - drops one reference, the last one gives the buffer back
+[IN ]:
+        - buffer (u32): index of an acquired buffer
+-----------------------------------------------------*/
+void IoBufferPool::release(u32 buffer)
+{
+    assert(buffer < _buffer_count);
+    // NOTE: acq_rel so the reads of the other owners happen before the
+    // buffer is given to the next reader
+    u32 refs = _states[buffer]._refs.fetch_sub(1, std::memory_order_acq_rel);
+    assert(refs);
+    if(refs == 1) push_free(buffer);
+}
+
+void IoBufferPool::release(IoSlice *slice)
+{
+    release(slice->_buffer);
+    slice->_data = 0;
+    slice->_length = 0;
+}
+
+u8 *IoBufferPool::get_data(u32 buffer)
+{
+    assert(buffer < _buffer_count);
+    return _data + (u64)buffer * _buffer_size;
+}
+
+u32 IoBufferPool::get_buffer_size()
+{
+    return _buffer_size;
+}
+
+IoBufferStats IoBufferPool::get_stats()
+{
+    IoBufferStats stats;
+    stats._acquired = _acquired.load(std::memory_order_relaxed);
+    stats._recycled = _recycled.load(std::memory_order_relaxed);
+    stats._failed = _failed.load(std::memory_order_relaxed);
+    return stats;
+}
+
+///////////////////////////////////////////////////////
+//      IoBufferPool methods:
+//      Private
+///////////////////////////////////////////////////////
+
+void IoBufferPool::push_free(u32 buffer)
+{
+    u64 old_head = _free_buffers.load(std::memory_order_relaxed);
+    u64 new_head;
+    do
+    {
+        _states[buffer]._next.store((u32)old_head, std::memory_order_relaxed);
+        new_head = (((old_head >> 32) + 1) << 32) | (buffer + 1);
+    } while(!_free_buffers.compare_exchange_weak(old_head, new_head, std::memory_order_release, std::memory_order_relaxed));
+    _recycled.fetch_add(1, std::memory_order_relaxed);
+}
+
+};
@@ -0,0 +1,120 @@
+#ifndef IO_BUFFER_POOL_H
+#define IO_BUFFER_POOL_H
+
+#include "arena.h"
+#include <atomic>
+
+namespace mem
+{
+
+// NOTE: buffers are addressed by index, the free stack links are index + 1
+// so 0 means none
+#define IO_BUFFER_ALIGNMENT MEMORY_PAGE_SIZE
+#define IO_BUFFER_NONE 0xFFFFFFFF
+
+/*@docs------------------------------------------------
+[DES]:  - out of band state of a buffer so the buffer itself is only data
+-----------------------------------------------------*/
+struct IoBufferState
+{
+    std::atomic<u32> _refs;
+    std::atomic<u32> _next;
+};
+
+/*@docs------------------------------------------------
+[DES]:  - bytes of a pool buffer, it holds one reference on the buffer
+-----------------------------------------------------*/
+struct IoSlice
+{
+    u8 *_data;
+    u32 _length;
+    u32 _buffer;
+};
+
+struct IoBufferStats
+{
+    u64 _acquired;
+    u64 _recycled;
+    u64 _failed;
+};
+
+/*@docs------------------------------------------------
+[DES]:  - pool of fixed size buffers for the I/O paths, every buffer starts
+          on a page and its size is a multiple of the page so it can be read
+          with FILE_FLAG_NO_BUFFERING and split in page segments for
+          ReadFileScatter and WriteFileGather, a parsed record keeps a slice
+          of the buffer it arrived in instead of a copy, the buffer goes back
+          to the pool when its last reference is released, references can be
+          released from any thread
+-----------------------------------------------------*/
+class IoBufferPool
+{
+public:
+    /*@docs------------------------------------------------
+    [FNC]:  - IoBufferPool(Memory *mem, u32 buffer_size, u32 buffer_count)
+    [IN ]:
+            - mem (Memory *): pointer to a memory object
+            - buffer_size (u32): size of every buffer, multiple of
+              IO_BUFFER_ALIGNMENT
+            - buffer_count (u32): number of buffers
+    [OUT]:
+            - pool (IoBufferPool): new IoBufferPool object
+    -----------------------------------------------------*/
+    IoBufferPool(Memory *mem, u32 buffer_size, u32 buffer_count);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - IoBufferPool::acquire()
+    [OUT]:
+            - buffer (u32): index of a free buffer with one reference owned
+              by the caller, IO_BUFFER_NONE if all the buffers are in use
+    -----------------------------------------------------*/
+    u32 acquire();
+
+    /*@docs------------------------------------------------
+    [FNC]:  - IoBufferPool::slice(u32 buffer, u32 offset, u32 length)
+    [DES]:  - adds a reference to (buffer), the caller must already hold one
+    [IN ]:
+            - buffer (u32): index of an acquired buffer
+            - offset (u32): start of the slice in the buffer
+            - length (u32): size of the slice
+    [OUT]:
+            - slice (IoSlice): slice to give back with release
+    -----------------------------------------------------*/
+    IoSlice slice(u32 buffer, u32 offset, u32 length);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - IoBufferPool::retain(IoSlice *slice)
+    [DES]:  - adds a reference for a copy of (slice)
+    -----------------------------------------------------*/
+    void retain(IoSlice *slice);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - IoBufferPool::release(u32 buffer)
+    [DES]:  - drops one reference, the last one gives the buffer back
+    [IN ]:
+            - buffer (u32): index of an acquired buffer
+    -----------------------------------------------------*/
+    void release(u32 buffer);
+    void release(IoSlice *slice);
+
+    u8 *get_data(u32 buffer);
+    u32 get_buffer_size();
+    IoBufferStats get_stats();
+
+private:
+    Arena _arena;
+    u8 *_data;
+    IoBufferState *_states;
+    u32 _buffer_size;
+    u32 _buffer_count;
+    alignas(64) std::atomic<u64> _free_buffers;
+    std::atomic<u64> _acquired;
+    std::atomic<u64> _recycled;
+    std::atomic<u64> _failed;
+
+    void push_free(u32 buffer);
+};
+
+};
+
+#endif // IO_BUFFER_POOL_H
@@ -0,0 +1,219 @@
+#include "maintenance.h"
+#include "tracer.h"
+#include <Windows.h>
+#include <assert.h>
+
+namespace mem
+{
+
+// NOTE: the thread entry needs the OS calling convention, it's kept out of the header
+struct MaintenanceWorker
+{
+    static DWORD WINAPI proc(LPVOID data);
+};
+
+///////////////////////////////////////////////////////
+//      HeapMaintainer methods:
+//      Public interface
+///////////////////////////////////////////////////////
+
+/*@docs------------------------------------------------
+[FNC]:  - HeapMaintainer(Heap *heap, u32 interval_ms, u32 frees_per_tick)
+[DES]:  - starts the worker thread, from now on the heap must only be used
+          through the maintainer
+[IN ]:
+        - heap (Heap *): heap to maintain
+        - interval_ms (u32): time between two worker ticks
+        - frees_per_tick (u32): max number of deferred frees done in a tick
+[OUT]:
+        - maintainer (HeapMaintainer): new HeapMaintainer object
+-----------------------------------------------------*/
+HeapMaintainer::HeapMaintainer(Heap *heap, u32 interval_ms, u32 frees_per_tick)
+{
+    static_assert(sizeof(_lock) == sizeof(SRWLOCK), "SRWLOCK must fit in _lock");
+    _heap = heap;
+    InitializeSRWLock((PSRWLOCK)&_lock);
+    _deferred = 0;
+    _running = true;
+    _paused = false;
+    _interval_ms = interval_ms;
+    _frees_per_tick = frees_per_tick;
+    _pending = 0;
+    _stats = {};
+
+    _wake_event = CreateEventA(0, FALSE, FALSE, 0);
+    _thread = CreateThread(0, 0, MaintenanceWorker::proc, this, 0, 0);
+    assert(_wake_event && _thread);
+}
+
+HeapMaintainer::~HeapMaintainer()
+{
+    _running = false;
+    SetEvent((HANDLE)_wake_event);
+    WaitForSingleObject((HANDLE)_thread, INFINITE);
+    CloseHandle((HANDLE)_thread);
+    CloseHandle((HANDLE)_wake_event);
+
+    // NOTE: the worker is gone, free everything that is still deferred
+    _paused = false;
+    _frees_per_tick = 0xFFFFFFFF;
+    tick();
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - HeapMaintainer::allocate(u64 size)
+[IN ]:
+        - size (u64): number of bytes to allocate
+[OUT]:
+        - data (u8 *): pointer to the new allocated data
+-----------------------------------------------------*/
+u8 *HeapMaintainer::allocate(u64 size)
+{
+    // NOTE: a deferred free stores the stack link in the first bytes of the data
+    if(size < sizeof(u8 *)) size = sizeof(u8 *);
+    lock();
+    u8 *data = _heap->allocate(size);
+    unlock();
+    return data;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - HeapMaintainer::deallocate(u8 *data)
+[DES]:  - lock-free, the pointer is pushed to the deferred stack and freed
+          by the worker in its next tick
+[IN ]:
+        - data (u8 *): already allocated pointer to be free
+-----------------------------------------------------*/
+void HeapMaintainer::deallocate(u8 *data)
+{
+    u8 *head = _deferred.load(std::memory_order_relaxed);
+    do
+    {
+        *(u8 **)data = head;
+    }
+    while(!_deferred.compare_exchange_weak(head, data, std::memory_order_release, std::memory_order_relaxed));
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - HeapMaintainer::pause()
+[DES]:  - the worker stops its current tick and waits until resume, when
+          pause returns the worker doesn't touch the heap anymore, the
+          deferred frees keep accumulating meanwhile
+-----------------------------------------------------*/
+void HeapMaintainer::pause()
+{
+    _paused = true;
+    // NOTE: waits for the batch or the purge that holds the lock now
+    lock();
+    unlock();
+}
+
+void HeapMaintainer::resume()
+{
+    _paused = false;
+    SetEvent((HANDLE)_wake_event);
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - HeapMaintainer::set_rate(u32 interval_ms, u32 frees_per_tick)
+[IN ]:
+        - interval_ms (u32): time between two worker ticks
+        - frees_per_tick (u32): max number of deferred frees done in a tick
+-----------------------------------------------------*/
+void HeapMaintainer::set_rate(u32 interval_ms, u32 frees_per_tick)
+{
+    _interval_ms = interval_ms;
+    _frees_per_tick = frees_per_tick;
+    SetEvent((HANDLE)_wake_event);
+}
+
+MaintenanceStats HeapMaintainer::get_stats()
+{
+    lock();
+    MaintenanceStats stats = _stats;
+    unlock();
+    return stats;
+}
+
+///////////////////////////////////////////////////////
+//      HeapMaintainer methods:
+//      Private
+///////////////////////////////////////////////////////
+
+DWORD WINAPI MaintenanceWorker::proc(LPVOID data)
+{
+    HeapMaintainer *maintainer = (HeapMaintainer *)data;
+    while(maintainer->_running)
+    {
+        WaitForSingleObject((HANDLE)maintainer->_wake_event, maintainer->_interval_ms);
+        if(maintainer->_running && !maintainer->_paused)
+        {
+            maintainer->tick();
+        }
+    }
+    return 0;
+}
+
+void HeapMaintainer::tick()
+{
+    TraceScope trace("HeapMaintainer::tick");
+    // NOTE: take all the new deferred frees at once, the ones over the
+    // limit wait in _pending for the next tick
+    u8 *data = _deferred.exchange(0, std::memory_order_acquire);
+    while(data)
+    {
+        u8 *next = *(u8 **)data;
+        *(u8 **)data = _pending;
+        _pending = data;
+        data = next;
+    }
+
+    u8 *batch[MAINTENANCE_BATCH_SIZE];
+    u32 frees_per_tick = _frees_per_tick;
+    u32 frees = 0;
+    while(_pending && frees < frees_per_tick)
+    {
+        // NOTE: the lock is taken per batch so the owner threads can allocate
+        // in between, the pause flag is read under it so nothing runs after
+        // pause returned
+        lock();
+        if(_paused)
+        {
+            unlock();
+            break;
+        }
+        u32 count = 0;
+        while(_pending && count < MAINTENANCE_BATCH_SIZE && frees + count < frees_per_tick)
+        {
+            batch[count++] = _pending;
+            _pending = *(u8 **)_pending;
+        }
+        _heap->deallocate_batch(batch, count);
+        _stats._frees += count;
+        unlock();
+        frees += count;
+    }
+
+    lock();
+    Tracer::counter("HeapMaintainer::frees", 0, frees);
+    // NOTE: without frees there is no new free block to merge or purge
+    if(frees && !_paused)
+    {
+        _heap->flush_quicklists();
+        _stats._purged_bytes += _heap->purge_free_blocks(MAINTENANCE_PURGE_MIN_SIZE);
+    }
+    ++_stats._ticks;
+    unlock();
+}
+
+void HeapMaintainer::lock()
+{
+    AcquireSRWLockExclusive((PSRWLOCK)&_lock);
+}
+
+void HeapMaintainer::unlock()
+{
+    ReleaseSRWLockExclusive((PSRWLOCK)&_lock);
+}
+
+};
@@ -0,0 +1,104 @@
+#ifndef MAINTENANCE_H
+#define MAINTENANCE_H
+
+#include "heap.h"
+#include <atomic>
+
+namespace mem
+{
+
+#define MAINTENANCE_BATCH_SIZE 256
+#define MAINTENANCE_PURGE_MIN_SIZE KB(64)
+
+struct MaintenanceStats
+{
+    u64 _ticks;
+    u64 _frees;
+    u64 _purged_bytes;
+};
+
+/*@docs------------------------------------------------
+[DES]:  - runs the slow parts of the heap in a worker thread, the owner
+          threads only push frees in a lock-free stack and take a short
+          lock to allocate, the worker frees in batches, flushes the quick
+          lists and purges the pages of the big free blocks
+-----------------------------------------------------*/
+class HeapMaintainer
+{
+public:
+    /*@docs------------------------------------------------
+    [FNC]:  - HeapMaintainer(Heap *heap, u32 interval_ms, u32 frees_per_tick)
+    [DES]:  - starts the worker thread, from now on the heap must only be used
+              through the maintainer
+    [IN ]:
+            - heap (Heap *): heap to maintain
+            - interval_ms (u32): time between two worker ticks
+            - frees_per_tick (u32): max number of deferred frees done in a tick
+    [OUT]:
+            - maintainer (HeapMaintainer): new HeapMaintainer object
+    -----------------------------------------------------*/
+    HeapMaintainer(Heap *heap, u32 interval_ms, u32 frees_per_tick);
+    ~HeapMaintainer();
+
+    /*@docs------------------------------------------------
+    [FNC]:  - HeapMaintainer::allocate(u64 size)
+    [IN ]:
+            - size (u64): number of bytes to allocate
+    [OUT]:
+            - data (u8 *): pointer to the new allocated data
+    -----------------------------------------------------*/
+    u8 *allocate(u64 size);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - HeapMaintainer::deallocate(u8 *data)
+    [DES]:  - lock-free, the pointer is pushed to the deferred stack and freed
+              by the worker in its next tick
+    [IN ]:
+            - data (u8 *): already allocated pointer to be free
+    -----------------------------------------------------*/
+    void deallocate(u8 *data);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - HeapMaintainer::pause()
+    [DES]:  - the worker stops its current tick and waits until resume, when
+              pause returns the worker doesn't touch the heap anymore, the
+              deferred frees keep accumulating meanwhile
+    -----------------------------------------------------*/
+    void pause();
+    void resume();
+
+    /*@docs------------------------------------------------
+    [FNC]:  - HeapMaintainer::set_rate(u32 interval_ms, u32 frees_per_tick)
+    [IN ]:
+            - interval_ms (u32): time between two worker ticks
+            - frees_per_tick (u32): max number of deferred frees done in a tick
+    -----------------------------------------------------*/
+    void set_rate(u32 interval_ms, u32 frees_per_tick);
+
+    MaintenanceStats get_stats();
+
+private:
+    Heap *_heap;
+    void *_lock;
+    void *_thread;
+    void *_wake_event;
+
+    std::atomic<u8 *> _deferred;
+    std::atomic<bool> _running;
+    std::atomic<bool> _paused;
+    std::atomic<u32> _interval_ms;
+    std::atomic<u32> _frees_per_tick;
+
+    // NOTE: only touched by the worker
+    u8 *_pending;
+    MaintenanceStats _stats;
+
+    friend struct MaintenanceWorker;
+    void tick();
+    void lock();
+    void unlock();
+};
+
+};
+
+#endif // MAINTENANCE_H
@@ -1,7 +1,23 @@
 #include "heap.h"
+#include "small_heap.h"
+#include "fixed_arena.h"
+#include "arena_array.h"
+#include "arena_string.h"
+#include "soa_store.h"
+#include "coro_frame.h"
+#include "concurrent_pool.h"
+#include "epoch.h"
+#include "sub_heap.h"
+#include "io_buffer_pool.h"
+#include "arena_snapshot.h"
+#include "virtual_array.h"
 #include "profiler.h"
+#include "tracer.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <coroutine>
+#include <Windows.h>
 
 struct Entity
 {
@@ -9,12 +25,214 @@ struct Entity
     u64 data[256];
 };
 
+// NOTE: cold part of Entity in the structure of arrays store
+struct EntityPayload
+{
+    u64 data[256];
+};
+
 struct BigEntity
 {
     f32 x, y;
     u64 data[1024];
 };
 
+// NOTE: minimal awaitable task for the coroutine ping-pong, (FrameBase) is
+// empty to use the default frame allocation or mem::CoroFramePromise, the
+// awaited task runs to its end inside await_suspend so the stack doesn't
+// depend on symmetric transfer
+template <typename FrameBase>
+struct PingTask
+{
+    struct promise_type : FrameBase
+    {
+        u64 _value;
+
+        PingTask get_return_object() { return PingTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_value(u64 value) { _value = value; }
+        void unhandled_exception() {}
+    };
+
+    explicit PingTask(std::coroutine_handle<promise_type> handle) : _handle(handle) {}
+    PingTask(const PingTask &) = delete;
+    ~PingTask() { if(_handle) _handle.destroy(); }
+
+    bool await_ready() { return false; }
+    u64 await_resume() { return _handle.promise()._value; }
+    bool await_suspend(std::coroutine_handle<>)
+    {
+        _handle.resume();
+        return false;
+    }
+
+    u64 run()
+    {
+        _handle.resume();
+        return _handle.promise()._value;
+    }
+
+    std::coroutine_handle<promise_type> _handle;
+};
+
+struct DefaultFrame {};
+
+// NOTE: cache of the tagged allocation test, it gives back its oldest half
+// when its tag goes over budget
+#define CACHE_TAG 1
+#define CACHE_CAPACITY 4096
+struct TagCache
+{
+    mem::Heap *heap;
+    u8 *items[CACHE_CAPACITY];
+    u32 first;
+    u32 count;
+    u32 trims;
+};
+
+static void trim_tag_cache(u8 tag, u64, u64, void *user)
+{
+    TagCache *cache = (TagCache *)user;
+    if(tag != CACHE_TAG) return;
+    ++cache->trims;
+    for(u32 i = cache->count / 2; i > 0; --i)
+    {
+        cache->heap->deallocate(cache->items[cache->first]);
+        cache->first = (cache->first + 1) % CACHE_CAPACITY;
+        --cache->count;
+    }
+}
+
+template <typename FrameBase>
+PingTask<FrameBase> pong(u64 value)
+{
+    co_return value + 1;
+}
+
+template <typename FrameBase>
+PingTask<FrameBase> ping(u64 count)
+{
+    u64 value = 0;
+    for(u64 i = 0; i < count; ++i)
+    {
+        value = co_await pong<FrameBase>(value);
+    }
+    co_return value;
+}
+
+// NOTE: contention test, every producer sends its buffers to one consumer
+// through a single producer single consumer ring, the buffers come from the
+// concurrent pool or from a heap behind a lock
+#define POOL_PAIRS 4
+#define POOL_MESSAGES 200000
+#define POOL_RING_SIZE 1024
+#define POOL_BUFFER_SIZE 256
+struct MessageRing
+{
+    alignas(64) std::atomic<u64> head;
+    alignas(64) std::atomic<u64> tail;
+    u8 *items[POOL_RING_SIZE];
+};
+
+struct MessageTest
+{
+    mem::ConcurrentPool *pool;
+    mem::Heap *heap;
+    SRWLOCK heap_lock;
+    MessageRing rings[POOL_PAIRS];
+    std::atomic<u32> next_producer;
+    std::atomic<u32> next_consumer;
+};
+
+static u8 *message_allocate(MessageTest *test)
+{
+    if(test->pool) return test->pool->allocate();
+    AcquireSRWLockExclusive(&test->heap_lock);
+    u8 *data = test->heap->allocate(POOL_BUFFER_SIZE);
+    ReleaseSRWLockExclusive(&test->heap_lock);
+    return data;
+}
+
+static void message_deallocate(MessageTest *test, u8 *data)
+{
+    if(test->pool)
+    {
+        test->pool->deallocate(data);
+        return;
+    }
+    AcquireSRWLockExclusive(&test->heap_lock);
+    test->heap->deallocate(data);
+    ReleaseSRWLockExclusive(&test->heap_lock);
+}
+
+static DWORD WINAPI message_producer(LPVOID data)
+{
+    MessageTest *test = (MessageTest *)data;
+    MessageRing *ring = &test->rings[test->next_producer.fetch_add(1)];
+    for(u64 i = 0; i < POOL_MESSAGES; ++i)
+    {
+        u8 *buffer = message_allocate(test);
+        *(u64 *)buffer = i;
+        while(ring->head.load(std::memory_order_relaxed) - ring->tail.load(std::memory_order_acquire) == POOL_RING_SIZE)
+        {
+            SwitchToThread();
+        }
+        ring->items[i % POOL_RING_SIZE] = buffer;
+        ring->head.store(i + 1, std::memory_order_release);
+    }
+    if(test->pool) test->pool->flush_thread();
+    return 0;
+}
+
+static DWORD WINAPI message_consumer(LPVOID data)
+{
+    MessageTest *test = (MessageTest *)data;
+    MessageRing *ring = &test->rings[test->next_consumer.fetch_add(1)];
+    for(u64 i = 0; i < POOL_MESSAGES; ++i)
+    {
+        while(ring->head.load(std::memory_order_acquire) == i)
+        {
+            SwitchToThread();
+        }
+        u8 *buffer = ring->items[i % POOL_RING_SIZE];
+        ring->tail.store(i + 1, std::memory_order_release);
+        message_deallocate(test, buffer);
+    }
+    if(test->pool) test->pool->flush_thread();
+    return 0;
+}
+
+static void run_message_test(MessageTest *test)
+{
+    HANDLE threads[POOL_PAIRS * 2];
+    for(u32 i = 0; i < POOL_PAIRS; ++i)
+    {
+        test->rings[i].head = 0;
+        test->rings[i].tail = 0;
+    }
+    test->next_producer = 0;
+    test->next_consumer = 0;
+    for(u32 i = 0; i < POOL_PAIRS; ++i)
+    {
+        threads[i * 2] = CreateThread(0, 0, message_producer, test, 0, 0);
+        threads[i * 2 + 1] = CreateThread(0, 0, message_consumer, test, 0, 0);
+    }
+    for(u32 i = 0; i < POOL_PAIRS * 2; ++i)
+    {
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+    }
+}
+
+// NOTE: background serialization of a snapshot while the heap keeps changing
+static DWORD WINAPI snapshot_writer(LPVOID data)
+{
+    mem::ArenaSnapshot *snapshot = (mem::ArenaSnapshot *)data;
+    snapshot->write_to_file("snapshot_test.bin");
+    return 0;
+}
+
 int main()
 {
     mem::Memory memory(MB(256));
@@ -31,6 +249,10 @@ int main()
     static Entity *ae_ptr[TEST_COUNT];
 
     os::Profiler prof;
+    if(!prof.enable_counters())
+    {
+        printf("hardware counters not available, times only\n\n");
+    }
 
     prof.start(GLOBAL_ALLOC);
     for(u32 i = 0; i < TEST_COUNT; ++i)
@@ -54,15 +276,983 @@ int main()
     prof.stop(ARENA_ALLOC);
 
     printf("global allocator takes:\n");
-    prof.print(GLOBAL_ALLOC);
+    prof.print(GLOBAL_ALLOC, TEST_COUNT);
     printf("custom allocator takes:\n");
-    prof.print(CUSTOM_ALLOC);
+    prof.print(CUSTOM_ALLOC, TEST_COUNT);
     printf("arena allocator takes:\n");
-    prof.print(ARENA_ALLOC);
+    prof.print(ARENA_ALLOC, TEST_COUNT);
     
     //printf("\n");
     //heap.debug_print_state();
     printf("heap used %lld, arena used %lld\n", heap.get_used(), arena.get_used());
 
+    // NOTE: freelist walk, build mem_wide.exe (HEAP_COMPACT_LINKS=0) to compare
+    // the 32-bit offset links against the 64-bit layout
+#define FREELIST_WALK 3
+#define WALK_BLOCK_COUNT 20000
+#define WALK_MISS_COUNT 200
+    {
+        mem::Memory walk_memory(MB(64));
+        mem::Heap walk_heap(&walk_memory, MB(64));
+        static u8 *walk_ptr[WALK_BLOCK_COUNT * 2];
+        for(u32 i = 0; i < WALK_BLOCK_COUNT * 2; ++i)
+        {
+            walk_ptr[i] = walk_heap.allocate(16);
+        }
+        for(u32 i = 0; i < WALK_BLOCK_COUNT * 2; i += 2)
+        {
+            walk_heap.deallocate(walk_ptr[i]);
+        }
+
+        // every request misses the small blocks so the whole freelist is walked
+        prof.start(FREELIST_WALK);
+        for(u32 i = 0; i < WALK_MISS_COUNT; ++i)
+        {
+            walk_heap.allocate(128);
+        }
+        prof.stop(FREELIST_WALK);
+
+        printf("\nfreelist walk (%d free blocks, block header %lld bytes) takes:\n",
+               WALK_BLOCK_COUNT, (s64)sizeof(mem::Block));
+        prof.print(FREELIST_WALK, WALK_MISS_COUNT);
+    }
+
+    // NOTE: small objects, the small heap pages don't have per object headers
+#define SMALL_HEAP_ALLOC 4
+#define SMALL_HEAP_FREE_ALLOC 5
+#define SMALL_COUNT 100000
+#define SMALL_SIZE 16
+    {
+        mem::Memory small_memory(MB(64));
+        mem::Heap small_block_heap(&small_memory, MB(32));
+        mem::SmallHeap small_heap(&small_memory, MB(32));
+        static u8 *small_ptr[SMALL_COUNT];
+
+        u64 heap_start = small_block_heap.get_used();
+        prof.start(SMALL_HEAP_FREE_ALLOC);
+        for(u32 i = 0; i < SMALL_COUNT; ++i)
+        {
+            small_ptr[i] = small_block_heap.allocate(SMALL_SIZE);
+        }
+        prof.stop(SMALL_HEAP_FREE_ALLOC);
+        u64 heap_bytes = small_block_heap.get_used() - heap_start;
+
+        u64 small_start = small_heap.get_used();
+        prof.start(SMALL_HEAP_ALLOC);
+        for(u32 i = 0; i < SMALL_COUNT; ++i)
+        {
+            small_ptr[i] = small_heap.allocate(SMALL_SIZE);
+        }
+        prof.stop(SMALL_HEAP_ALLOC);
+        u64 small_bytes = small_heap.get_used() - small_start;
+
+        printf("\n%d objects of %d bytes, heap uses %lld bytes:\n", SMALL_COUNT, SMALL_SIZE, heap_bytes);
+        prof.print(SMALL_HEAP_FREE_ALLOC, SMALL_COUNT);
+        printf("small heap uses %lld bytes:\n", small_bytes);
+        prof.print(SMALL_HEAP_ALLOC, SMALL_COUNT);
+    }
+
+    // NOTE: bulk spawn and teardown of entities, one by one against the batch calls
+#define SPAWN_ONE_BY_ONE 6
+#define SPAWN_BATCH 7
+#define SPAWN_ROUNDS 20
+    {
+        mem::Memory spawn_memory(MB(32));
+        mem::Heap spawn_heap(&spawn_memory, MB(32));
+
+        prof.start(SPAWN_ONE_BY_ONE);
+        for(u32 round = 0; round < SPAWN_ROUNDS; ++round)
+        {
+            for(u32 i = 0; i < TEST_COUNT; ++i)
+            {
+                ce_ptr[i] = (Entity *)spawn_heap.allocate(sizeof(Entity));
+            }
+            for(u32 i = 0; i < TEST_COUNT; ++i)
+            {
+                spawn_heap.deallocate((u8 *)ce_ptr[i], sizeof(Entity));
+            }
+        }
+        prof.stop(SPAWN_ONE_BY_ONE);
+
+        prof.start(SPAWN_BATCH);
+        for(u32 round = 0; round < SPAWN_ROUNDS; ++round)
+        {
+            spawn_heap.allocate_batch(TEST_COUNT, sizeof(Entity), (u8 **)ce_ptr);
+            spawn_heap.deallocate_batch((u8 **)ce_ptr, TEST_COUNT);
+        }
+        prof.stop(SPAWN_BATCH);
+
+        printf("\nspawn and teardown one by one takes:\n");
+        prof.print(SPAWN_ONE_BY_ONE);
+        printf("spawn and teardown in batch takes:\n");
+        prof.print(SPAWN_BATCH);
+    }
+
+    // NOTE: free/alloc ping-pong of the same size, served by the quick lists
+#define PING_PONG 9
+#define PING_PONG_COUNT 100000
+    {
+        mem::Memory ping_memory(MB(1));
+        mem::Heap ping_heap(&ping_memory, MB(1));
+        u8 *ping = ping_heap.allocate(48);
+        u8 *pong = ping_heap.allocate(48);
+
+        prof.start(PING_PONG);
+        for(u32 i = 0; i < PING_PONG_COUNT; ++i)
+        {
+            ping_heap.deallocate(ping);
+            ping = ping_heap.allocate(48);
+        }
+        prof.stop(PING_PONG);
+
+        printf("\nfree/alloc ping-pong takes:\n");
+        prof.print(PING_PONG);
+        ping_heap.deallocate(pong);
+    }
+
+    // NOTE: vector growth, a few buffers grow and shrink interleaved
+#define VECTOR_GROWTH 8
+#define VECTOR_COUNT 8
+#define VECTOR_STEPS 2000
+    {
+        mem::Memory vector_memory(MB(64));
+        mem::Heap vector_heap(&vector_memory, MB(64));
+        u8 *vectors[VECTOR_COUNT];
+        u64 sizes[VECTOR_COUNT];
+        for(u32 i = 0; i < VECTOR_COUNT; ++i)
+        {
+            sizes[i] = 64;
+            vectors[i] = vector_heap.allocate(sizes[i]);
+        }
+
+        prof.start(VECTOR_GROWTH);
+        for(u32 step = 0; step < VECTOR_STEPS; ++step)
+        {
+            u32 i = (step * 7) % VECTOR_COUNT;
+            sizes[i] = (step % 5 == 4) ? sizes[i] / 2 + 64 : sizes[i] + sizes[i] / 2;
+            if(sizes[i] > KB(256)) sizes[i] = 64;
+            vectors[i] = vector_heap.reallocate(vectors[i], sizes[i]);
+        }
+        prof.stop(VECTOR_GROWTH);
+
+        mem::HeapReallocStats stats = vector_heap.get_realloc_stats();
+        printf("\nvector growth takes:\n");
+        prof.print(VECTOR_GROWTH);
+        printf("    same size %lld, top %lld, shrink %lld, grow right %lld, merge left %lld, slow %lld\n",
+               stats._same_size, stats._top, stats._shrink, stats._grow_right, stats._merge_left, stats._slow);
+    }
+
+    // NOTE: size classes, the sizes of a mixed workload are recorded and the
+    // generated classes are compared with power of two classes, the histogram
+    // is saved for size_class_gen.exe
+#define CLASS_BUDGET 8
+#define CLASS_SAMPLE_COUNT 20000
+    {
+        mem::Memory class_memory(MB(128));
+        mem::Heap class_heap(&class_memory, MB(128));
+        mem::SizeHistogram histogram;
+        class_heap.set_size_histogram(&histogram);
+        static u8 *class_ptr[CLASS_SAMPLE_COUNT];
+        for(u32 i = 0; i < CLASS_SAMPLE_COUNT; ++i)
+        {
+            u64 size = 0;
+            switch(i % 5)
+            {
+                case 0: size = sizeof(Entity); break;
+                case 1: size = 24 + (i % 3) * 8; break;
+                case 2: size = 72; break;
+                case 3: size = 100 + (i % 200); break;
+                case 4: size = 520; break;
+            }
+            class_ptr[i] = class_heap.allocate(size);
+        }
+        class_heap.set_size_histogram(0);
+        for(u32 i = 0; i < CLASS_SAMPLE_COUNT; ++i)
+        {
+            class_heap.deallocate(class_ptr[i]);
+        }
+
+        u32 pow2_classes[CLASS_BUDGET] = { 32, 64, 128, 256, 512, 1024, 2048, 4096 };
+        u32 classes[CLASS_BUDGET];
+        u32 count = histogram.compute_classes(CLASS_BUDGET, SIZE_HISTOGRAM_MAX_SIZE, classes);
+        printf("\nsize classes for %lld requested bytes:\n", histogram.get_requested_bytes());
+        printf("    power of two waste %lld, generated waste %lld:",
+               histogram.get_waste(pow2_classes, CLASS_BUDGET), histogram.get_waste(classes, count));
+        for(u32 i = 0; i < count; ++i)
+        {
+            printf(" %d", classes[i]);
+        }
+        printf("\n");
+        histogram.save("size_histogram.bin");
+    }
+
+    // NOTE: scratch memory of a hot function, taken from a shared heap or
+    // from a FixedArena on the stack that falls back to the heap
+#define SCRATCH_HEAP 10
+#define SCRATCH_FIXED 11
+#define SCRATCH_CALLS 100000
+#define SCRATCH_PUSHES 16
+    {
+        mem::Memory scratch_memory(MB(16));
+        mem::Heap scratch_heap(&scratch_memory, MB(16));
+        u64 checksum = 0;
+
+        prof.start(SCRATCH_HEAP);
+        for(u32 call = 0; call < SCRATCH_CALLS; ++call)
+        {
+            u8 *scratch[SCRATCH_PUSHES];
+            for(u32 i = 0; i < SCRATCH_PUSHES; ++i)
+            {
+                scratch[i] = scratch_heap.allocate(64 + i * 8);
+                scratch[i][0] = (u8)i;
+            }
+            for(u32 i = 0; i < SCRATCH_PUSHES; ++i)
+            {
+                checksum += scratch[i][0];
+                scratch_heap.deallocate(scratch[i]);
+            }
+        }
+        prof.stop(SCRATCH_HEAP);
+
+        prof.start(SCRATCH_FIXED);
+        for(u32 call = 0; call < SCRATCH_CALLS; ++call)
+        {
+            mem::FixedArena<KB(2)> scratch_arena(&scratch_heap);
+            u8 *scratch[SCRATCH_PUSHES];
+            for(u32 i = 0; i < SCRATCH_PUSHES; ++i)
+            {
+                scratch[i] = scratch_arena.push_size(64 + i * 8);
+                scratch[i][0] = (u8)i;
+            }
+            for(u32 i = 0; i < SCRATCH_PUSHES; ++i)
+            {
+                checksum += scratch[i][0];
+            }
+        }
+        prof.stop(SCRATCH_FIXED);
+
+        printf("\nscratch from heap takes:\n");
+        prof.print(SCRATCH_HEAP);
+        printf("scratch from fixed arena takes (checksum %lld):\n", checksum);
+        prof.print(SCRATCH_FIXED);
+    }
+
+    // NOTE: coroutine ping-pong, every co_await makes a new pong frame
+#define CORO_DEFAULT 12
+#define CORO_RECYCLED 13
+#define CORO_TREE 14
+#define CORO_PING_COUNT 200000
+    {
+        mem::Memory coro_memory(MB(16));
+        mem::CoroFrameAllocator coro_allocator(&coro_memory, MB(16));
+        mem::CoroFrameAllocator::set_current(&coro_allocator);
+
+        prof.start(CORO_DEFAULT);
+        u64 default_value = ping<DefaultFrame>(CORO_PING_COUNT).run();
+        prof.stop(CORO_DEFAULT);
+
+        prof.start(CORO_RECYCLED);
+        u64 recycled_value = ping<mem::CoroFramePromise>(CORO_PING_COUNT).run();
+        prof.stop(CORO_RECYCLED);
+
+        // NOTE: the frames of the tree are only freed by release
+        prof.start(CORO_TREE);
+        mem::CoroTaskTree tree(&coro_allocator);
+        u64 tree_value = 0;
+        for(u32 i = 0; i < 100; ++i)
+        {
+            {
+                mem::CoroTaskScope scope(&tree);
+                tree_value += ping<mem::CoroFramePromise>(CORO_PING_COUNT / 100).run();
+            }
+            tree.release();
+        }
+        prof.stop(CORO_TREE);
+
+        printf("\ncoroutine ping-pong with default frames takes (%lld):\n", default_value);
+        prof.print(CORO_DEFAULT);
+        printf("coroutine ping-pong with recycled frames takes (%lld):\n", recycled_value);
+        prof.print(CORO_RECYCLED);
+        printf("coroutine ping-pong with task tree frames takes (%lld):\n", tree_value);
+        prof.print(CORO_TREE);
+        mem::CoroFrameAllocator::set_current(0);
+    }
+
+    // NOTE: sampling profiler overhead, the same mixed workload runs without
+    // and with a profiler, the live sites are dumped as collapsed stacks
+#define PROFILE_OFF 15
+#define PROFILE_ON 16
+#define PROFILE_SLOTS 4096
+#define PROFILE_STEPS 400000
+    {
+        mem::Memory profile_memory(MB(64) + HEAP_PROFILER_ARENA_SIZE);
+        mem::Heap profile_heap(&profile_memory, MB(64));
+        mem::HeapProfiler profiler(&profile_memory, HEAP_PROFILER_DEFAULT_INTERVAL);
+        static u8 *profile_ptr[PROFILE_SLOTS];
+
+        for(u32 pass = 0; pass < 2; ++pass)
+        {
+            u32 slot = pass ? PROFILE_ON : PROFILE_OFF;
+            profile_heap.set_profiler(pass ? &profiler : 0);
+            prof.start(slot);
+            for(u32 step = 0; step < PROFILE_STEPS; ++step)
+            {
+                u32 i = (step * 2654435761u) % PROFILE_SLOTS;
+                if(profile_ptr[i])
+                {
+                    profile_heap.deallocate(profile_ptr[i]);
+                    profile_ptr[i] = 0;
+                }
+                else
+                {
+                    profile_ptr[i] = profile_heap.allocate(i % 7 == 0 ? sizeof(Entity) : 16 + i % 300);
+                }
+            }
+            prof.stop(slot);
+            for(u32 i = 0; i < PROFILE_SLOTS; ++i)
+            {
+                if(profile_ptr[i]) profile_heap.deallocate(profile_ptr[i]);
+                profile_ptr[i] = 0;
+            }
+        }
+        profile_heap.set_profiler(0);
+
+        mem::HeapProfileStats stats = profiler.get_stats();
+        printf("\nheap workload without profiler takes:\n");
+        prof.print(PROFILE_OFF, PROFILE_STEPS);
+        printf("heap workload with profiler takes (%lld samples, %lld bytes estimated):\n",
+               stats._samples, stats._total_bytes);
+        prof.print(PROFILE_ON, PROFILE_STEPS);
+        profiler.write_collapsed("heap_profile.collapsed", false);
+    }
+
+    // NOTE: tagged allocation, a runaway cache shares the heap with another
+    // subsystem and is kept under its hard budget by trimming itself
+#define TAG_TAGGED 17
+#define OTHER_TAG 2
+#define TAG_STEPS 200000
+    {
+        mem::Memory tag_memory(MB(64));
+        mem::Heap tag_heap(&tag_memory, MB(64));
+        mem::HeapTags tags;
+        tag_heap.set_tags(&tags);
+
+        static TagCache cache;
+        cache.heap = &tag_heap;
+        tags.set_budget(CACHE_TAG, MB(2), true);
+        tags.set_callback(trim_tag_cache, &cache);
+
+        prof.start(TAG_TAGGED);
+        for(u32 step = 0; step < TAG_STEPS; ++step)
+        {
+            if(cache.count == CACHE_CAPACITY)
+            {
+                tag_heap.deallocate(cache.items[cache.first]);
+                cache.first = (cache.first + 1) % CACHE_CAPACITY;
+                --cache.count;
+            }
+            u8 *item = tag_heap.allocate(1024 + step % 512, CACHE_TAG);
+            cache.items[(cache.first + cache.count++) % CACHE_CAPACITY] = item;
+
+            mem::HeapTagScope scope(OTHER_TAG);
+            tag_heap.deallocate(tag_heap.allocate(64 + step % 128));
+        }
+        prof.stop(TAG_TAGGED);
+
+        mem::HeapTagStats cache_stats = tags.get_stats(CACHE_TAG);
+        mem::HeapTagStats other_stats = tags.get_stats(OTHER_TAG);
+        printf("\ntagged runaway cache takes (live %lld, peak %lld, trims %d):\n",
+               cache_stats._live_bytes, cache_stats._peak_bytes, cache.trims);
+        prof.print(TAG_TAGGED);
+        printf("    other subsystem live %lld, peak %lld\n", other_stats._live_bytes, other_stats._peak_bytes);
+    }
+
+    // NOTE: tracer overhead, the workload of the profiler test runs with a
+    // current tracer, the timeline of the heap is written for chrome://tracing
+#define TRACE_ON 18
+#define TRACE_THREADS 4
+    {
+        mem::Memory trace_memory(MB(80));
+        mem::Heap trace_heap(&trace_memory, MB(64));
+        mem::Tracer tracer(&trace_memory, TRACE_THREADS, TRACE_DEFAULT_EVENTS);
+        static u8 *trace_ptr[PROFILE_SLOTS];
+
+        mem::Tracer::set_current(&tracer);
+        prof.start(TRACE_ON);
+        for(u32 step = 0; step < PROFILE_STEPS; ++step)
+        {
+            u32 i = (step * 2654435761u) % PROFILE_SLOTS;
+            if(trace_ptr[i])
+            {
+                trace_heap.deallocate(trace_ptr[i]);
+                trace_ptr[i] = 0;
+            }
+            else
+            {
+                trace_ptr[i] = trace_heap.allocate(i % 7 == 0 ? sizeof(Entity) : 16 + i % 300);
+            }
+        }
+        prof.stop(TRACE_ON);
+        mem::Tracer::set_current(0);
+
+        mem::TraceStats stats = tracer.get_stats();
+        printf("\nheap workload with tracer takes (%lld events, %lld overwritten):\n",
+               stats._events, stats._overwritten);
+        prof.print(TRACE_ON, PROFILE_STEPS);
+        tracer.write_chrome_json("heap_trace.json");
+    }
+
+    // NOTE: arena containers, the array grows in place at the top of the
+    // arena instead of copying and abandoning, everything is popped at once
+#define CONTAINER_ARRAY 19
+#define CONTAINER_MAP 20
+#define CONTAINER_COUNT 200000
+    {
+        mem::Memory container_memory(MB(64));
+        mem::Arena container_arena(&container_memory, MB(64));
+        u64 marker = container_arena.get_marker();
+
+        // copy and abandon, the old arrays stay in the arena
+        u64 *copy_data = 0;
+        u64 copy_capacity = 0;
+        for(u64 i = 0; i < CONTAINER_COUNT; ++i)
+        {
+            if(i == copy_capacity)
+            {
+                u64 *data = (u64 *)container_arena.push_size((copy_capacity ? copy_capacity * 2 : 8) * sizeof(u64));
+                if(copy_capacity) memcpy(data, copy_data, copy_capacity * sizeof(u64));
+                copy_data = data;
+                copy_capacity = copy_capacity ? copy_capacity * 2 : 8;
+            }
+            copy_data[i] = i;
+        }
+        u64 copy_bytes = container_arena.get_marker() - marker;
+        container_arena.pop_to_marker(marker);
+
+        prof.start(CONTAINER_ARRAY);
+        mem::ArenaArray<u64> array(&container_arena);
+        for(u64 i = 0; i < CONTAINER_COUNT; ++i)
+        {
+            array.push(i);
+        }
+        prof.stop(CONTAINER_ARRAY);
+        u64 array_bytes = container_arena.get_marker() - marker;
+        container_arena.pop_to_marker(marker);
+
+        prof.start(CONTAINER_MAP);
+        mem::ArenaMap<u64, u64> map(&container_arena);
+        u64 found = 0;
+        for(u64 i = 0; i < CONTAINER_COUNT; ++i)
+        {
+            map.insert(i * 2654435761u, i);
+        }
+        for(u64 i = 0; i < CONTAINER_COUNT; ++i)
+        {
+            found += map.find(i * 2654435761u) != 0;
+        }
+        prof.stop(CONTAINER_MAP);
+
+        mem::ArenaInterner interner(&container_arena);
+        mem::ArenaStringBuilder builder(&container_arena);
+        builder.appendf("%lld keys", found);
+        mem::ArenaString name = interner.intern(builder.finish()._data);
+        container_arena.pop_to_marker(marker);
+
+        printf("\narena array of %d u64 takes (%lld bytes, copy and abandon %lld bytes):\n",
+               CONTAINER_COUNT, array_bytes, copy_bytes);
+        prof.print(CONTAINER_ARRAY, CONTAINER_COUNT);
+        printf("arena map insert and find of %s takes:\n", name._data);
+        prof.print(CONTAINER_MAP, CONTAINER_COUNT * 2);
+    }
+
+    // NOTE: position update, pointer per Entity against the structure of
+    // arrays store where x and y are dense and the payload is apart
+#define ENTITY_POINTERS 21
+#define ENTITY_SOA 22
+#define ENTITY_COUNT 20000
+#define ENTITY_PASSES 50
+    {
+        mem::Memory entity_memory(MB(96));
+        mem::Heap entity_heap(&entity_memory, MB(48));
+        mem::Arena entity_arena(&entity_memory, MB(48));
+        mem::SoaStore<f32, f32, EntityPayload> store(&entity_arena, ENTITY_COUNT);
+        static Entity *entity_ptr[ENTITY_COUNT];
+        static u32 entity_handle[ENTITY_COUNT];
+        for(u32 i = 0; i < ENTITY_COUNT; ++i)
+        {
+            entity_ptr[i] = (Entity *)entity_heap.allocate(sizeof(Entity));
+            entity_ptr[i]->x = (f32)i;
+            entity_ptr[i]->y = 0.0f;
+            entity_handle[i] = store.create();
+            *store.get<0>(entity_handle[i]) = (f32)i;
+            *store.get<1>(entity_handle[i]) = 0.0f;
+        }
+
+        prof.start(ENTITY_POINTERS);
+        for(u32 pass = 0; pass < ENTITY_PASSES; ++pass)
+        {
+            for(u32 i = 0; i < ENTITY_COUNT; ++i)
+            {
+                entity_ptr[i]->x += 1.0f;
+                entity_ptr[i]->y += 0.5f;
+            }
+        }
+        prof.stop(ENTITY_POINTERS);
+
+        prof.start(ENTITY_SOA);
+        for(u32 pass = 0; pass < ENTITY_PASSES; ++pass)
+        {
+            f32 *x = store.get_array<0>();
+            f32 *y = store.get_array<1>();
+            u32 count = store.get_count();
+            for(u32 i = 0; i < count; ++i)
+            {
+                x[i] += 1.0f;
+                y[i] += 0.5f;
+            }
+        }
+        prof.stop(ENTITY_SOA);
+
+        // every other entity is destroyed, the arrays stay dense
+        for(u32 i = 0; i < ENTITY_COUNT; i += 2)
+        {
+            store.destroy(entity_handle[i]);
+        }
+        bool stale = store.is_alive(entity_handle[0]);
+
+        printf("\nposition update of %d entities, pointer per entity takes:\n", ENTITY_COUNT);
+        prof.print(ENTITY_POINTERS, ENTITY_COUNT * ENTITY_PASSES);
+        printf("structure of arrays takes (%d alive after removes, stale handle alive %d):\n",
+               store.get_count(), stale);
+        prof.print(ENTITY_SOA, ENTITY_COUNT * ENTITY_PASSES);
+    }
+
+    // NOTE: many producers and consumers, buffers allocated by one thread
+    // and freed by another
+#define POOL_LOCKED_HEAP 23
+#define POOL_CONCURRENT 24
+    {
+        mem::Memory message_memory(MB(64));
+        mem::Heap message_heap(&message_memory, MB(32));
+        mem::ConcurrentPool message_pool(&message_memory, MB(32), POOL_BUFFER_SIZE);
+        static MessageTest test;
+        InitializeSRWLock(&test.heap_lock);
+
+        test.pool = 0;
+        test.heap = &message_heap;
+        prof.start(POOL_LOCKED_HEAP);
+        run_message_test(&test);
+        prof.stop(POOL_LOCKED_HEAP);
+
+        test.pool = &message_pool;
+        prof.start(POOL_CONCURRENT);
+        run_message_test(&test);
+        prof.stop(POOL_CONCURRENT);
+
+        mem::PoolStats stats = message_pool.get_stats();
+        printf("\n%d producers and %d consumers, heap behind a lock takes:\n", POOL_PAIRS, POOL_PAIRS);
+        prof.print(POOL_LOCKED_HEAP, POOL_PAIRS * POOL_MESSAGES);
+        printf("concurrent pool takes (%lld carved, %lld chains exchanged):\n",
+               stats._carved, stats._chain_pops);
+        prof.print(POOL_CONCURRENT, POOL_PAIRS * POOL_MESSAGES);
+    }
+
+    // NOTE: epoch reclamation, cost of a read side critical section and of
+    // a retire until the batched free into the heap
+#define EPOCH_CRITICAL 25
+#define EPOCH_RETIRE 26
+#define EPOCH_OPERATIONS 1000000
+    {
+        mem::Memory epoch_memory(MB(64));
+        mem::Heap epoch_heap(&epoch_memory, MB(32));
+        mem::EpochDomain domain(&epoch_memory);
+        static u64 shared_value;
+        u64 read_sum = 0;
+
+        prof.start(EPOCH_CRITICAL);
+        for(u32 i = 0; i < EPOCH_OPERATIONS; ++i)
+        {
+            mem::EpochGuard guard(&domain);
+            read_sum += shared_value;
+        }
+        prof.stop(EPOCH_CRITICAL);
+
+        prof.start(EPOCH_RETIRE);
+        for(u32 i = 0; i < EPOCH_OPERATIONS; ++i)
+        {
+            domain.retire(&epoch_heap, epoch_heap.allocate(64));
+        }
+        domain.synchronize();
+        prof.stop(EPOCH_RETIRE);
+
+        mem::EpochStats stats = domain.get_stats();
+        printf("\nepoch critical section takes:\n");
+        prof.print(EPOCH_CRITICAL, EPOCH_OPERATIONS);
+        printf("heap allocate and retire takes (%lld epochs, %lld freed):\n", stats._epoch, stats._freed);
+        prof.print(EPOCH_RETIRE, EPOCH_OPERATIONS);
+    }
+
+    // NOTE: per session state, every session allocates its objects and is
+    // torn down with one free per object or by resetting its sub heap
+#define SESSION_FREE_EACH 27
+#define SESSION_SUB_HEAP 28
+#define SESSION_COUNT 100
+#define SESSION_OBJECTS 4096
+    {
+        mem::Memory session_memory(MB(64));
+        mem::Heap session_heap(&session_memory, MB(32));
+        u8 **objects = (u8 **)malloc(SESSION_OBJECTS * sizeof(u8 *));
+
+        prof.start(SESSION_FREE_EACH);
+        for(u32 session = 0; session < SESSION_COUNT; ++session)
+        {
+            for(u32 i = 0; i < SESSION_OBJECTS; ++i)
+            {
+                objects[i] = session_heap.allocate(16 + (i % 16) * 8);
+            }
+            for(u32 i = 0; i < SESSION_OBJECTS; ++i)
+            {
+                session_heap.deallocate(objects[i]);
+            }
+        }
+        prof.stop(SESSION_FREE_EACH);
+
+        mem::SubHeapStats stats = {};
+        prof.start(SESSION_SUB_HEAP);
+        for(u32 session = 0; session < SESSION_COUNT; ++session)
+        {
+            mem::SubHeap sub_heap(&session_heap, KB(256));
+            for(u32 i = 0; i < SESSION_OBJECTS; ++i)
+            {
+                objects[i] = sub_heap.allocate(16 + (i % 16) * 8);
+            }
+            stats = sub_heap.get_stats();
+        }
+        prof.stop(SESSION_SUB_HEAP);
+
+        free(objects);
+        printf("\nsession torn down with one free per object takes:\n");
+        prof.print(SESSION_FREE_EACH, SESSION_COUNT);
+        printf("session torn down with a sub heap reset takes (%lld chunks):\n", stats._chunks);
+        prof.print(SESSION_SUB_HEAP, SESSION_COUNT);
+    }
+
+    // NOTE: one arena per request, the span of a destroyed arena is taken
+    // again by the next one, committed or decommitted after every request
+#define REQUEST_RETAINED 29
+#define REQUEST_DECOMMITTED 30
+#define REQUEST_COUNT 10000
+#define REQUEST_ARENA_SIZE MB(1)
+    {
+        mem::Memory request_memory(MB(64));
+        u64 checksum = 0;
+
+        prof.start(REQUEST_RETAINED);
+        for(u32 request = 0; request < REQUEST_COUNT; ++request)
+        {
+            mem::Arena request_arena(&request_memory, REQUEST_ARENA_SIZE);
+            u8 *data = request_arena.push_size(KB(16));
+            data[request % KB(16)] = (u8)request;
+            checksum += data[request % KB(16)];
+        }
+        prof.stop(REQUEST_RETAINED);
+        mem::MemoryStats retained_stats = request_memory.get_stats();
+
+        request_memory.set_retain_size(0);
+        prof.start(REQUEST_DECOMMITTED);
+        for(u32 request = 0; request < REQUEST_COUNT; ++request)
+        {
+            mem::Arena request_arena(&request_memory, REQUEST_ARENA_SIZE);
+            u8 *data = request_arena.push_size(KB(16));
+            data[request % KB(16)] = (u8)request;
+            checksum += data[request % KB(16)];
+        }
+        prof.stop(REQUEST_DECOMMITTED);
+        mem::MemoryStats decommitted_stats = request_memory.get_stats();
+
+        printf("\nper request arena with retained spans takes (%lld reused, %lld bytes decommitted):\n",
+               retained_stats._reused, retained_stats._decommitted);
+        prof.print(REQUEST_RETAINED, REQUEST_COUNT);
+        printf("per request arena decommitted after every request takes (%lld reused, %lld bytes decommitted):\n",
+               decommitted_stats._reused - retained_stats._reused, decommitted_stats._decommitted);
+        prof.print(REQUEST_DECOMMITTED, REQUEST_COUNT);
+    }
+
+    // NOTE: ingest of a file in fixed size records, copied from a malloc'd
+    // read buffer into heap blocks or kept as slices of the pool buffers,
+    // both read through the file cache so only the copies differ
+#define INGEST_COPY 31
+#define INGEST_SLICES 32
+#define INGEST_FILE_SIZE MB(64)
+#define INGEST_BUFFER_SIZE KB(64)
+#define INGEST_RECORD_SIZE 512
+#define INGEST_RECORDS (INGEST_BUFFER_SIZE / INGEST_RECORD_SIZE)
+    {
+        const char *ingest_path = "ingest_test.bin";
+        HANDLE ingest_file = CreateFileA(ingest_path, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+        u8 *chunk = (u8 *)malloc(INGEST_BUFFER_SIZE);
+        for(u32 i = 0; i < INGEST_BUFFER_SIZE; ++i)
+        {
+            chunk[i] = (u8)i;
+        }
+        for(u64 written = 0; written < INGEST_FILE_SIZE; written += INGEST_BUFFER_SIZE)
+        {
+            DWORD bytes = 0;
+            WriteFile(ingest_file, chunk, INGEST_BUFFER_SIZE, &bytes, 0);
+        }
+        CloseHandle(ingest_file);
+        free(chunk);
+
+        mem::Memory ingest_memory(MB(64));
+        mem::Heap ingest_heap(&ingest_memory, MB(16));
+        mem::IoBufferPool io_pool(&ingest_memory, INGEST_BUFFER_SIZE, 16);
+        u8 *records[INGEST_RECORDS];
+        mem::IoSlice slices[INGEST_RECORDS];
+        u64 copy_sum = 0;
+        u64 slice_sum = 0;
+
+        prof.start(INGEST_COPY);
+        ingest_file = CreateFileA(ingest_path, GENERIC_READ, 0, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+        for(DWORD bytes = INGEST_BUFFER_SIZE; bytes == INGEST_BUFFER_SIZE;)
+        {
+            u8 *buffer = (u8 *)malloc(INGEST_BUFFER_SIZE);
+            ReadFile(ingest_file, buffer, INGEST_BUFFER_SIZE, &bytes, 0);
+            u32 count = bytes / INGEST_RECORD_SIZE;
+            for(u32 i = 0; i < count; ++i)
+            {
+                records[i] = ingest_heap.allocate(INGEST_RECORD_SIZE);
+                memcpy(records[i], buffer + i * INGEST_RECORD_SIZE, INGEST_RECORD_SIZE);
+            }
+            free(buffer);
+            for(u32 i = 0; i < count; ++i)
+            {
+                copy_sum += records[i][i];
+                ingest_heap.deallocate(records[i]);
+            }
+        }
+        CloseHandle(ingest_file);
+        prof.stop(INGEST_COPY);
+
+        prof.start(INGEST_SLICES);
+        ingest_file = CreateFileA(ingest_path, GENERIC_READ, 0, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+        for(DWORD bytes = INGEST_BUFFER_SIZE; bytes == INGEST_BUFFER_SIZE;)
+        {
+            u32 buffer = io_pool.acquire();
+            ReadFile(ingest_file, io_pool.get_data(buffer), INGEST_BUFFER_SIZE, &bytes, 0);
+            u32 count = bytes / INGEST_RECORD_SIZE;
+            for(u32 i = 0; i < count; ++i)
+            {
+                slices[i] = io_pool.slice(buffer, i * INGEST_RECORD_SIZE, INGEST_RECORD_SIZE);
+            }
+            io_pool.release(buffer);
+            for(u32 i = 0; i < count; ++i)
+            {
+                slice_sum += slices[i]._data[i];
+                io_pool.release(&slices[i]);
+            }
+        }
+        CloseHandle(ingest_file);
+        prof.stop(INGEST_SLICES);
+        DeleteFileA(ingest_path);
+
+        u64 record_count = INGEST_FILE_SIZE / INGEST_RECORD_SIZE;
+        printf("\ningest with malloc and copy to heap takes (sum %lld):\n", copy_sum);
+        prof.print(INGEST_COPY, record_count);
+        printf("ingest with pool buffer slices takes (sum %lld, %lld buffers recycled):\n", slice_sum, io_pool.get_stats()._recycled);
+        prof.print(INGEST_SLICES, record_count);
+    }
+
+    // NOTE: 128MB heap with normal, prefaulted and large pages, the setup,
+    // the first use of the pages and a random walk over the objects are
+    // timed apart, the walk is where the dTLB misses show
+#define PAGES_SETUP 33
+#define PAGES_FIRST_USE 36
+#define PAGES_WALK 39
+#define PAGES_MODE_COUNT 3
+#define PAGES_HEAP_SIZE MB(128)
+#define PAGES_OBJECT_COUNT (1 << 20)
+#define PAGES_OBJECT_SIZE 64
+#define PAGES_STEPS (1 << 22)
+    {
+        const char *page_modes[PAGES_MODE_COUNT] = {"normal pages", "prefaulted pages", "large pages"};
+        u32 page_flags[PAGES_MODE_COUNT] = {0, MEMORY_PREFAULT, MEMORY_LARGE_PAGES};
+        u8 **objects = (u8 **)malloc(PAGES_OBJECT_COUNT * sizeof(u8 *));
+        for(u32 mode = 0; mode < PAGES_MODE_COUNT; ++mode)
+        {
+            prof.start(PAGES_SETUP + mode);
+            mem::Memory page_memory(PAGES_HEAP_SIZE + MB(2), page_flags[mode]);
+            mem::Heap page_heap(&page_memory, PAGES_HEAP_SIZE);
+            prof.stop(PAGES_SETUP + mode);
+
+            prof.start(PAGES_FIRST_USE + mode);
+            for(u32 i = 0; i < PAGES_OBJECT_COUNT; ++i)
+            {
+                objects[i] = page_heap.allocate(PAGES_OBJECT_SIZE);
+            }
+            prof.stop(PAGES_FIRST_USE + mode);
+
+            // NOTE: same shuffle in every mode, the objects are linked in a
+            // random cycle so every step of the walk depends on the last one
+            u64 seed = 1;
+            for(u32 i = PAGES_OBJECT_COUNT - 1; i > 0; --i)
+            {
+                seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+                u32 j = (u32)((seed >> 33) % (i + 1));
+                u8 *swap = objects[i];
+                objects[i] = objects[j];
+                objects[j] = swap;
+            }
+            for(u32 i = 0; i < PAGES_OBJECT_COUNT; ++i)
+            {
+                *(u8 **)objects[i] = objects[(i + 1) % PAGES_OBJECT_COUNT];
+            }
+
+            prof.start(PAGES_WALK + mode);
+            u8 *cursor = objects[0];
+            for(u32 step = 0; step < PAGES_STEPS; ++step)
+            {
+                cursor = *(u8 **)cursor;
+            }
+            prof.stop(PAGES_WALK + mode);
+
+            bool granted = page_memory._flags == page_flags[mode];
+            printf("\n%s (%s) setup takes:\n", page_modes[mode], granted ? "granted" : "fallback to normal pages");
+            prof.print(PAGES_SETUP + mode);
+            printf("first use of the pages takes:\n");
+            prof.print(PAGES_FIRST_USE + mode, PAGES_OBJECT_COUNT);
+            printf("random walk takes (end %p):\n", cursor);
+            prof.print(PAGES_WALK + mode, PAGES_STEPS);
+        }
+        free(objects);
+    }
+
+    // NOTE: checkpoint of a heap by copying its used part or with a
+    // copy on write snapshot, the same few objects are changed afterwards
+    // while a thread writes the snapshot to a file
+#define SNAPSHOT_COPY 42
+#define SNAPSHOT_TAKE 43
+#define SNAPSHOT_WRITES 44
+#define SNAPSHOT_OBJECT_COUNT (1 << 19)
+#define SNAPSHOT_OBJECT_SIZE 96
+#define SNAPSHOT_WRITE_COUNT 256
+#define SNAPSHOT_HEAP_SIZE MB(96)
+    {
+        mem::Memory snapshot_memory(2 * SNAPSHOT_HEAP_SIZE);
+        mem::Heap snapshot_heap(&snapshot_memory, SNAPSHOT_HEAP_SIZE);
+        u8 **objects = (u8 **)malloc(SNAPSHOT_OBJECT_COUNT * sizeof(u8 *));
+        for(u32 i = 0; i < SNAPSHOT_OBJECT_COUNT; ++i)
+        {
+            objects[i] = snapshot_heap.allocate(SNAPSHOT_OBJECT_SIZE);
+            memset(objects[i], (u8)i, SNAPSHOT_OBJECT_SIZE);
+        }
+
+        prof.start(SNAPSHOT_COPY);
+        u8 *checkpoint = (u8 *)malloc(snapshot_heap.get_used());
+        memcpy(checkpoint, snapshot_heap.get_base(), snapshot_heap.get_used());
+        prof.stop(SNAPSHOT_COPY);
+
+        prof.start(SNAPSHOT_TAKE);
+        mem::ArenaSnapshot *snapshot = new mem::ArenaSnapshot(&snapshot_memory, &snapshot_heap);
+        prof.stop(SNAPSHOT_TAKE);
+        HANDLE writer = CreateThread(0, 0, snapshot_writer, snapshot, 0, 0);
+
+        prof.start(SNAPSHOT_WRITES);
+        for(u32 i = 0; i < SNAPSHOT_WRITE_COUNT; ++i)
+        {
+            objects[(i * 7919) % SNAPSHOT_OBJECT_COUNT][0] = 0xFF;
+        }
+        prof.stop(SNAPSHOT_WRITES);
+
+        WaitForSingleObject(writer, INFINITE);
+        CloseHandle(writer);
+        u8 *first_page = (u8 *)malloc(MEMORY_PAGE_SIZE);
+        snapshot->read(0, first_page, MEMORY_PAGE_SIZE);
+        // NOTE: the headers of the snapshot were saved like a clean close
+        u64 headers = sizeof(mem::ArenaHeader) + sizeof(mem::HeapHeader);
+        bool same = memcmp(first_page + headers, checkpoint + headers, MEMORY_PAGE_SIZE - headers) == 0;
+        mem::SnapshotStats stats = snapshot->get_stats();
+        u64 snapshot_size = snapshot->get_size();
+        delete snapshot;
+
+        // NOTE: the file is a heap closed at the snapshot, the objects still
+        // have the values they had before the writes
+        bool restored;
+        bool objects_same = true;
+        {
+            mem::Memory restore_memory("snapshot_test.bin", SNAPSHOT_HEAP_SIZE);
+            mem::Heap restore_heap(&restore_memory, SNAPSHOT_HEAP_SIZE);
+            restored = restore_heap.is_restored() && restore_heap.get_used() == snapshot_size;
+            for(u32 i = 0; i < SNAPSHOT_OBJECT_COUNT && restored; i += 7919)
+            {
+                u8 *object = restore_heap.get_base() + (objects[i] - snapshot_heap.get_base());
+                for(u32 byte = 0; byte < SNAPSHOT_OBJECT_SIZE; ++byte)
+                {
+                    if(object[byte] != (u8)i) objects_same = false;
+                }
+                restore_heap.deallocate(object);
+            }
+            restore_heap.allocate(SNAPSHOT_OBJECT_SIZE);
+        }
+        DeleteFileA("snapshot_test.bin");
+        free(first_page);
+        free(checkpoint);
+        free(objects);
+
+        printf("\ncheckpoint by copy of the heap takes:\n");
+        prof.print(SNAPSHOT_COPY);
+        printf("copy on write snapshot takes (%lld pages):\n", stats._pages);
+        prof.print(SNAPSHOT_TAKE);
+        printf("writes after the snapshot take (%lld pages copied, %s):\n", stats._copied_pages, same ? "snapshot unchanged" : "snapshot changed");
+        prof.print(SNAPSHOT_WRITES, SNAPSHOT_WRITE_COUNT);
+        printf("heap restored from the snapshot file: %s\n",
+               restored ? (objects_same ? "yes, objects unchanged" : "yes, objects changed") : "no");
+    }
+
+    // NOTE: append only log grown by doubling with Heap::reallocate or in a
+    // reserved virtual array that only commits pages
+#define LOG_REALLOC 45
+#define LOG_VIRTUAL 46
+#define LOG_ENTRY_COUNT (1 << 23)
+    {
+        mem::Memory realloc_memory(MB(512));
+        mem::Heap realloc_heap(&realloc_memory, MB(512));
+        u64 capacity = 8;
+        u64 *entries = (u64 *)realloc_heap.allocate(capacity * sizeof(u64));
+
+        prof.start(LOG_REALLOC);
+        for(u64 i = 0; i < LOG_ENTRY_COUNT; ++i)
+        {
+            if(i == capacity)
+            {
+                capacity *= 2;
+                entries = (u64 *)realloc_heap.reallocate((u8 *)entries, capacity * sizeof(u64));
+                // NOTE: other allocations land after the log, the next growth
+                // can't extend it in place
+                realloc_heap.allocate(64);
+            }
+            entries[i] = i;
+        }
+        prof.stop(LOG_REALLOC);
+        mem::HeapReallocStats realloc_stats = realloc_heap.get_realloc_stats();
+
+        mem::Memory log_memory(GB(2));
+        mem::VirtualArray<u64> log(&log_memory, GB(1) / sizeof(u64));
+        u64 *first = 0;
+
+        prof.start(LOG_VIRTUAL);
+        for(u64 i = 0; i < LOG_ENTRY_COUNT; ++i)
+        {
+            u64 *entry = log.push(i);
+            if(!i) first = entry;
+        }
+        prof.stop(LOG_VIRTUAL);
+
+        printf("\nlog growth with heap reallocate takes (%lld slow reallocs):\n", realloc_stats._slow);
+        prof.print(LOG_REALLOC, LOG_ENTRY_COUNT);
+        printf("log growth in a virtual array takes (%lld bytes committed, first entry %s):\n",
+               log.get_committed(), first == log.get_data() ? "never moved" : "moved");
+        prof.print(LOG_VIRTUAL, LOG_ENTRY_COUNT);
+    }
+
     return 0;
 }
@@ -1,5 +1,6 @@
 #include "memory.h"
 #include <Windows.h>
+#include <assert.h>
 
 namespace mem
 {
@@ -26,16 +27,402 @@ void safe_memcpy(void *dst, void *src, u64 number_bytes)
     }
 }
 
-Memory::Memory(u64 size)
+u64 purge_pages(void *data, u64 size)
 {
-    _size = align8(size);
-    _base = (u8 *)VirtualAlloc(0, _size, MEM_COMMIT|MEM_RESERVE, PAGE_READWRITE);
+    u64 page_size = KB(4);
+    u64 start = ((u64)data + page_size - 1) & ~(page_size - 1);
+    u64 end = ((u64)data + size) & ~(page_size - 1);
+    if(end <= start) return 0;
+    // NOTE: MEM_RESET fails on file backed views, nothing is purged there
+    if(!VirtualAlloc((void *)start, end - start, MEM_RESET, PAGE_READWRITE)) return 0;
+    return end - start;
+}
+
+static u64 align_page(u64 size)
+{
+    return (size + MEMORY_PAGE_SIZE - 1) & ~(MEMORY_PAGE_SIZE - 1);
+}
+
+static bool enable_lock_memory_privilege()
+{
+    // NOTE: the privilege must be granted to the user by the local security
+    // policy, it is only enabled in the token here
+    HANDLE token;
+    if(!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES|TOKEN_QUERY, &token)) return false;
+    TOKEN_PRIVILEGES privileges = {};
+    privileges.PrivilegeCount = 1;
+    privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    bool enabled = LookupPrivilegeValueA(0, "SeLockMemoryPrivilege", &privileges.Privileges[0].Luid) &&
+                   AdjustTokenPrivileges(token, FALSE, &privileges, 0, 0, 0) &&
+                   GetLastError() == ERROR_SUCCESS;
+    CloseHandle(token);
+    return enabled;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Memory(u64 size, u32 flags)
+[DES]:  - only reserves the region, the pages are committed with the
+          spans, MEMORY_LARGE_PAGES maps the whole region with large pages
+          when the process can lock memory and falls back to normal
+          pages otherwise, MEMORY_PREFAULT commits and touches every page
+          now so the spans never fault later
+[IN ]:
+        - size (u64): total size of the region in bytes
+        - flags (u32): MEMORY_LARGE_PAGES and MEMORY_PREFAULT or 0
+[OUT]:
+        - memory (Memory): new Memory object
+-----------------------------------------------------*/
+Memory::Memory(u64 size, u32 flags)
+{
+    _size = align_page(size);
+    _base = 0;
+    _flags = 0;
+    _committed = false;
+    if(flags & MEMORY_LARGE_PAGES)
+    {
+        // NOTE: large pages are committed and locked at once and can't be
+        // decommitted, the size is rounded to the large page
+        u64 large_page = GetLargePageMinimum();
+        if(large_page && enable_lock_memory_privilege())
+        {
+            u64 large_size = (size + large_page - 1) & ~(large_page - 1);
+            _base = (u8 *)VirtualAlloc(0, large_size, MEM_RESERVE|MEM_COMMIT|MEM_LARGE_PAGES, PAGE_READWRITE);
+            if(_base)
+            {
+                _size = large_size;
+                _flags |= MEMORY_LARGE_PAGES;
+                _committed = true;
+            }
+        }
+    }
+    if(!_base && (flags & MEMORY_PREFAULT))
+    {
+        _base = (u8 *)VirtualAlloc(0, _size, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
+        assert(_base);
+        // NOTE: a committed page is only backed on its first touch, the
+        // faults are all taken here instead of in the first pushes
+        for(u64 offset = 0; offset < _size; offset += MEMORY_PAGE_SIZE)
+        {
+            ((volatile u8 *)_base)[offset] = 0;
+        }
+        _flags |= MEMORY_PREFAULT;
+        _committed = true;
+    }
+    if(!_base)
+    {
+        _base = (u8 *)VirtualAlloc(0, _size, MEM_RESERVE, PAGE_READWRITE);
+        assert(_base);
+    }
     _used = 0;
+    _file = 0;
+    _mapping = 0;
+    _restored = false;
+    init_spans();
+}
+
+Memory::Memory(const char *path, u64 size)
+{
+    _size = align_page(size);
+    _used = 0;
+    _flags = 0;
+    _committed = true;
+    init_spans();
+    
+    HANDLE file = CreateFileA(path, GENERIC_READ|GENERIC_WRITE, 0, 0, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+    assert(file != INVALID_HANDLE_VALUE);
+    _restored = GetLastError() == ERROR_ALREADY_EXISTS;
+    
+    // NOTE: a file with a different size is not ours, truncate it so the
+    // mapping starts zero filled and no old header can be taken as valid
+    LARGE_INTEGER file_size;
+    GetFileSizeEx(file, &file_size);
+    if((u64)file_size.QuadPart != _size)
+    {
+        _restored = false;
+        LARGE_INTEGER zero = {};
+        SetFilePointerEx(file, zero, 0, FILE_BEGIN);
+        SetEndOfFile(file);
+    }
+    
+    HANDLE mapping = CreateFileMappingA(file, 0, PAGE_READWRITE, (DWORD)(_size >> 32), (DWORD)(_size & 0xFFFFFFFF), 0);
+    assert(mapping);
+    _base = (u8 *)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, _size);
+    assert(_base);
+    
+    _file = file;
+    _mapping = mapping;
 }
 
 Memory::~Memory()
 {
-    VirtualFree(_base, 0, MEM_RELEASE);
+    if(_mapping)
+    {
+        FlushViewOfFile(_base, 0);
+        UnmapViewOfFile(_base);
+        CloseHandle((HANDLE)_mapping);
+        FlushFileBuffers((HANDLE)_file);
+        CloseHandle((HANDLE)_file);
+    }
+    else
+    {
+        VirtualFree(_base, 0, MEM_RELEASE);
+    }
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Memory::allocate_span(u64 size, bool *fresh)
+[IN ]:
+        - size (u64): bytes wanted, rounded up to MEMORY_PAGE_SIZE
+        - fresh (bool *): optional, true if the span was never given out
+          before in this run, only those can hold a restored state
+[OUT]:
+        - data (u8 *): page aligned and committed span
+-----------------------------------------------------*/
+u8 *Memory::allocate_span(u64 size, bool *fresh)
+{
+    return take_span(size, fresh, true);
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Memory::reserve_span(u64 size)
+[DES]:  - like allocate_span but the pages are not committed, the owner
+          commits them with commit_pages as it grows
+[IN ]:
+        - size (u64): bytes wanted, rounded up to MEMORY_PAGE_SIZE
+[OUT]:
+        - data (u8 *): page aligned span
+-----------------------------------------------------*/
+u8 *Memory::reserve_span(u64 size)
+{
+    return take_span(size, 0, false);
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Memory::free_span(u8 *data, u64 size, bool committed)
+[DES]:  - when MEMORY_MAX_FREE_SPANS spans are already free and the span
+          can't be merged, its pages go back to the OS and its range is
+          dropped from the free list
+[IN ]:
+        - data (u8 *): pointer returned by allocate_span or reserve_span
+        - size (u64): same size given when the span was taken
+        - committed (bool): false if the pages of the span were
+          decommitted by the owner
+-----------------------------------------------------*/
+void Memory::free_span(u8 *data, u64 size, bool committed)
+{
+    size = align_page(size);
+    u64 offset = (u64)(data - _base);
+    assert(offset % MEMORY_PAGE_SIZE == 0 && offset + size <= _used);
+
+    u32 index = 0;
+    while(index < _free_count && _free_spans[index]._offset < offset)
+    {
+        ++index;
+    }
+    MemorySpan *prev = index ? &_free_spans[index - 1] : 0;
+    MemorySpan *next = index < _free_count ? &_free_spans[index] : 0;
+    assert(!prev || prev->_offset + prev->_size <= offset);
+    assert(!next || offset + size <= next->_offset);
+    if(prev && prev->_offset + prev->_size != offset) prev = 0;
+    if(next && offset + size != next->_offset) next = 0;
+
+    MemorySpan span = {offset, size, committed || _committed};
+    _free_size += size;
+    if(span._committed) _free_committed += size;
+    // NOTE: past the retain size the span goes back to the OS right away,
+    // a merged span is only committed if all its parts are
+    if(_free_committed > _retain_size) decommit_span(&span);
+    if(!span._committed || (prev && !prev->_committed) || (next && !next->_committed))
+    {
+        decommit_span(&span);
+        if(prev) decommit_span(prev);
+        if(next) decommit_span(next);
+    }
+
+    if(prev)
+    {
+        prev->_size += size;
+        if(next)
+        {
+            prev->_size += next->_size;
+            remove_free_span(index);
+        }
+    }
+    else if(next)
+    {
+        next->_offset = offset;
+        next->_size += size;
+    }
+    else if(_free_count == MEMORY_MAX_FREE_SPANS)
+    {
+        // NOTE: the range is only used again if it's at the top, where it
+        // goes back to the bump part
+        decommit_span(&span);
+        _free_size -= size;
+        if(span._committed) _free_committed -= size;
+        if(offset + size == _used) _used = offset;
+    }
+    else
+    {
+        for(u32 move = _free_count; move > index; --move)
+        {
+            _free_spans[move] = _free_spans[move - 1];
+        }
+        _free_spans[index] = span;
+        ++_free_count;
+    }
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Memory::commit_pages(u8 *data, u64 size)
+[DES]:  - commits the pages of a span, nothing to do in a region that is
+          always committed
+[IN ]:
+        - data (u8 *): page aligned start inside a span
+        - size (u64): bytes to commit, rounded up to MEMORY_PAGE_SIZE
+-----------------------------------------------------*/
+void Memory::commit_pages(u8 *data, u64 size)
+{
+    assert(data >= _base && data + size <= _base + _used);
+    if(_committed || !size) return;
+    void *committed = VirtualAlloc(data, align_page(size), MEM_COMMIT, PAGE_READWRITE);
+    assert(committed);
+}
+
+void Memory::decommit_pages(u8 *data, u64 size)
+{
+    assert(data >= _base && data + size <= _base + _used);
+    if(_committed || !size) return;
+    BOOL decommitted = VirtualFree(data, align_page(size), MEM_DECOMMIT);
+    assert(decommitted);
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Memory::decommit_free_spans()
+[DES]:  - gives the pages of all the free spans back to the OS, to call
+          when the program is idle
+[OUT]:
+        - decommitted (u64): number of bytes decommitted
+-----------------------------------------------------*/
+u64 Memory::decommit_free_spans()
+{
+    u64 decommitted = _decommitted;
+    for(u32 index = 0; index < _free_count; ++index)
+    {
+        decommit_span(&_free_spans[index]);
+    }
+    return _decommitted - decommitted;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Memory::set_retain_size(u64 size)
+[IN ]:
+        - size (u64): free bytes kept committed for the next spans,
+          MEMORY_RETAIN_SIZE by default
+-----------------------------------------------------*/
+void Memory::set_retain_size(u64 size)
+{
+    _retain_size = size;
+}
+
+MemoryStats Memory::get_stats()
+{
+    MemoryStats stats;
+    stats._used = _used - _free_size;
+    stats._free = _free_size;
+    stats._free_committed = _free_committed;
+    stats._free_spans = _free_count;
+    stats._reused = _reused;
+    stats._decommitted = _decommitted;
+    return stats;
+}
+
+void Memory::init_spans()
+{
+    _free_count = 0;
+    _free_size = 0;
+    _free_committed = 0;
+    _retain_size = MEMORY_RETAIN_SIZE;
+    _high_water = 0;
+    _reused = 0;
+    _decommitted = 0;
+}
+
+u8 *Memory::take_span(u64 size, bool *fresh, bool commit)
+{
+    size = align_page(size);
+    assert(size);
+    for(u32 index = 0; index < _free_count; ++index)
+    {
+        MemorySpan *span = &_free_spans[index];
+        if(span->_size < size) continue;
+
+        u8 *data = _base + span->_offset;
+        if(span->_committed)
+        {
+            _free_committed -= size;
+        }
+        else if(commit)
+        {
+            void *committed = VirtualAlloc(data, size, MEM_COMMIT, PAGE_READWRITE);
+            assert(committed);
+        }
+        _free_size -= size;
+        span->_offset += size;
+        span->_size -= size;
+        if(!span->_size) remove_free_span(index);
+        ++_reused;
+        if(fresh) *fresh = false;
+        return data;
+    }
+
+    // NOTE: a free span that ends at the top is given back to the bump part
+    // so the new span can use it, its pages are committed again if needed
+    if(_free_count)
+    {
+        MemorySpan *last = &_free_spans[_free_count - 1];
+        if(last->_offset + last->_size == _used)
+        {
+            _used = last->_offset;
+            _free_size -= last->_size;
+            if(last->_committed) _free_committed -= last->_size;
+            remove_free_span(_free_count - 1);
+        }
+    }
+
+    assert(_used + size <= _size);
+    u8 *data = _base + _used;
+    if(fresh) *fresh = _used >= _high_water;
+    _used += size;
+    if(_used > _high_water) _high_water = _used;
+    if(!_committed && commit)
+    {
+        void *committed = VirtualAlloc(data, size, MEM_COMMIT, PAGE_READWRITE);
+        assert(committed);
+    }
+    return data;
+}
+
+void Memory::remove_free_span(u32 index)
+{
+    assert(index < _free_count);
+    --_free_count;
+    for(u32 move = index; move < _free_count; ++move)
+    {
+        _free_spans[move] = _free_spans[move + 1];
+    }
+}
+
+void Memory::decommit_span(MemorySpan *span)
+{
+    // NOTE: the pages of a file mapping hold the content of the file and
+    // large or prefaulted pages are kept for the whole life of the region
+    if(!span->_committed || _committed) return;
+    BOOL decommitted = VirtualFree(_base + span->_offset, span->_size, MEM_DECOMMIT);
+    assert(decommitted);
+    span->_committed = false;
+    _free_committed -= span->_size;
+    _decommitted += span->_size;
 }
 
 };
@@ -14,14 +14,177 @@ inline u64 align8(u64 size)
 
 void safe_memcpy(void *dst, void *src, u64 number_bytes);
 
+/*@docs------------------------------------------------
+[FNC]:  - purge_pages(void *data, u64 size)
+[DES]:  - tells the OS the content of the whole pages inside the range is not
+          needed anymore, the pages stay usable but the OS can reclaim them
+[IN ]:
+        - data (void *): start of the range
+        - size (u64): size of the range in bytes
+[OUT]:
+        - purged (u64): number of bytes purged
+-----------------------------------------------------*/
+u64 purge_pages(void *data, u64 size);
+
+#define MEMORY_PAGE_SIZE KB(4)
+#define MEMORY_MAX_FREE_SPANS 256
+#define MEMORY_RETAIN_SIZE MB(16)
+#define MEMORY_LARGE_PAGE_SIZE MB(2)
+
+// NOTE: options of Memory(u64 size, u32 flags), _flags only keeps the ones
+// that were granted
+#define MEMORY_LARGE_PAGES 0x1
+#define MEMORY_PREFAULT 0x2
+
+/*@docs------------------------------------------------
+[DES]:  - free pages of the region, (_committed) is false once the pages
+          were given back to the OS
+-----------------------------------------------------*/
+struct MemorySpan
+{
+    u64 _offset;
+    u64 _size;
+    bool _committed;
+};
+
+struct MemoryStats
+{
+    u64 _used;
+    u64 _free;
+    u64 _free_committed;
+    u64 _free_spans;
+    u64 _reused;
+    u64 _decommitted;
+};
+
+/*@docs------------------------------------------------
+[DES]:  - reserved region split in page spans, a span is taken from the free
+          spans first (lowest address that fits) and bumped from _used
+          otherwise, a freed span is merged with its free neighbours, the
+          free spans stay committed up to the retain size and are
+          decommitted after it or by decommit_free_spans, a file backed,
+          large page or prefaulted region is always committed, it is not
+          thread safe
+-----------------------------------------------------*/
 struct Memory
 {
-    Memory(u64 size);
+    /*@docs------------------------------------------------
+    [FNC]:  - Memory(u64 size, u32 flags)
+    [DES]:  - only reserves the region, the pages are committed with the
+              spans, MEMORY_LARGE_PAGES maps the whole region with large pages
+              when the process can lock memory and falls back to normal
+              pages otherwise, MEMORY_PREFAULT commits and touches every page
+              now so the spans never fault later
+    [IN ]:
+            - size (u64): total size of the region in bytes
+            - flags (u32): MEMORY_LARGE_PAGES and MEMORY_PREFAULT or 0
+    [OUT]:
+            - memory (Memory): new Memory object
+    -----------------------------------------------------*/
+    Memory(u64 size, u32 flags = 0);
+    
+    /*@docs------------------------------------------------
+    [FNC]:  - Memory(const char *path, u64 size)
+    [DES]:  - maps the region from a file, if the file already exist with the
+              same size the previous content is kept and _restored is true,
+              arenas and heaps carved in the same order find their state again
+    [IN ]:
+            - path (const char *): path of the backing file
+            - size (u64): total size of the region in bytes
+    [OUT]:
+            - memory (Memory): new Memory object
+    -----------------------------------------------------*/
+    Memory(const char *path, u64 size);
     ~Memory();
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Memory::allocate_span(u64 size, bool *fresh)
+    [IN ]:
+            - size (u64): bytes wanted, rounded up to MEMORY_PAGE_SIZE
+            - fresh (bool *): optional, true if the span was never given out
+              before in this run, only those can hold a restored state
+    [OUT]:
+            - data (u8 *): page aligned and committed span
+    -----------------------------------------------------*/
+    u8 *allocate_span(u64 size, bool *fresh = 0);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Memory::reserve_span(u64 size)
+    [DES]:  - like allocate_span but the pages are not committed, the owner
+              commits them with commit_pages as it grows
+    [IN ]:
+            - size (u64): bytes wanted, rounded up to MEMORY_PAGE_SIZE
+    [OUT]:
+            - data (u8 *): page aligned span
+    -----------------------------------------------------*/
+    u8 *reserve_span(u64 size);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Memory::free_span(u8 *data, u64 size, bool committed)
+    [DES]:  - when MEMORY_MAX_FREE_SPANS spans are already free and the span
+              can't be merged, its pages go back to the OS and its range is
+              dropped from the free list
+    [IN ]:
+            - data (u8 *): pointer returned by allocate_span or reserve_span
+            - size (u64): same size given when the span was taken
+            - committed (bool): false if the pages of the span were
+              decommitted by the owner
+    -----------------------------------------------------*/
+    void free_span(u8 *data, u64 size, bool committed = true);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Memory::commit_pages(u8 *data, u64 size)
+    [DES]:  - commits the pages of a span, nothing to do in a region that is
+              always committed
+    [IN ]:
+            - data (u8 *): page aligned start inside a span
+            - size (u64): bytes to commit, rounded up to MEMORY_PAGE_SIZE
+    -----------------------------------------------------*/
+    void commit_pages(u8 *data, u64 size);
+    void decommit_pages(u8 *data, u64 size);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Memory::decommit_free_spans()
+    [DES]:  - gives the pages of all the free spans back to the OS, to call
+              when the program is idle
+    [OUT]:
+            - decommitted (u64): number of bytes decommitted
+    -----------------------------------------------------*/
+    u64 decommit_free_spans();
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Memory::set_retain_size(u64 size)
+    [IN ]:
+            - size (u64): free bytes kept committed for the next spans,
+              MEMORY_RETAIN_SIZE by default
+    -----------------------------------------------------*/
+    void set_retain_size(u64 size);
+
+    MemoryStats get_stats();
     
     u8 *_base;
     u64 _used;
     u64 _size;
+
+    void *_file;
+    void *_mapping;
+    bool _restored;
+    u32 _flags;
+    bool _committed;
+
+    MemorySpan _free_spans[MEMORY_MAX_FREE_SPANS];
+    u32 _free_count;
+    u64 _free_size;
+    u64 _free_committed;
+    u64 _retain_size;
+    u64 _high_water;
+    u64 _reused;
+    u64 _decommitted;
+
+    void init_spans();
+    u8 *take_span(u64 size, bool *fresh, bool commit);
+    void remove_free_span(u32 index);
+    void decommit_span(MemorySpan *span);
 };
 
 };
@@ -1,36 +1,220 @@
 #include "profiler.h"
 
 #include <stdio.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <time.h>
+#else
 #include <Windows.h>
+#endif
 
 namespace os
 {
 
+static const char *counter_names[PROFILER_COUNTER_COUNT] =
+{
+    "cycles", "instructions", "l1d misses", "llc misses", "dtlb misses", "branch misses"
+};
+
+static u64 read_timer()
+{
+#ifdef __linux__
+    timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (u64)time.tv_sec * 1000000000ULL + (u64)time.tv_nsec;
+#else
+    LARGE_INTEGER l_coun;
+    QueryPerformanceCounter(&l_coun);
+    return l_coun.QuadPart;
+#endif
+}
+
+#ifdef __linux__
+static s32 open_counter(u32 type, u64 config, s32 group)
+{
+    perf_event_attr attr = {};
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (s32)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+static u64 cache_miss(u64 cache)
+{
+    return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+#endif
+
 Profiler::Profiler() 
 {
     printf("application start with the profiler...\n\n");
+#ifdef __linux__
+    _frequency = 1000000000ULL;
+#else
     LARGE_INTEGER l_freq;
     QueryPerformanceFrequency(&l_freq);
     _frequency = l_freq.QuadPart;
+#endif
+    _counter_mask = 0;
+    for(u32 counter = 0; counter < PROFILER_COUNTER_COUNT; ++counter)
+    {
+        _counter_fd[counter] = -1;
+    }
+}
+
+Profiler::~Profiler()
+{
+#ifdef __linux__
+    for(u32 counter = 0; counter < PROFILER_COUNTER_COUNT; ++counter)
+    {
+        if(_counter_fd[counter] >= 0) close(_counter_fd[counter]);
+    }
+#endif
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Profiler::enable_counters()
+[DES]:  - opens the hardware counters of the calling thread, every slot
+          then also counts the events between start and stop, the
+          counters the system doesn't allow are left out, on Linux they
+          are a perf_event_open group (perf_event_paranoid <= 2), on
+          Windows only the thread cycles are available
+[OUT]:
+        - enabled (bool): false if no counter could be opened
+-----------------------------------------------------*/
+bool Profiler::enable_counters()
+{
+    if(_counter_mask) return true;
+#ifdef __linux__
+    u32 types[PROFILER_COUNTER_COUNT] =
+    {
+        PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+        PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE
+    };
+    u64 configs[PROFILER_COUNTER_COUNT] =
+    {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, cache_miss(PERF_COUNT_HW_CACHE_L1D),
+        cache_miss(PERF_COUNT_HW_CACHE_LL), cache_miss(PERF_COUNT_HW_CACHE_DTLB), PERF_COUNT_HW_BRANCH_MISSES
+    };
+    // NOTE: the first counter that opens leads the group so all of them are
+    // scheduled together and read with one call
+    s32 leader = -1;
+    for(u32 counter = 0; counter < PROFILER_COUNTER_COUNT; ++counter)
+    {
+        _counter_fd[counter] = open_counter(types[counter], configs[counter], leader);
+        if(_counter_fd[counter] < 0) continue;
+        if(leader < 0) leader = _counter_fd[counter];
+        _counter_mask |= 1 << counter;
+    }
+#else
+    ULONG64 cycles = 0;
+    if(QueryThreadCycleTime(GetCurrentThread(), &cycles))
+    {
+        _counter_mask = 1 << PROFILER_COUNTER_CYCLES;
+    }
+#endif
+    return _counter_mask != 0;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Profiler::has_counter(u32 counter)
+[IN ]:
+        - counter (u32): one of the PROFILER_COUNTER_ values
+[OUT]:
+        - available (bool): true if the counter is measured
+-----------------------------------------------------*/
+bool Profiler::has_counter(u32 counter)
+{
+    return (_counter_mask >> counter) & 1;
 }
 
 void Profiler::start(u8 slot)
 {
-    LARGE_INTEGER l_coun;
-    QueryPerformanceCounter(&l_coun);
-    _last_counter[slot] = l_coun.QuadPart;
+    if(_counter_mask) read_counters(_last_events[slot]);
+    _last_counter[slot] = read_timer();
 }
 
 void Profiler::stop(u8 slot)
 {
-    LARGE_INTEGER l_coun;
-    QueryPerformanceCounter(&l_coun);
-    _data[slot] = (f64)(l_coun.QuadPart - _last_counter[slot]) / _frequency;
+    u64 counter = read_timer();
+    _data[slot] = (f64)(counter - _last_counter[slot]) / _frequency;
+    if(_counter_mask)
+    {
+        u64 events[PROFILER_COUNTER_COUNT];
+        read_counters(events);
+        for(u32 index = 0; index < PROFILER_COUNTER_COUNT; ++index)
+        {
+            _events[slot][index] = (f64)(events[index] - _last_events[slot][index]);
+        }
+    }
 }
 
 void Profiler::print(u8 slot)
 {
     printf("    profiler %d, takes = %lfs\n", slot, _data[slot]);
+    print_counters(slot, 1.0);
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Profiler::print(u8 slot, u64 operations)
+[DES]:  - prints the time and the counters of the slot divided by the
+          number of operations done between start and stop
+[IN ]:
+        - slot (u8): profiler slot
+        - operations (u64): number of operations of the slot
+-----------------------------------------------------*/
+void Profiler::print(u8 slot, u64 operations)
+{
+    f64 divisor = operations ? (f64)operations : 1.0;
+    printf("    profiler %d, takes = %lfs, %.1lfns per op\n", slot, _data[slot], _data[slot] * 1e9 / divisor);
+    print_counters(slot, divisor);
+}
+
+void Profiler::read_counters(u64 *values)
+{
+    for(u32 counter = 0; counter < PROFILER_COUNTER_COUNT; ++counter)
+    {
+        values[counter] = 0;
+    }
+#ifdef __linux__
+    // NOTE: group read, the values come in the order the counters were
+    // opened, scaled up if the group was multiplexed with other events
+    u64 buffer[3 + PROFILER_COUNTER_COUNT];
+    s32 leader = -1;
+    for(u32 counter = 0; counter < PROFILER_COUNTER_COUNT && leader < 0; ++counter)
+    {
+        leader = _counter_fd[counter];
+    }
+    if(read(leader, buffer, sizeof(buffer)) <= 0) return;
+    f64 scale = buffer[2] ? (f64)buffer[1] / (f64)buffer[2] : 0.0;
+    u32 value = 0;
+    for(u32 counter = 0; counter < PROFILER_COUNTER_COUNT && value < buffer[0]; ++counter)
+    {
+        if(!has_counter(counter)) continue;
+        values[counter] = (u64)((f64)buffer[3 + value++] * scale);
+    }
+#else
+    ULONG64 cycles = 0;
+    QueryThreadCycleTime(GetCurrentThread(), &cycles);
+    values[PROFILER_COUNTER_CYCLES] = cycles;
+#endif
+}
+
+void Profiler::print_counters(u8 slot, f64 divisor)
+{
+    if(!_counter_mask) return;
+    printf("       ");
+    for(u32 counter = 0; counter < PROFILER_COUNTER_COUNT; ++counter)
+    {
+        if(!has_counter(counter)) continue;
+        printf(" %s %.1lf", counter_names[counter], _events[slot][counter] / divisor);
+    }
+    printf("\n");
 }
 
 };
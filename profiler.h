@@ -6,19 +6,68 @@
 namespace os
 {
 
+#define PROFILER_SLOT_COUNT 256
+#define PROFILER_COUNTER_CYCLES 0
+#define PROFILER_COUNTER_INSTRUCTIONS 1
+#define PROFILER_COUNTER_L1D_MISSES 2
+#define PROFILER_COUNTER_LLC_MISSES 3
+#define PROFILER_COUNTER_DTLB_MISSES 4
+#define PROFILER_COUNTER_BRANCH_MISSES 5
+#define PROFILER_COUNTER_COUNT 6
+
 class Profiler
 {
 public:
     Profiler(); 
+    ~Profiler();
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Profiler::enable_counters()
+    [DES]:  - opens the hardware counters of the calling thread, every slot
+              then also counts the events between start and stop, the
+              counters the system doesn't allow are left out, on Linux they
+              are a perf_event_open group (perf_event_paranoid <= 2), on
+              Windows only the thread cycles are available
+    [OUT]:
+            - enabled (bool): false if no counter could be opened
+    -----------------------------------------------------*/
+    bool enable_counters();
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Profiler::has_counter(u32 counter)
+    [IN ]:
+            - counter (u32): one of the PROFILER_COUNTER_ values
+    [OUT]:
+            - available (bool): true if the counter is measured
+    -----------------------------------------------------*/
+    bool has_counter(u32 counter);
     
     void start(u8 slot);
     void stop(u8 slot);
     void print(u8 slot);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Profiler::print(u8 slot, u64 operations)
+    [DES]:  - prints the time and the counters of the slot divided by the
+              number of operations done between start and stop
+    [IN ]:
+            - slot (u8): profiler slot
+            - operations (u64): number of operations of the slot
+    -----------------------------------------------------*/
+    void print(u8 slot, u64 operations);
 private:
     u64 _frequency;
     
-    u64 _last_counter[256];
-    f64 _data[256];
+    u64 _last_counter[PROFILER_SLOT_COUNT];
+    f64 _data[PROFILER_SLOT_COUNT];
+
+    u32 _counter_mask;
+    s32 _counter_fd[PROFILER_COUNTER_COUNT];
+    u64 _last_events[PROFILER_SLOT_COUNT][PROFILER_COUNTER_COUNT];
+    f64 _events[PROFILER_SLOT_COUNT][PROFILER_COUNTER_COUNT];
+
+    void read_counters(u64 *values);
+    void print_counters(u8 slot, f64 divisor);
 };
 
 };
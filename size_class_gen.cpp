@@ -0,0 +1,68 @@
+#include "size_histogram.h"
+#include "size_classes.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// NOTE: offline tool, reads a histogram saved with SizeHistogram::save and
+// writes the size class header compiled into SmallHeap:
+//     size_class_gen.exe <histogram> <class count> [<max size>] [<output header>]
+
+int main(int argc, char **argv)
+{
+    if(argc < 3)
+    {
+        printf("usage: size_class_gen <histogram> <class count> [<max size>] [<output header>]\n");
+        return 1;
+    }
+
+    mem::SizeHistogram histogram;
+    if(!histogram.load(argv[1]))
+    {
+        printf("can't load histogram %s\n", argv[1]);
+        return 1;
+    }
+
+    u32 max_count = (u32)atoi(argv[2]);
+    u64 max_size = argc > 3 ? (u64)atoll(argv[3]) : SIZE_HISTOGRAM_MAX_SIZE;
+    const char *path = argc > 4 ? argv[4] : "size_classes.h";
+    if(max_count == 0 || max_count > SIZE_CLASS_MAX_COUNT)
+    {
+        printf("class count must be in [1, %d]\n", SIZE_CLASS_MAX_COUNT);
+        return 1;
+    }
+
+    u32 classes[SIZE_CLASS_MAX_COUNT];
+    u32 count = histogram.compute_classes(max_count, max_size, classes);
+    if(!count)
+    {
+        printf("no recorded size up to %lld bytes\n", max_size);
+        return 1;
+    }
+
+    // NOTE: the current table only covers the sizes up to its last class,
+    // the new one is compared over the same sizes
+    u32 current_count = 0;
+    while(current_count < SIZE_CLASS_COUNT && mem::size_class_size[current_count] <= classes[count - 1])
+    {
+        ++current_count;
+    }
+    printf("%lld allocations, %lld over %d bytes\n",
+           histogram.get_count(), histogram.get_overflow_count(), SIZE_HISTOGRAM_MAX_SIZE);
+    printf("current classes waste %lld bytes (sizes up to %d)\n",
+           histogram.get_waste(mem::size_class_size, current_count),
+           current_count ? mem::size_class_size[current_count - 1] : 0);
+    printf("new classes waste %lld bytes:\n   ", histogram.get_waste(classes, count));
+    for(u32 index = 0; index < count; ++index)
+    {
+        printf(" %d", classes[index]);
+    }
+    printf("\n");
+
+    if(!mem::write_size_classes(path, classes, count))
+    {
+        printf("can't write %s\n", path);
+        return 1;
+    }
+    printf("written %s\n", path);
+    return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef SIZE_CLASSES_H
+#define SIZE_CLASSES_H
+
+// NOTE: generated by size_class_gen.exe from a recorded SizeHistogram,
+// regenerate it instead of editing it
+
+#include "types.h"
+
+namespace mem
+{
+
+#define SIZE_CLASS_COUNT 6
+#define SIZE_CLASS_MAX_SIZE 64
+#define SIZE_CLASS_TABLE_ID 0x3887DC5DULL
+
+constexpr u32 size_class_size[SIZE_CLASS_COUNT] =
+{
+    8, 16, 24, 32, 48, 64
+};
+
+// NOTE: indexed by (size + 7) / 8
+constexpr u8 size_class_from_granule[SIZE_CLASS_MAX_SIZE / 8 + 1] =
+{
+    0, 0, 1, 2, 3, 4, 4, 5, 5
+};
+
+};
+
+#endif // SIZE_CLASSES_H
@@ -0,0 +1,260 @@
+#include "size_histogram.h"
+#include <stdio.h>
+#include <assert.h>
+
+namespace mem
+{
+
+///////////////////////////////////////////////////////
+//      SizeHistogram methods:
+//      Public interface
+///////////////////////////////////////////////////////
+
+SizeHistogram::SizeHistogram()
+{
+    for(u32 index = 0; index < SIZE_HISTOGRAM_GRANULE_COUNT; ++index)
+    {
+        _counts[index] = 0;
+    }
+    _overflow_count = 0;
+    _requested_bytes = 0;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - SizeHistogram::record(u64 size)
+[IN ]:
+        - size (u64): requested size of an allocation
+-----------------------------------------------------*/
+void SizeHistogram::record(u64 size)
+{
+    _requested_bytes += size;
+    if(size > SIZE_HISTOGRAM_MAX_SIZE)
+    {
+        ++_overflow_count;
+        return;
+    }
+    // NOTE: a 0 byte allocation still takes the smallest class
+    u64 granule = (size + 7) >> 3;
+    ++_counts[granule ? granule : 1];
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - SizeHistogram::compute_classes(u32 max_count, u64 max_size, u32 *classes)
+[DES]:  - finds the size classes that minimize the bytes wasted by the
+          recorded sizes up to (max_size) using at most (max_count)
+          classes, the classes are multiples of 8 and the last one is
+          the biggest recorded size
+[IN ]:
+        - max_count (u32): class budget, at most SIZE_CLASS_MAX_COUNT
+        - max_size (u64): biggest size served by the classes
+        - classes (u32 *): array of (max_count) sizes filled in increasing order
+[OUT]:
+        - count (u32): number of classes written, can be less than (max_count)
+-----------------------------------------------------*/
+u32 SizeHistogram::compute_classes(u32 max_count, u64 max_size, u32 *classes)
+{
+    assert(max_count > 0 && max_count <= SIZE_CLASS_MAX_COUNT);
+    if(max_size > SIZE_HISTOGRAM_MAX_SIZE) max_size = SIZE_HISTOGRAM_MAX_SIZE;
+
+    // NOTE: prefix sums of the counts and of count * granule, so the waste of
+    // a class covering the granules [first, last] is computed in O(1)
+    u64 counts[SIZE_HISTOGRAM_GRANULE_COUNT];
+    u64 granules[SIZE_HISTOGRAM_GRANULE_COUNT];
+    counts[0] = 0;
+    granules[0] = 0;
+    u32 last = 0;
+    u32 used_count = 0;
+    for(u32 granule = 1; granule <= max_size >> 3; ++granule)
+    {
+        counts[granule] = counts[granule - 1] + _counts[granule];
+        granules[granule] = granules[granule - 1] + _counts[granule] * granule;
+        if(_counts[granule])
+        {
+            last = granule;
+            ++used_count;
+        }
+    }
+    if(!last) return 0;
+
+    u32 count = max_count < used_count ? max_count : used_count;
+
+    // NOTE: waste[j] is the best waste covering the granules [1, j] with the
+    // last class ending at j, it's computed for 1..count classes, the first
+    // granule of the last class is kept to walk the solution back
+    u64 waste[SIZE_HISTOGRAM_GRANULE_COUNT];
+    u64 next_waste[SIZE_HISTOGRAM_GRANULE_COUNT];
+    u16 first[SIZE_CLASS_MAX_COUNT][SIZE_HISTOGRAM_GRANULE_COUNT];
+    for(u32 end = 1; end <= last; ++end)
+    {
+        waste[end] = (end * counts[end] - granules[end]) * 8;
+        first[0][end] = 1;
+    }
+    for(u32 class_index = 1; class_index < count; ++class_index)
+    {
+        for(u32 end = class_index + 1; end <= last; ++end)
+        {
+            u64 best = ~0ULL;
+            for(u32 start = class_index + 1; start <= end; ++start)
+            {
+                u64 class_waste = (end * (counts[end] - counts[start - 1]) - (granules[end] - granules[start - 1])) * 8;
+                if(waste[start - 1] + class_waste < best)
+                {
+                    best = waste[start - 1] + class_waste;
+                    first[class_index][end] = (u16)start;
+                }
+            }
+            next_waste[end] = best;
+        }
+        for(u32 end = class_index + 1; end <= last; ++end)
+        {
+            waste[end] = next_waste[end];
+        }
+    }
+
+    u32 end = last;
+    for(u32 class_index = count; class_index > 0; --class_index)
+    {
+        classes[class_index - 1] = end * 8;
+        end = first[class_index - 1][end] - 1;
+    }
+    return count;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - SizeHistogram::get_waste(const u32 *classes, u32 count)
+[DES]:  - bytes lost between the requested sizes and their class, the
+          sizes bigger than the last class are not counted
+[IN ]:
+        - classes (const u32 *): size classes in increasing order
+        - count (u32): number of classes
+[OUT]:
+        - waste (u64): wasted bytes over all the recorded allocations
+-----------------------------------------------------*/
+u64 SizeHistogram::get_waste(const u32 *classes, u32 count)
+{
+    // NOTE: measured from the 8 byte aligned size, the heap pads to 8 anyway
+    u64 waste = 0;
+    u32 class_index = 0;
+    for(u32 granule = 1; granule < SIZE_HISTOGRAM_GRANULE_COUNT; ++granule)
+    {
+        while(class_index < count && classes[class_index] < granule * 8)
+        {
+            ++class_index;
+        }
+        if(class_index == count) break;
+        waste += _counts[granule] * (classes[class_index] - granule * 8);
+    }
+    return waste;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - SizeHistogram::save(const char *path) / load(const char *path)
+[OUT]:
+        - ok (bool): false if the file can't be opened or isn't a histogram
+-----------------------------------------------------*/
+bool SizeHistogram::save(const char *path)
+{
+    FILE *file = fopen(path, "wb");
+    if(!file) return false;
+    u64 magic = SIZE_HISTOGRAM_MAGIC | ((u64)SIZE_HISTOGRAM_MAX_SIZE << 32);
+    bool ok = fwrite(&magic, sizeof(magic), 1, file) == 1 &&
+              fwrite(this, sizeof(SizeHistogram), 1, file) == 1;
+    fclose(file);
+    return ok;
+}
+
+bool SizeHistogram::load(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if(!file) return false;
+    u64 magic = 0;
+    bool ok = fread(&magic, sizeof(magic), 1, file) == 1 &&
+              magic == (SIZE_HISTOGRAM_MAGIC | ((u64)SIZE_HISTOGRAM_MAX_SIZE << 32)) &&
+              fread(this, sizeof(SizeHistogram), 1, file) == 1;
+    fclose(file);
+    return ok;
+}
+
+u64 SizeHistogram::get_count()
+{
+    u64 count = _overflow_count;
+    for(u32 index = 0; index < SIZE_HISTOGRAM_GRANULE_COUNT; ++index)
+    {
+        count += _counts[index];
+    }
+    return count;
+}
+
+u64 SizeHistogram::get_overflow_count()
+{
+    return _overflow_count;
+}
+
+u64 SizeHistogram::get_requested_bytes()
+{
+    return _requested_bytes;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - write_size_classes(const char *path, const u32 *classes, u32 count)
+[DES]:  - writes the size class header compiled into SmallHeap
+[IN ]:
+        - path (const char *): path of the header to generate
+        - classes (const u32 *): size classes in increasing order
+        - count (u32): number of classes
+[OUT]:
+        - ok (bool): false if the file can't be written
+-----------------------------------------------------*/
+bool write_size_classes(const char *path, const u32 *classes, u32 count)
+{
+    assert(count > 0 && count <= SIZE_CLASS_MAX_COUNT);
+    FILE *file = fopen(path, "w");
+    if(!file) return false;
+
+    // NOTE: the table id goes in the SmallHeap magic, a heap file made
+    // with other classes is not restored
+    u32 table_id = 2166136261u;
+    for(u32 index = 0; index < count; ++index)
+    {
+        table_id = (table_id ^ classes[index]) * 16777619u;
+    }
+
+    u32 max_size = classes[count - 1];
+    fprintf(file, "#ifndef SIZE_CLASSES_H\n");
+    fprintf(file, "#define SIZE_CLASSES_H\n\n");
+    fprintf(file, "// NOTE: generated by size_class_gen.exe from a recorded SizeHistogram,\n");
+    fprintf(file, "// regenerate it instead of editing it\n\n");
+    fprintf(file, "#include \"types.h\"\n\n");
+    fprintf(file, "namespace mem\n{\n\n");
+    fprintf(file, "#define SIZE_CLASS_COUNT %u\n", count);
+    fprintf(file, "#define SIZE_CLASS_MAX_SIZE %u\n", max_size);
+    fprintf(file, "#define SIZE_CLASS_TABLE_ID 0x%08XULL\n\n", table_id);
+
+    fprintf(file, "constexpr u32 size_class_size[SIZE_CLASS_COUNT] =\n{");
+    for(u32 index = 0; index < count; ++index)
+    {
+        fprintf(file, "%s%u", index % 16 ? ", " : (index ? ",\n    " : "\n    "), classes[index]);
+    }
+    fprintf(file, "\n};\n\n");
+
+    fprintf(file, "// NOTE: indexed by (size + 7) / 8\n");
+    fprintf(file, "constexpr u8 size_class_from_granule[SIZE_CLASS_MAX_SIZE / 8 + 1] =\n{");
+    u32 class_index = 0;
+    for(u32 granule = 0; granule <= max_size / 8; ++granule)
+    {
+        while(classes[class_index] < granule * 8)
+        {
+            ++class_index;
+        }
+        fprintf(file, "%s%u", granule % 16 ? ", " : (granule ? ",\n    " : "\n    "), class_index);
+    }
+    fprintf(file, "\n};\n\n");
+    fprintf(file, "};\n\n");
+    fprintf(file, "#endif // SIZE_CLASSES_H\n");
+
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
+
+};
@@ -0,0 +1,92 @@
+#ifndef SIZE_HISTOGRAM_H
+#define SIZE_HISTOGRAM_H
+
+#include "types.h"
+
+namespace mem
+{
+
+// NOTE: sizes are counted in 8 byte granules, the ones bigger than
+// SIZE_HISTOGRAM_MAX_SIZE only go to the overflow counter
+#define SIZE_HISTOGRAM_MAX_SIZE 4096
+#define SIZE_HISTOGRAM_GRANULE_COUNT (SIZE_HISTOGRAM_MAX_SIZE / 8 + 1)
+#define SIZE_CLASS_MAX_COUNT 64
+#define SIZE_HISTOGRAM_MAGIC 0x54534948ULL
+
+/*@docs------------------------------------------------
+[DES]:  - number of allocations per size recorded from a running heap,
+          it's saved to a file and used offline to generate the size
+          class table (size_classes.h) with size_class_gen.exe
+-----------------------------------------------------*/
+class SizeHistogram
+{
+public:
+    SizeHistogram();
+
+    /*@docs------------------------------------------------
+    [FNC]:  - SizeHistogram::record(u64 size)
+    [IN ]:
+            - size (u64): requested size of an allocation
+    -----------------------------------------------------*/
+    void record(u64 size);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - SizeHistogram::compute_classes(u32 max_count, u64 max_size, u32 *classes)
+    [DES]:  - finds the size classes that minimize the bytes wasted by the
+              recorded sizes up to (max_size) using at most (max_count)
+              classes, the classes are multiples of 8 and the last one is
+              the biggest recorded size
+    [IN ]:
+            - max_count (u32): class budget, at most SIZE_CLASS_MAX_COUNT
+            - max_size (u64): biggest size served by the classes
+            - classes (u32 *): array of (max_count) sizes filled in increasing order
+    [OUT]:
+            - count (u32): number of classes written, can be less than (max_count)
+    -----------------------------------------------------*/
+    u32 compute_classes(u32 max_count, u64 max_size, u32 *classes);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - SizeHistogram::get_waste(const u32 *classes, u32 count)
+    [DES]:  - bytes lost between the requested sizes and their class, the
+              sizes bigger than the last class are not counted
+    [IN ]:
+            - classes (const u32 *): size classes in increasing order
+            - count (u32): number of classes
+    [OUT]:
+            - waste (u64): wasted bytes over all the recorded allocations
+    -----------------------------------------------------*/
+    u64 get_waste(const u32 *classes, u32 count);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - SizeHistogram::save(const char *path) / load(const char *path)
+    [OUT]:
+            - ok (bool): false if the file can't be opened or isn't a histogram
+    -----------------------------------------------------*/
+    bool save(const char *path);
+    bool load(const char *path);
+
+    u64 get_count();
+    u64 get_overflow_count();
+    u64 get_requested_bytes();
+
+private:
+    u64 _counts[SIZE_HISTOGRAM_GRANULE_COUNT];
+    u64 _overflow_count;
+    u64 _requested_bytes;
+};
+
+/*@docs------------------------------------------------
+[FNC]:  - write_size_classes(const char *path, const u32 *classes, u32 count)
+[DES]:  - writes the size class header compiled into SmallHeap
+[IN ]:
+        - path (const char *): path of the header to generate
+        - classes (const u32 *): size classes in increasing order
+        - count (u32): number of classes
+[OUT]:
+        - ok (bool): false if the file can't be written
+-----------------------------------------------------*/
+bool write_size_classes(const char *path, const u32 *classes, u32 count);
+
+};
+
+#endif // SIZE_HISTOGRAM_H
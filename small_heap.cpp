@@ -0,0 +1,250 @@
+#include "small_heap.h"
+#include "tracer.h"
+#include <assert.h>
+
+namespace mem
+{
+
+static_assert(SMALL_MAX_SIZE <= SMALL_PAGE_SIZE, "a size class must fit in a page");
+
+///////////////////////////////////////////////////////
+//      SmallHeap methods:
+//      Public interface
+///////////////////////////////////////////////////////
+
+/*@docs------------------------------------------------
+[FNC]:  - SmallHeap(Memory *mem, u64 size)
+[DES]:  - carves the arena in SMALL_PAGE_SIZE pages plus a descriptor
+          array indexed by page, a file backed heap is restored like Heap
+[IN ]:
+        - mem (Memory *): pointer to a memory object
+        - size (u64): total size of the heap in bytes
+[OUT]:
+        - heap (SmallHeap): new SmallHeap object
+-----------------------------------------------------*/
+SmallHeap::SmallHeap(Memory *mem, u64 size) :
+    Arena(mem, size)
+{
+    u64 header_size = sizeof(ArenaHeader) + sizeof(SmallHeapHeader);
+    assert(_size > header_size + SMALL_PAGE_SIZE + sizeof(SmallPage));
+
+    // NOTE: pages are aligned to SMALL_PAGE_SIZE from the arena base, so the
+    // page count is what is left after the descriptors and the alignment
+    _page_count = (u32)((_size - header_size) / (SMALL_PAGE_SIZE + sizeof(SmallPage)));
+    u64 first_page = (header_size + _page_count * sizeof(SmallPage) + SMALL_PAGE_SIZE - 1) & ~(SMALL_PAGE_SIZE - 1);
+    while(first_page + (u64)_page_count * SMALL_PAGE_SIZE > _size)
+    {
+        --_page_count;
+    }
+
+    _small_header = (SmallHeapHeader *)(_base + sizeof(ArenaHeader));
+    _pages = (SmallPage *)(_base + header_size);
+    _first_page = _base + first_page;
+
+    if(!_restored || _small_header->_magic != SMALL_HEAP_MAGIC)
+    {
+        _small_header->_carved_count = 0;
+        _small_header->_free_pages = 0;
+        for(u32 index = 0; index < SMALL_CLASS_COUNT; ++index)
+        {
+            _small_header->_partial[index] = 0;
+        }
+        // NOTE: the arena is fully used by the pages, _used is not moved after this
+        _used = _size;
+    }
+    _small_header->_magic = 0;
+}
+
+SmallHeap::~SmallHeap()
+{
+    _small_header->_magic = SMALL_HEAP_MAGIC;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - SmallHeap::allocate(u64 size)
+[IN ]:
+        - size (u64): number of bytes to allocate, at most SMALL_MAX_SIZE
+[OUT]:
+        - data (u8 *): pointer to the new allocated data
+-----------------------------------------------------*/
+u8 *SmallHeap::allocate(u64 size)
+{
+    assert(size <= SMALL_MAX_SIZE);
+    u32 size_class = get_class(size);
+
+    SmallPage *page = get_page(_small_header->_partial[size_class]);
+    if(!page)
+    {
+        page = carve_page(size_class);
+        add_page_to_partial(page);
+    }
+
+    u8 *data = 0;
+    if(page->_free != SMALL_SLOT_NONE)
+    {
+        data = get_page_data(page) + page->_free;
+        page->_free = *(u32 *)data;
+    }
+    else
+    {
+        data = get_page_data(page) + page->_bump;
+        page->_bump += size_class_size[size_class];
+    }
+    ++page->_used_count;
+
+    if(page_is_full(page))
+    {
+        remove_page_from_partial(page);
+    }
+    return data;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - SmallHeap::deallocate(u8 *data)
+[DES]:  - the size class is found from the page descriptor, not from the data
+[IN ]:
+        - data (u8 *): already allocated pointer to be free
+-----------------------------------------------------*/
+void SmallHeap::deallocate(u8 *data)
+{
+    assert(owns(data));
+    SmallPage *page = &_pages[(u64)(data - _first_page) >> SMALL_PAGE_SHIFT];
+    assert(page->_class != SMALL_PAGE_UNUSED && page->_used_count > 0);
+
+    bool was_full = page_is_full(page);
+    u32 slot = (u32)(data - get_page_data(page));
+    *(u32 *)data = page->_free;
+    page->_free = slot;
+    --page->_used_count;
+
+    if(page->_used_count == 0)
+    {
+        // NOTE: empty pages go back to the free pages, any class can reuse them
+        if(!was_full) remove_page_from_partial(page);
+        page->_class = SMALL_PAGE_UNUSED;
+        page->_next = _small_header->_free_pages;
+        _small_header->_free_pages = (u32)(page - _pages) + 1;
+    }
+    else if(was_full)
+    {
+        add_page_to_partial(page);
+    }
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - SmallHeap::deallocate(u8 *data, u64 size)
+[DES]:  - sized free, the size class comes from (size) and is checked
+          against the page descriptor
+[IN ]:
+        - data (u8 *): already allocated pointer to be free
+        - size (u64): size used to allocate the pointer
+-----------------------------------------------------*/
+void SmallHeap::deallocate(u8 *data, u64 size)
+{
+    assert(_pages[(u64)(data - _first_page) >> SMALL_PAGE_SHIFT]._class == get_class(size));
+    deallocate(data);
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - SmallHeap::owns(u8 *data)
+[OUT]:
+        - owns (bool): true if (data) is inside the pages of this heap
+-----------------------------------------------------*/
+bool SmallHeap::owns(u8 *data)
+{
+    return data >= _first_page && data < _first_page + (u64)_page_count * SMALL_PAGE_SIZE;
+}
+
+u64 SmallHeap::get_slot_size(u8 *data)
+{
+    SmallPage *page = &_pages[(u64)(data - _first_page) >> SMALL_PAGE_SHIFT];
+    return size_class_size[page->_class];
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - SmallHeap::get_used()
+[DES]:  - the arena is taken whole by the pages, this counts the headers
+          and the pages carved so far with their descriptors
+[OUT]:
+        - used (u64): number of bytes in use
+-----------------------------------------------------*/
+u64 SmallHeap::get_used()
+{
+    u64 header_size = sizeof(ArenaHeader) + sizeof(SmallHeapHeader);
+    return header_size + (u64)_small_header->_carved_count * (sizeof(SmallPage) + SMALL_PAGE_SIZE);
+}
+
+///////////////////////////////////////////////////////
+//      SmallHeap methods:
+//      Private
+///////////////////////////////////////////////////////
+
+u32 SmallHeap::get_class(u64 size)
+{
+    return size_class_from_granule[(size + 7) >> 3];
+}
+
+SmallPage *SmallHeap::get_page(u32 index)
+{
+    return index ? &_pages[index - 1] : 0;
+}
+
+u8 *SmallHeap::get_page_data(SmallPage *page)
+{
+    return _first_page + ((u64)(page - _pages) << SMALL_PAGE_SHIFT);
+}
+
+bool SmallHeap::page_is_full(SmallPage *page)
+{
+    return page->_free == SMALL_SLOT_NONE &&
+           page->_bump + size_class_size[page->_class] > SMALL_PAGE_SIZE;
+}
+
+SmallPage *SmallHeap::carve_page(u32 size_class)
+{
+    Tracer::instant("SmallHeap::carve_page", size_class);
+    SmallPage *page = get_page(_small_header->_free_pages);
+    if(page)
+    {
+        _small_header->_free_pages = page->_next;
+    }
+    else
+    {
+        assert(_small_header->_carved_count < _page_count);
+        page = &_pages[_small_header->_carved_count++];
+    }
+    page->_class = size_class;
+    page->_used_count = 0;
+    page->_free = SMALL_SLOT_NONE;
+    page->_bump = 0;
+    page->_next = 0;
+    page->_prev = 0;
+    return page;
+}
+
+void SmallHeap::add_page_to_partial(SmallPage *page)
+{
+    u32 index = (u32)(page - _pages) + 1;
+    u32 *head = &_small_header->_partial[page->_class];
+    page->_prev = 0;
+    page->_next = *head;
+    if(*head) get_page(*head)->_prev = index;
+    *head = index;
+}
+
+void SmallHeap::remove_page_from_partial(SmallPage *page)
+{
+    if(page->_prev)
+    {
+        get_page(page->_prev)->_next = page->_next;
+    }
+    else
+    {
+        _small_header->_partial[page->_class] = page->_next;
+    }
+    if(page->_next) get_page(page->_next)->_prev = page->_prev;
+    page->_next = 0;
+    page->_prev = 0;
+}
+
+};
@@ -0,0 +1,121 @@
+#ifndef SMALL_HEAP_H
+#define SMALL_HEAP_H
+
+#include "arena.h"
+#include "size_classes.h"
+
+namespace mem
+{
+
+#define SMALL_PAGE_SHIFT 14
+#define SMALL_PAGE_SIZE (1ULL << SMALL_PAGE_SHIFT)
+// NOTE: the size classes come from size_classes.h, generated from a recorded
+// SizeHistogram by size_class_gen.exe
+#define SMALL_MAX_SIZE SIZE_CLASS_MAX_SIZE
+#define SMALL_CLASS_COUNT SIZE_CLASS_COUNT
+#define SMALL_SLOT_NONE 0xFFFFFFFF
+#define SMALL_PAGE_UNUSED 0xFFFFFFFF
+#define SMALL_HEAP_MAGIC (0x4C414D53ULL | (SIZE_CLASS_TABLE_ID << 32))
+
+/*@docs------------------------------------------------
+[DES]:  - out of band descriptor of a page, all the slots of a page have the
+          same size class so the slots don't need any header, page links are
+          page index + 1 (0 means no page) and slot links are offsets in the page
+-----------------------------------------------------*/
+struct SmallPage
+{
+    u32 _class;
+    u32 _used_count;
+    u32 _free;
+    u32 _bump;
+    u32 _next;
+    u32 _prev;
+};
+
+struct SmallHeapHeader
+{
+    u64 _magic;
+    u32 _carved_count;
+    u32 _free_pages;
+    u32 _partial[SMALL_CLASS_COUNT];
+};
+
+class SmallHeap : public Arena
+{
+public:
+    /*@docs------------------------------------------------
+    [FNC]:  - SmallHeap(Memory *mem, u64 size)
+    [DES]:  - carves the arena in SMALL_PAGE_SIZE pages plus a descriptor
+              array indexed by page, a file backed heap is restored like Heap
+    [IN ]:
+            - mem (Memory *): pointer to a memory object
+            - size (u64): total size of the heap in bytes
+    [OUT]:
+            - heap (SmallHeap): new SmallHeap object
+    -----------------------------------------------------*/
+    SmallHeap(Memory *mem, u64 size);
+    ~SmallHeap();
+
+    /*@docs------------------------------------------------
+    [FNC]:  - SmallHeap::allocate(u64 size)
+    [IN ]:
+            - size (u64): number of bytes to allocate, at most SMALL_MAX_SIZE
+    [OUT]:
+            - data (u8 *): pointer to the new allocated data
+    -----------------------------------------------------*/
+    u8 *allocate(u64 size);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - SmallHeap::deallocate(u8 *data)
+    [DES]:  - the size class is found from the page descriptor, not from the data
+    [IN ]:
+            - data (u8 *): already allocated pointer to be free
+    -----------------------------------------------------*/
+    void deallocate(u8 *data);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - SmallHeap::deallocate(u8 *data, u64 size)
+    [DES]:  - sized free, the size class comes from (size) and is checked
+              against the page descriptor
+    [IN ]:
+            - data (u8 *): already allocated pointer to be free
+            - size (u64): size used to allocate the pointer
+    -----------------------------------------------------*/
+    void deallocate(u8 *data, u64 size);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - SmallHeap::owns(u8 *data)
+    [OUT]:
+            - owns (bool): true if (data) is inside the pages of this heap
+    -----------------------------------------------------*/
+    bool owns(u8 *data);
+
+    u64 get_slot_size(u8 *data);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - SmallHeap::get_used()
+    [DES]:  - the arena is taken whole by the pages, this counts the headers
+              and the pages carved so far with their descriptors
+    [OUT]:
+            - used (u64): number of bytes in use
+    -----------------------------------------------------*/
+    u64 get_used();
+
+private:
+    SmallHeapHeader *_small_header;
+    SmallPage *_pages;
+    u8 *_first_page;
+    u32 _page_count;
+
+    u32 get_class(u64 size);
+    SmallPage *get_page(u32 index);
+    u8 *get_page_data(SmallPage *page);
+    bool page_is_full(SmallPage *page);
+    SmallPage *carve_page(u32 size_class);
+    void add_page_to_partial(SmallPage *page);
+    void remove_page_from_partial(SmallPage *page);
+};
+
+};
+
+#endif // SMALL_HEAP_H
@@ -0,0 +1,182 @@
+#ifndef SOA_STORE_H
+#define SOA_STORE_H
+
+#include "arena.h"
+#include <stddef.h>
+#include <tuple>
+#include <utility>
+#include <type_traits>
+#include <assert.h>
+
+namespace mem
+{
+
+// NOTE: a handle is (generation << SOA_HANDLE_INDEX_BITS) | index, the
+// generation of a slot never is 0 so the 0 handle is never alive
+#define SOA_HANDLE_INDEX_BITS 20
+#define SOA_HANDLE_INDEX_MASK ((1u << SOA_HANDLE_INDEX_BITS) - 1)
+#define SOA_HANDLE_GENERATION_MASK ((1u << (32 - SOA_HANDLE_INDEX_BITS)) - 1)
+#define SOA_MAX_CAPACITY SOA_HANDLE_INDEX_MASK
+#define SOA_HANDLE_NONE 0
+#define SOA_ARRAY_ALIGNMENT 64
+#define SOA_INDEX_NONE 0xFFFFFFFF
+
+/*@docs------------------------------------------------
+[DES]:  - structure of arrays store, every field type of (Fields) has its
+          own dense array in the arena so a loop over one field only
+          touches that field, entities are named by 32-bit generational
+          handles, a stale handle is detected after the entity is destroyed,
+          destroy moves the last entity in the hole so the arrays stay dense
+          and the dense order of the entities changes
+-----------------------------------------------------*/
+template <typename... Fields>
+class SoaStore
+{
+    static_assert((std::is_trivially_copyable<Fields>::value && ...), "SoaStore needs trivially copyable fields");
+
+public:
+    template <u32 F>
+    using Field = typename std::tuple_element<F, std::tuple<Fields...>>::type;
+
+    /*@docs------------------------------------------------
+    [FNC]:  - SoaStore(Arena *arena, u32 capacity)
+    [DES]:  - pushes all the arrays in (arena) at once, they never grow
+    [IN ]:
+            - arena (Arena *): arena the arrays are pushed in
+            - capacity (u32): max number of alive entities
+    [OUT]:
+            - store (SoaStore): new SoaStore object
+    -----------------------------------------------------*/
+    SoaStore(Arena *arena, u32 capacity)
+    {
+        assert(capacity > 0 && capacity <= SOA_MAX_CAPACITY);
+        _arrays = std::tuple<Fields *...>((Fields *)arena->push_aligned(capacity * sizeof(Fields), SOA_ARRAY_ALIGNMENT)...);
+        _dense = (u32 *)arena->push_aligned(capacity * sizeof(u32), alignof(u32));
+        _sparse = (u32 *)arena->push_aligned(capacity * sizeof(u32), alignof(u32));
+        _handles = (u32 *)arena->push_aligned(capacity * sizeof(u32), alignof(u32));
+        for(u32 index = 0; index < capacity; ++index)
+        {
+            _handles[index] = (1u << SOA_HANDLE_INDEX_BITS) | index;
+            _sparse[index] = index + 1 < capacity ? index + 1 : SOA_INDEX_NONE;
+        }
+        _capacity = capacity;
+        _count = 0;
+        _free = 0;
+    }
+
+    /*@docs------------------------------------------------
+    [FNC]:  - SoaStore::create()
+    [DES]:  - the fields of the new entity are not initialized
+    [OUT]:
+            - handle (u32): handle of the new entity, SOA_HANDLE_NONE if full
+    -----------------------------------------------------*/
+    u32 create()
+    {
+        if(_free == SOA_INDEX_NONE) return SOA_HANDLE_NONE;
+        u32 slot = _free;
+        _free = _sparse[slot];
+        _sparse[slot] = _count;
+        _dense[_count++] = slot;
+        return _handles[slot];
+    }
+
+    /*@docs------------------------------------------------
+    [FNC]:  - SoaStore::destroy(u32 handle)
+    [DES]:  - swap remove, the last entity of the arrays takes the place of
+              the destroyed one, the handle of the slot gets a new generation
+    [IN ]:
+            - handle (u32): handle of an alive entity
+    -----------------------------------------------------*/
+    void destroy(u32 handle)
+    {
+        assert(is_alive(handle));
+        u32 slot = handle & SOA_HANDLE_INDEX_MASK;
+        u32 index = _sparse[slot];
+        u32 last = --_count;
+        if(index != last)
+        {
+            move_fields(index, last, std::index_sequence_for<Fields...>());
+            _dense[index] = _dense[last];
+            _sparse[_dense[index]] = index;
+        }
+
+        u32 generation = ((handle >> SOA_HANDLE_INDEX_BITS) + 1) & SOA_HANDLE_GENERATION_MASK;
+        if(!generation) generation = 1;
+        _handles[slot] = (generation << SOA_HANDLE_INDEX_BITS) | slot;
+        _sparse[slot] = _free;
+        _free = slot;
+    }
+
+    bool is_alive(u32 handle)
+    {
+        // NOTE: a free slot already holds the next handle, after the
+        // generations wrap a stale handle can match it, the dense array
+        // tells if the slot is really in use
+        u32 slot = handle & SOA_HANDLE_INDEX_MASK;
+        if(slot >= _capacity || _handles[slot] != handle || handle == SOA_HANDLE_NONE) return false;
+        u32 index = _sparse[slot];
+        return index < _count && _dense[index] == slot;
+    }
+
+    /*@docs------------------------------------------------
+    [FNC]:  - SoaStore::get<F>(u32 handle)
+    [OUT]:
+            - field (Field<F> *): field (F) of the entity, valid until an
+              entity is destroyed
+    -----------------------------------------------------*/
+    template <u32 F>
+    Field<F> *get(u32 handle)
+    {
+        assert(is_alive(handle));
+        return &std::get<F>(_arrays)[_sparse[handle & SOA_HANDLE_INDEX_MASK]];
+    }
+
+    /*@docs------------------------------------------------
+    [FNC]:  - SoaStore::get_array<F>()
+    [OUT]:
+            - array (Field<F> *): dense array of the field (F), get_count()
+              elements aligned to SOA_ARRAY_ALIGNMENT
+    -----------------------------------------------------*/
+    template <u32 F>
+    Field<F> *get_array()
+    {
+        return std::get<F>(_arrays);
+    }
+
+    /*@docs------------------------------------------------
+    [FNC]:  - SoaStore::get_handle(u32 index)
+    [IN ]:
+            - index (u32): dense index, less than get_count()
+    [OUT]:
+            - handle (u32): handle of the entity at (index)
+    -----------------------------------------------------*/
+    u32 get_handle(u32 index)
+    {
+        assert(index < _count);
+        return _handles[_dense[index]];
+    }
+
+    u32 get_count() { return _count; }
+    u32 get_capacity() { return _capacity; }
+
+private:
+    std::tuple<Fields *...> _arrays;
+    // NOTE: dense index -> slot, slot -> dense index (or next free slot),
+    // slot -> current handle
+    u32 *_dense;
+    u32 *_sparse;
+    u32 *_handles;
+    u32 _capacity;
+    u32 _count;
+    u32 _free;
+
+    template <size_t... I>
+    void move_fields(u32 to, u32 from, std::index_sequence<I...>)
+    {
+        ((std::get<I>(_arrays)[to] = std::get<I>(_arrays)[from]), ...);
+    }
+};
+
+};
+
+#endif // SOA_STORE_H
@@ -0,0 +1,179 @@
+#include "sub_heap.h"
+#include "tracer.h"
+#include <new>
+#include <assert.h>
+
+namespace mem
+{
+
+// NOTE: bytes of a chunk that are not usable by the allocations
+#define SUB_HEAP_CHUNK_OVERHEAD (align8(sizeof(SubHeapChunk)) + sizeof(ArenaHeader) + sizeof(HeapHeader) + sizeof(Block))
+
+///////////////////////////////////////////////////////
+//      SubHeap methods:
+//      Public interface
+///////////////////////////////////////////////////////
+
+/*@docs------------------------------------------------
+[FNC]:  - SubHeap(Heap *parent, u64 chunk_size)
+[DES]:  - the chunks are blocks of (parent), they go back with deallocate
+[IN ]:
+        - parent (Heap *): heap the chunks are allocated from
+        - chunk_size (u64): size of the chunks taken from (parent)
+[OUT]:
+        - heap (SubHeap): new SubHeap object, no chunk is taken yet
+-----------------------------------------------------*/
+SubHeap::SubHeap(Heap *parent, u64 chunk_size)
+{
+    assert(chunk_size > SUB_HEAP_CHUNK_OVERHEAD);
+    _parent_heap = parent;
+    _parent_arena = 0;
+    _chunk_size = chunk_size;
+    _chunks = 0;
+    _arena_marker = 0;
+    _arena_end = 0;
+    _stats = {};
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - SubHeap(Arena *parent, u64 chunk_size)
+[DES]:  - the chunks are pushed in (parent), they go back with one
+          pop_to_marker so nothing else can be pushed in (parent) while
+          the sub heap has chunks
+[IN ]:
+        - parent (Arena *): arena the chunks are pushed in
+        - chunk_size (u64): size of the chunks pushed in (parent)
+[OUT]:
+        - heap (SubHeap): new SubHeap object, no chunk is taken yet
+-----------------------------------------------------*/
+SubHeap::SubHeap(Arena *parent, u64 chunk_size)
+{
+    assert(chunk_size > SUB_HEAP_CHUNK_OVERHEAD);
+    _parent_heap = 0;
+    _parent_arena = parent;
+    _chunk_size = chunk_size;
+    _chunks = 0;
+    _arena_marker = 0;
+    _arena_end = 0;
+    _stats = {};
+}
+
+SubHeap::~SubHeap()
+{
+    reset();
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - SubHeap::allocate(u64 size)
+[DES]:  - tries the chunks from the newest one, a new chunk big enough
+          for (size) is taken when they are all full
+[IN ]:
+        - size (u64): number of bytes to allocate
+[OUT]:
+        - data (u8 *): pointer to the new allocated data
+-----------------------------------------------------*/
+u8 *SubHeap::allocate(u64 size)
+{
+    for(SubHeapChunk *chunk = _chunks; chunk; chunk = chunk->_next)
+    {
+        u8 *data = chunk->_heap.try_allocate(size);
+        if(data) return data;
+    }
+
+    u64 chunk_size = SUB_HEAP_CHUNK_OVERHEAD + align8(size);
+    SubHeapChunk *chunk = add_chunk(chunk_size > _chunk_size ? chunk_size : _chunk_size);
+    u8 *data = chunk->_heap.try_allocate(size);
+    assert(data);
+    return data;
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - SubHeap::deallocate(u8 *data)
+[IN ]:
+        - data (u8 *): pointer allocated by this sub heap
+-----------------------------------------------------*/
+void SubHeap::deallocate(u8 *data)
+{
+    find_chunk(data)->_heap.deallocate(data);
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - SubHeap::reset()
+[DES]:  - frees everything allocated in the sub heap by giving its
+          chunks back to the parent, the cost depends on the number of
+          chunks and not on the number of allocations
+-----------------------------------------------------*/
+void SubHeap::reset()
+{
+    TraceScope trace("SubHeap::reset");
+    if(!_chunks) return;
+
+    // NOTE: ~Heap is not called on the chunks, it only saves the state of
+    // the heap in its header for a restore and the region is given back
+    if(_parent_heap)
+    {
+        SubHeapChunk *chunk = _chunks;
+        while(chunk)
+        {
+            SubHeapChunk *next = chunk->_next;
+            _parent_heap->deallocate((u8 *)chunk);
+            chunk = next;
+        }
+    }
+    else
+    {
+        assert(_parent_arena->get_marker() == _arena_end);
+        _parent_arena->pop_to_marker(_arena_marker);
+    }
+    _chunks = 0;
+    _stats = {};
+}
+
+SubHeapStats SubHeap::get_stats()
+{
+    return _stats;
+}
+
+///////////////////////////////////////////////////////
+//      SubHeap methods:
+//      Private
+///////////////////////////////////////////////////////
+
+SubHeapChunk *SubHeap::add_chunk(u64 size)
+{
+    u8 *data;
+    if(_parent_heap)
+    {
+        data = _parent_heap->allocate(size);
+        assert(data);
+    }
+    else
+    {
+        if(!_chunks) _arena_marker = _parent_arena->get_marker();
+        data = _parent_arena->push_aligned(size, alignof(SubHeapChunk));
+        _arena_end = _parent_arena->get_marker();
+    }
+
+    u64 header_size = align8(sizeof(SubHeapChunk));
+    SubHeapChunk *chunk = (SubHeapChunk *)data;
+    new (&chunk->_heap) Heap(data + header_size, size - header_size);
+    chunk->_size = size;
+    chunk->_next = _chunks;
+    _chunks = chunk;
+    ++_stats._chunks;
+    _stats._bytes += size;
+    return chunk;
+}
+
+SubHeapChunk *SubHeap::find_chunk(u8 *data)
+{
+    SubHeapChunk *chunk = _chunks;
+    while(chunk && !chunk->_heap.owns(data))
+    {
+        chunk = chunk->_next;
+    }
+    assert(chunk);
+    return chunk;
+}
+
+};
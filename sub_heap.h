@@ -0,0 +1,105 @@
+#ifndef SUB_HEAP_H
+#define SUB_HEAP_H
+
+#include "heap.h"
+
+namespace mem
+{
+
+#define SUB_HEAP_DEFAULT_CHUNK_SIZE KB(64)
+
+/*@docs------------------------------------------------
+[DES]:  - one region taken from the parent, the child Heap lives at its
+          start and manages the bytes after it
+-----------------------------------------------------*/
+struct SubHeapChunk
+{
+    Heap _heap;
+    SubHeapChunk *_next;
+    u64 _size;
+};
+
+struct SubHeapStats
+{
+    u64 _chunks;
+    u64 _bytes;
+};
+
+/*@docs------------------------------------------------
+[DES]:  - child heap inside a parent Heap or Arena, it has its own freelists
+          in chunks taken from the parent and grows by taking more chunks,
+          reset gives every chunk back at once without touching the blocks
+          allocated in it, the parent must outlive the sub heap
+-----------------------------------------------------*/
+class SubHeap
+{
+public:
+    /*@docs------------------------------------------------
+    [FNC]:  - SubHeap(Heap *parent, u64 chunk_size)
+    [DES]:  - the chunks are blocks of (parent), they go back with deallocate
+    [IN ]:
+            - parent (Heap *): heap the chunks are allocated from
+            - chunk_size (u64): size of the chunks taken from (parent)
+    [OUT]:
+            - heap (SubHeap): new SubHeap object, no chunk is taken yet
+    -----------------------------------------------------*/
+    SubHeap(Heap *parent, u64 chunk_size = SUB_HEAP_DEFAULT_CHUNK_SIZE);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - SubHeap(Arena *parent, u64 chunk_size)
+    [DES]:  - the chunks are pushed in (parent), they go back with one
+              pop_to_marker so nothing else can be pushed in (parent) while
+              the sub heap has chunks
+    [IN ]:
+            - parent (Arena *): arena the chunks are pushed in
+            - chunk_size (u64): size of the chunks pushed in (parent)
+    [OUT]:
+            - heap (SubHeap): new SubHeap object, no chunk is taken yet
+    -----------------------------------------------------*/
+    SubHeap(Arena *parent, u64 chunk_size = SUB_HEAP_DEFAULT_CHUNK_SIZE);
+    ~SubHeap();
+
+    /*@docs------------------------------------------------
+    [FNC]:  - SubHeap::allocate(u64 size)
+    [DES]:  - tries the chunks from the newest one, a new chunk big enough
+              for (size) is taken when they are all full
+    [IN ]:
+            - size (u64): number of bytes to allocate
+    [OUT]:
+            - data (u8 *): pointer to the new allocated data
+    -----------------------------------------------------*/
+    u8 *allocate(u64 size);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - SubHeap::deallocate(u8 *data)
+    [IN ]:
+            - data (u8 *): pointer allocated by this sub heap
+    -----------------------------------------------------*/
+    void deallocate(u8 *data);
+
+    /*@docs------------------------------------------------
+    [FNC]:  - SubHeap::reset()
+    [DES]:  - frees everything allocated in the sub heap by giving its
+              chunks back to the parent, the cost depends on the number of
+              chunks and not on the number of allocations
+    -----------------------------------------------------*/
+    void reset();
+
+    SubHeapStats get_stats();
+
+private:
+    Heap *_parent_heap;
+    Arena *_parent_arena;
+    u64 _chunk_size;
+    SubHeapChunk *_chunks;
+    u64 _arena_marker;
+    u64 _arena_end;
+    SubHeapStats _stats;
+
+    SubHeapChunk *add_chunk(u64 size);
+    SubHeapChunk *find_chunk(u8 *data);
+};
+
+};
+
+#endif // SUB_HEAP_H
@@ -0,0 +1,225 @@
+#include "tracer.h"
+#include <Windows.h>
+#include <intrin.h>
+#include <stdio.h>
+#include <assert.h>
+
+namespace mem
+{
+
+/*@docs------------------------------------------------
+[DES]:  - buffer of the thread in the tracer with id (_owner), (_buffer) is
+          0 if the tracer had no buffer left for the thread
+-----------------------------------------------------*/
+struct TraceThreadCache
+{
+    u64 _owner;
+    TraceBuffer *_buffer;
+};
+
+static thread_local TraceThreadCache trace_thread_cache;
+static std::atomic<u64> trace_next_tracer_id(1);
+
+std::atomic<Tracer *> Tracer::_current(0);
+
+static u64 query_counter()
+{
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return counter.QuadPart;
+}
+
+static const char *trace_phase(u32 type)
+{
+    switch(type)
+    {
+        case TRACE_EVENT_BEGIN: return "B";
+        case TRACE_EVENT_END: return "E";
+        case TRACE_EVENT_INSTANT: return "i";
+        default: return "C";
+    }
+}
+
+///////////////////////////////////////////////////////
+//      Tracer methods:
+//      Public interface
+///////////////////////////////////////////////////////
+
+/*@docs------------------------------------------------
+[FNC]:  - Tracer(Memory *mem, u32 thread_count, u32 event_count)
+[DES]:  - the ring buffers are taken from (mem), the threads after the
+          first (thread_count) ones are not traced
+[IN ]:
+        - mem (Memory *): pointer to a memory object
+        - thread_count (u32): max number of traced threads
+        - event_count (u32): events per thread, a power of two
+[OUT]:
+        - tracer (Tracer): new Tracer object
+-----------------------------------------------------*/
+Tracer::Tracer(Memory *mem, u32 thread_count, u32 event_count) :
+    _arena(mem, sizeof(ArenaHeader) + thread_count * (sizeof(TraceBuffer) + (u64)event_count * sizeof(TraceEvent)))
+{
+    assert(thread_count > 0);
+    assert(event_count > 0 && (event_count & (event_count - 1)) == 0);
+    _buffers = (TraceBuffer *)_arena.push_size(thread_count * sizeof(TraceBuffer));
+    for(u32 index = 0; index < thread_count; ++index)
+    {
+        _buffers[index]._thread_id = 0;
+        _buffers[index]._head = 0;
+        _buffers[index]._events = (TraceEvent *)_arena.push_size((u64)event_count * sizeof(TraceEvent));
+    }
+    _buffer_count = 0;
+    _thread_count = thread_count;
+    _event_mask = event_count - 1;
+    _id = trace_next_tracer_id.fetch_add(1);
+    _dropped = 0;
+    _start_timestamp = __rdtsc();
+    _start_counter = query_counter();
+}
+
+Tracer::~Tracer()
+{
+    Tracer *tracer = this;
+    _current.compare_exchange_strong(tracer, 0, std::memory_order_acq_rel);
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Tracer::set_current(Tracer *tracer)
+[DES]:  - tracer the events of all the threads go to, 0 stops tracing,
+          a thread can still be recording in the old tracer after the
+          call so it must live until the threads are past their events
+[IN ]:
+        - tracer (Tracer *): tracer or 0
+-----------------------------------------------------*/
+void Tracer::set_current(Tracer *tracer)
+{
+    // NOTE: release so a thread that sees the tracer sees it constructed
+    _current.store(tracer, std::memory_order_release);
+}
+
+Tracer *Tracer::get_current()
+{
+    return _current.load(std::memory_order_acquire);
+}
+
+/*@docs------------------------------------------------
+[FNC]:  - Tracer::write_chrome_json(const char *path)
+[DES]:  - writes the events of all the threads, the traced threads must
+          be stopped or not recording anymore
+[IN ]:
+        - path (const char *): output file
+[OUT]:
+        - ok (bool): false if the file can't be written
+-----------------------------------------------------*/
+bool Tracer::write_chrome_json(const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if(!file) return false;
+
+    // NOTE: the TSC rate is measured against the performance counter over
+    // the whole life of the tracer
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    f64 seconds = (f64)(query_counter() - _start_counter) / (f64)frequency.QuadPart;
+    u64 ticks = __rdtsc() - _start_timestamp;
+    f64 ticks_per_us = seconds > 0.0 && ticks ? (f64)ticks / (seconds * 1000000.0) : 1.0;
+
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    bool first = true;
+    u32 buffer_count = _buffer_count < _thread_count ? (u32)_buffer_count : _thread_count;
+    for(u32 buffer_index = 0; buffer_index < buffer_count; ++buffer_index)
+    {
+        TraceBuffer *buffer = &_buffers[buffer_index];
+        u64 capacity = (u64)_event_mask + 1;
+        u64 start = buffer->_head > capacity ? buffer->_head - capacity : 0;
+        // NOTE: the end events whose begin was overwritten are skipped
+        u64 depth = 0;
+        for(u64 index = start; index < buffer->_head; ++index)
+        {
+            TraceEvent *event = &buffer->_events[index & _event_mask];
+            if(event->_type == TRACE_EVENT_END)
+            {
+                if(!depth) continue;
+                --depth;
+            }
+            else if(event->_type == TRACE_EVENT_BEGIN)
+            {
+                ++depth;
+            }
+
+            f64 us = (f64)(s64)(event->_timestamp - _start_timestamp) / ticks_per_us;
+            fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"%s\",\"pid\":1,\"tid\":%u,\"ts\":%.3lf",
+                    first ? "" : ",\n", event->_name, trace_phase(event->_type), buffer->_thread_id, us);
+            if(event->_type == TRACE_EVENT_INSTANT)
+            {
+                fprintf(file, ",\"s\":\"t\",\"args\":{\"value\":%llu}", event->_value);
+            }
+            else if(event->_type == TRACE_EVENT_COUNTER)
+            {
+                fprintf(file, ",\"id\":%u,\"args\":{\"value\":%llu}", event->_id, event->_value);
+            }
+            fprintf(file, "}");
+            first = false;
+        }
+    }
+    fprintf(file, "\n]}\n");
+
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
+
+TraceStats Tracer::get_stats()
+{
+    TraceStats stats = {};
+    u64 capacity = (u64)_event_mask + 1;
+    stats._threads = _buffer_count < _thread_count ? (u32)_buffer_count : _thread_count;
+    for(u64 buffer_index = 0; buffer_index < stats._threads; ++buffer_index)
+    {
+        u64 head = _buffers[buffer_index]._head;
+        stats._events += head;
+        if(head > capacity) stats._overwritten += head - capacity;
+    }
+    stats._dropped = _dropped;
+    return stats;
+}
+
+///////////////////////////////////////////////////////
+//      Tracer methods:
+//      Private
+///////////////////////////////////////////////////////
+
+void Tracer::push(u32 type, const char *name, u64 value, u32 id)
+{
+    TraceThreadCache *cache = &trace_thread_cache;
+    if(cache->_owner != _id)
+    {
+        cache->_owner = _id;
+        cache->_buffer = get_thread_buffer();
+    }
+    TraceBuffer *buffer = cache->_buffer;
+    if(!buffer)
+    {
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    TraceEvent *event = &buffer->_events[buffer->_head & _event_mask];
+    event->_timestamp = __rdtsc();
+    event->_name = name;
+    event->_value = value;
+    event->_type = type;
+    event->_id = id;
+    ++buffer->_head;
+}
+
+TraceBuffer *Tracer::get_thread_buffer()
+{
+    u32 index = _buffer_count.fetch_add(1);
+    if(index >= _thread_count) return 0;
+    TraceBuffer *buffer = &_buffers[index];
+    buffer->_thread_id = GetCurrentThreadId();
+    return buffer;
+}
+
+};
@@ -0,0 +1,173 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include "arena.h"
+#include <atomic>
+
+namespace mem
+{
+
+#define TRACE_EVENT_BEGIN 0
+#define TRACE_EVENT_END 1
+#define TRACE_EVENT_INSTANT 2
+#define TRACE_EVENT_COUNTER 3
+#define TRACE_DEFAULT_THREADS 64
+#define TRACE_DEFAULT_EVENTS 65536
+
+/*@docs------------------------------------------------
+[DES]:  - fixed size event, (_timestamp) is the TSC of the event, (_name)
+          must be a string literal (only the pointer is kept), (_value) and
+          (_id) are the value and the series of a counter
+-----------------------------------------------------*/
+struct TraceEvent
+{
+    u64 _timestamp;
+    const char *_name;
+    u64 _value;
+    u32 _type;
+    u32 _id;
+};
+
+/*@docs------------------------------------------------
+[DES]:  - ring buffer of one thread, only its thread writes it, (_head) is
+          the number of events ever pushed, the oldest ones are overwritten
+-----------------------------------------------------*/
+struct TraceBuffer
+{
+    u32 _thread_id;
+    u32 _pad;
+    u64 _head;
+    TraceEvent *_events;
+};
+
+struct TraceStats
+{
+    u64 _threads;
+    u64 _events;
+    u64 _overwritten;
+    u64 _dropped;
+};
+
+/*@docs------------------------------------------------
+[DES]:  - event tracer, every thread gets its own ring buffer the first
+          time it records an event so recording never takes a lock, the
+          calls do nothing while there is no current tracer so the hooks of
+          the allocators stay compiled in, the timeline is written after
+          the run in the Chrome trace format (chrome://tracing, Perfetto),
+          a tracer must outlive the recording of every thread, the
+          destructor doesn't wait for them
+-----------------------------------------------------*/
+class Tracer
+{
+public:
+    /*@docs------------------------------------------------
+    [FNC]:  - Tracer(Memory *mem, u32 thread_count, u32 event_count)
+    [DES]:  - the ring buffers are taken from (mem), the threads after the
+              first (thread_count) ones are not traced
+    [IN ]:
+            - mem (Memory *): pointer to a memory object
+            - thread_count (u32): max number of traced threads
+            - event_count (u32): events per thread, a power of two
+    [OUT]:
+            - tracer (Tracer): new Tracer object
+    -----------------------------------------------------*/
+    Tracer(Memory *mem, u32 thread_count, u32 event_count);
+    ~Tracer();
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Tracer::set_current(Tracer *tracer)
+    [DES]:  - tracer the events of all the threads go to, 0 stops tracing,
+              a thread can still be recording in the old tracer after the
+              call so it must live until the threads are past their events
+    [IN ]:
+            - tracer (Tracer *): tracer or 0
+    -----------------------------------------------------*/
+    static void set_current(Tracer *tracer);
+    static Tracer *get_current();
+
+    static void begin(const char *name)
+    {
+        Tracer *tracer = _current.load(std::memory_order_acquire);
+        if(tracer) tracer->push(TRACE_EVENT_BEGIN, name, 0, 0);
+    }
+
+    static void end(const char *name)
+    {
+        Tracer *tracer = _current.load(std::memory_order_acquire);
+        if(tracer) tracer->push(TRACE_EVENT_END, name, 0, 0);
+    }
+
+    static void instant(const char *name, u64 value)
+    {
+        Tracer *tracer = _current.load(std::memory_order_acquire);
+        if(tracer) tracer->push(TRACE_EVENT_INSTANT, name, value, 0);
+    }
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Tracer::counter(const char *name, u32 id, u64 value)
+    [DES]:  - new value of a counter, every (id) is its own series
+    [IN ]:
+            - name (const char *): string literal
+            - id (u32): series of the counter, the object it belongs to
+            - value (u64): value of the counter from now on
+    -----------------------------------------------------*/
+    static void counter(const char *name, u32 id, u64 value)
+    {
+        Tracer *tracer = _current.load(std::memory_order_acquire);
+        if(tracer) tracer->push(TRACE_EVENT_COUNTER, name, value, id);
+    }
+
+    /*@docs------------------------------------------------
+    [FNC]:  - Tracer::write_chrome_json(const char *path)
+    [DES]:  - writes the events of all the threads, the traced threads must
+              be stopped or not recording anymore
+    [IN ]:
+            - path (const char *): output file
+    [OUT]:
+            - ok (bool): false if the file can't be written
+    -----------------------------------------------------*/
+    bool write_chrome_json(const char *path);
+
+    TraceStats get_stats();
+
+private:
+    static std::atomic<Tracer *> _current;
+
+    Arena _arena;
+    TraceBuffer *_buffers;
+    std::atomic<u32> _buffer_count;
+    u32 _thread_count;
+    u32 _event_mask;
+    u64 _id;
+    u64 _start_timestamp;
+    u64 _start_counter;
+    std::atomic<u64> _dropped;
+
+    void push(u32 type, const char *name, u64 value, u32 id);
+    TraceBuffer *get_thread_buffer();
+};
+
+/*@docs------------------------------------------------
+[DES]:  - begin event now and end event when the scope ends
+-----------------------------------------------------*/
+class TraceScope
+{
+public:
+    TraceScope(const char *name)
+    {
+        _name = name;
+        Tracer::begin(name);
+    }
+
+    ~TraceScope()
+    {
+        Tracer::end(_name);
+    }
+
+private:
+    const char *_name;
+};
+
+};
+
+#endif // TRACER_H
@@ -0,0 +1,148 @@
+#ifndef VIRTUAL_ARRAY_H
+#define VIRTUAL_ARRAY_H
+
+#include "memory.h"
+#include <type_traits>
+#include <assert.h>
+
+namespace mem
+{
+
+// NOTE: the pages are committed and decommitted by this many bytes so a
+// push only calls the OS once per chunk
+#define VIRTUAL_ARRAY_COMMIT_SIZE KB(64)
+
+/*@docs------------------------------------------------
+[DES]:  - array that reserves the span for (max_count) elements once and
+          commits its pages as it grows, the elements never move so the
+          pointers to them stay valid for the life of the array and growing
+          never copies, with (decommit) the pages past the end go back to the
+          OS when the array shrinks by more than two commit chunks
+-----------------------------------------------------*/
+template <typename T>
+class VirtualArray
+{
+    static_assert(std::is_trivially_copyable<T>::value, "VirtualArray needs a trivially copyable type");
+
+public:
+    /*@docs------------------------------------------------
+    [FNC]:  - VirtualArray(Memory *mem, u64 max_count, bool decommit)
+    [IN ]:
+            - mem (Memory *): the span is reserved in (mem)
+            - max_count (u64): number of elements the array can ever hold
+            - decommit (bool): decommit the pages freed by a shrink
+    [OUT]:
+            - array (VirtualArray): new VirtualArray object, nothing is
+              committed yet
+    -----------------------------------------------------*/
+    VirtualArray(Memory *mem, u64 max_count, bool decommit = false)
+    {
+        assert(max_count > 0);
+        _memory = mem;
+        _reserved = max_count * sizeof(T);
+        _data = (T *)mem->reserve_span(_reserved);
+        _count = 0;
+        _committed = 0;
+        _decommit = decommit;
+    }
+
+    ~VirtualArray()
+    {
+        // NOTE: the whole span is decommitted, it can have come committed
+        // from the free spans of the Memory object
+        _memory->decommit_pages((u8 *)_data, _reserved);
+        _memory->free_span((u8 *)_data, _reserved, false);
+    }
+
+    // NOTE: a copy would decommit and free the span twice
+    VirtualArray(const VirtualArray &) = delete;
+    VirtualArray &operator=(const VirtualArray &) = delete;
+
+    /*@docs------------------------------------------------
+    [FNC]:  - VirtualArray::push(const T &value)
+    [IN ]:
+            - value (const T &): value copied at the end of the array
+    [OUT]:
+            - element (T *): pointer to the new element, always valid
+    -----------------------------------------------------*/
+    T *push(const T &value)
+    {
+        if((_count + 1) * sizeof(T) > _committed) reserve(_count + 1);
+        _data[_count] = value;
+        return &_data[_count++];
+    }
+
+    T pop()
+    {
+        assert(_count > 0);
+        T value = _data[--_count];
+        if(_decommit) trim();
+        return value;
+    }
+
+    /*@docs------------------------------------------------
+    [FNC]:  - VirtualArray::reserve(u64 count)
+    [DES]:  - commits the pages for (count) elements, the data doesn't move
+    [IN ]:
+            - count (u64): number of elements, at most the max count
+    -----------------------------------------------------*/
+    void reserve(u64 count)
+    {
+        u64 size = count * sizeof(T);
+        assert(size <= _reserved);
+        if(size <= _committed) return;
+        u64 committed = (size + VIRTUAL_ARRAY_COMMIT_SIZE - 1) & ~(VIRTUAL_ARRAY_COMMIT_SIZE - 1);
+        if(committed > _reserved) committed = _reserved;
+        _memory->commit_pages((u8 *)_data + _committed, committed - _committed);
+        _committed = committed;
+    }
+
+    void resize(u64 count)
+    {
+        reserve(count);
+        _count = count;
+        if(_decommit) trim();
+    }
+
+    void clear()
+    {
+        _count = 0;
+        if(_decommit) trim();
+    }
+
+    T &operator[](u64 index)
+    {
+        assert(index < _count);
+        return _data[index];
+    }
+
+    T *begin() { return _data; }
+    T *end() { return _data + _count; }
+    T *get_data() { return _data; }
+    u64 get_count() { return _count; }
+    u64 get_max_count() { return _reserved / sizeof(T); }
+    u64 get_committed() { return _committed; }
+
+private:
+    Memory *_memory;
+    T *_data;
+    u64 _count;
+    u64 _reserved;
+    u64 _committed;
+    bool _decommit;
+
+    void trim()
+    {
+        // NOTE: one chunk is kept past the end so a push after a pop at a
+        // chunk boundary doesn't commit it again
+        u64 size = (_count * sizeof(T) + VIRTUAL_ARRAY_COMMIT_SIZE - 1) & ~(VIRTUAL_ARRAY_COMMIT_SIZE - 1);
+        u64 keep = size + VIRTUAL_ARRAY_COMMIT_SIZE;
+        if(_committed < keep + VIRTUAL_ARRAY_COMMIT_SIZE) return;
+        _memory->decommit_pages((u8 *)_data + keep, _committed - keep);
+        _committed = keep;
+    }
+};
+
+};
+
+#endif // VIRTUAL_ARRAY_H